@@ -63,6 +63,7 @@ void ControlPanel::update_url_start_button_looking(bool start_status) const {
 void ControlPanel::custom_ready() {
     auto &ini = GuiInterface::Instance().ini_;
     dongle_name = ini[CONFIG_WIFI][WIFI_DEVICE];
+    diversity = ini[CONFIG_WIFI][WIFI_DIVERSITY] == "true";
     channel = std::stoi(ini[CONFIG_WIFI][WIFI_CHANNEL]);
     channelWidthMode = std::stoi(ini[CONFIG_WIFI][WIFI_CHANNEL_WIDTH_MODE]);
     keyPath = ini[CONFIG_WIFI][WIFI_GS_KEY];
@@ -139,6 +140,18 @@ void ControlPanel::custom_ready() {
             refresh_dongle_button_->connect_signal("triggered", callback2);
         }
 
+        {
+            auto diversity_btn = std::make_shared<revector::CheckButton>();
+            diversity_btn->set_text(FTR("all adapters"));
+            vbox_blockable->add_child(diversity_btn);
+            diversity_btn->set_toggled_no_signal(diversity);
+            auto callback = [this](const bool toggled) {
+                diversity = toggled;
+                GuiInterface::Instance().ini_[CONFIG_WIFI][WIFI_DIVERSITY] = toggled ? "true" : "false";
+            };
+            diversity_btn->connect_signal("toggled", callback);
+        }
+
         {
             auto hbox_container = std::make_shared<revector::HBoxContainer>();
             vbox_blockable->add_child(hbox_container);
@@ -300,6 +313,8 @@ void ControlPanel::custom_ready() {
                 GuiInterface::EnableAlink(enabled);
                 alink_con->set_collapse(!enabled);
 
+                GuiInterface::SetAlinkFecPolicy(GuiInterface::Instance().ini_[CONFIG_WIFI][WIFI_ALINK_FEC_POLICY]);
+
                 std::string tx_power = GuiInterface::Instance().ini_[CONFIG_WIFI][WIFI_ALINK_TX_POWER];
 
                 for (int idx = 0; idx < ALINK_TX_POWERS.size(); idx++) {
@@ -324,20 +339,21 @@ void ControlPanel::custom_ready() {
                 GuiInterface::Instance().is_using_wifi = true;
 
                 if (start) {
-                    std::optional<DeviceId> target_device_id;
+                    std::vector<DeviceId> target_device_ids;
                     for (auto &d : devices_) {
                         if (dongle_name == d.display_name) {
-                            target_device_id = d;
+                            target_device_ids.insert(target_device_ids.begin(), d);
+                        } else if (diversity) {
+                            target_device_ids.push_back(d);
                         }
                     }
+                    // Without the selected device there's no primary one.
+                    if (!target_device_ids.empty() && dongle_name != target_device_ids[0].display_name) {
+                        target_device_ids.clear();
+                    }
 
-                    if (target_device_id.has_value()) {
-                        bool res = GuiInterface::Start(target_device_id.value(), channel, channelWidthMode, keyPath);
-                        if (!res) {
-                            start = false;
-                        }
-                    } else {
-                        GuiInterface::Instance().ShowTip("Null device");
+                    bool res = GuiInterface::Start(target_device_ids, channel, channelWidthMode, keyPath);
+                    if (!res) {
                         start = false;
                     }
                 } else {
@@ -17,6 +17,8 @@ public:
 
     std::string dongle_name;
     std::optional<DeviceId> selected_dongle;
+    /// Receive with all adapters, the selected one first
+    bool diversity = false;
     uint32_t channel = 0;
     uint32_t channelWidthMode = 0;
     std::string keyPath;
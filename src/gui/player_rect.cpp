@@ -151,12 +151,16 @@ void PlayerRect::custom_ready() {
     hud_container_->add_child(pl_label_);
     fec_label_ = std::make_shared<revector::Label>();
     hud_container_->add_child(fec_label_);
+    antenna_label_ = std::make_shared<revector::Label>();
+    hud_container_->add_child(antenna_label_);
 #endif
 
     rx_status_update_timer = std::make_shared<revector::Timer>();
     add_child(rx_status_update_timer);
 
     auto callback = [this] {
+        GuiInterface::Instance().UpdateCount();
+
         lq_bar_->set_value(GuiInterface::Instance().link_quality_);
 
 #ifdef __linux__
@@ -167,9 +171,39 @@ void PlayerRect::custom_ready() {
             pl_label_->set_text(FTR("packet loss") + ": " +
                                 std::format("{:.1f}", GuiInterface::Instance().packet_loss_) + "%");
             fec_label_->set_text("FEC: " + std::to_string(GuiInterface::Instance().drone_fec_level_));
+
+            // Recent RSSI/SNR per antenna, marking the best one, then each adapter's own loss
+            const auto antennas = GuiInterface::GetAntennaStats();
+            std::string antenna_text;
+            for (size_t i = 0; i < antennas.antennas.size(); i++) {
+                const auto &antenna = antennas.antennas[i];
+                if (!antenna.active) {
+                    continue;
+                }
+                antenna_text += std::format("{}{}.{}: {:.0f} dBm {:.0f} dB\n",
+                                            (int)i == antennas.best ? "* " : "",
+                                            antenna.adapter,
+                                            antenna.antenna,
+                                            antenna.rssi_recent,
+                                            antenna.snr_recent);
+            }
+            if (antennas.adapters.size() > 1) {
+                for (const auto &adapter : antennas.adapters) {
+                    antenna_text += std::format("{} {}: {:.1f}%\n",
+                                                FTR("packet loss"),
+                                                adapter.adapter,
+                                                adapter.loss_ratio() * 100.f);
+                }
+            }
+            if (!antenna_text.empty()) {
+                antenna_text.pop_back();
+            }
+            antenna_label_->set_visibility(!antenna_text.empty());
+            antenna_label_->set_text(antenna_text);
         } else {
             pl_label_->set_visibility(false);
             fec_label_->set_visibility(false);
+            antenna_label_->set_visibility(false);
         }
 #endif
 
@@ -43,6 +43,8 @@ public:
 
     std::shared_ptr<revector::Label> fec_label_;
 
+    std::shared_ptr<revector::Label> antenna_label_;
+
     std::shared_ptr<SignalBar> lq_bar_;
 
     std::shared_ptr<revector::Label> video_info_label_;
@@ -4,9 +4,11 @@
 #include <mini/ini.h>
 #include <servers/translation_server.h>
 
+#include <atomic>
 #include <filesystem>
 #include <fstream>
 #include <future>
+#include <sstream>
 #include <nlohmann/json.hpp>
 
 #ifdef __linux__
@@ -15,6 +17,7 @@
 #endif
 
 #include "app.h"
+#include "wifi/rtp_ring.h"
 #include "wifi/wfbng_link.h"
 
 #define CONFIG_FILE "config.ini"
@@ -29,6 +32,12 @@
 #define WIFI_GS_KEY "key"
 #define WIFI_ALINK_ENABLED "alink_enabled"
 #define WIFI_ALINK_TX_POWER "alink_tx_power"
+#define WIFI_ALINK_FEC_POLICY "alink_fec_policy"
+#define WIFI_DIVERSITY "diversity"
+// Comma-separated radiotap captures to play back instead of receiving, one per adapter (Linux only)
+#define WIFI_REPLAY_CAPTURES "replay_captures"
+// Comma-separated <udp port>:<radio port> pairs to take wfb-ng forwarder streams on (Linux only)
+#define WIFI_FORWARDER_PORTS "forwarder_ports"
 
 #define CONFIG_LOCALHOST "localhost"
 #define CONFIG_LOCALHOST_PORT "port"
@@ -39,6 +48,7 @@
 #define CONFIG_SETTINGS_DARK_MODE "dark_mode"
 #define CONFIG_SETTINGS_MEDIA_BACKEND "media_backend"
 #define CONFIG_SETTINGS_RENDER_BACKEND "render_backend"
+#define CONFIG_SETTINGS_DAMAGED_FRAME_POLICY "damaged_frame_policy"
 
 #define DEFAULT_PORT 52356
 
@@ -150,6 +160,9 @@ public:
             use_vulkan_ = ini_[CONFIG_SETTINGS][CONFIG_SETTINGS_RENDER_BACKEND] == "vulkan";
             rtp_codec_ = ini_[CONFIG_LOCALHOST][CONFIG_LOCALHOST_CODEC];
             dark_mode_ = ini_[CONFIG_SETTINGS][CONFIG_SETTINGS_DARK_MODE] == "true";
+            if (ini_[CONFIG_SETTINGS].has(CONFIG_SETTINGS_DAMAGED_FRAME_POLICY)) {
+                damaged_frame_policy_ = ini_[CONFIG_SETTINGS][CONFIG_SETTINGS_DAMAGED_FRAME_POLICY];
+            }
         }
     }
 
@@ -209,6 +222,10 @@ public:
             ini[CONFIG_WIFI][WIFI_GS_KEY] = "";
             ini[CONFIG_WIFI][WIFI_ALINK_ENABLED] = "true";
             ini[CONFIG_WIFI][WIFI_ALINK_TX_POWER] = "20";
+            ini[CONFIG_WIFI][WIFI_ALINK_FEC_POLICY] = "threshold";
+            ini[CONFIG_WIFI][WIFI_DIVERSITY] = "false";
+            ini[CONFIG_WIFI][WIFI_REPLAY_CAPTURES] = "";
+            ini[CONFIG_WIFI][WIFI_FORWARDER_PORTS] = "";
 
             ini[CONFIG_LOCALHOST][CONFIG_LOCALHOST_PORT] = "5600";
             ini[CONFIG_LOCALHOST][CONFIG_LOCALHOST_CODEC] = "H264";
@@ -217,6 +234,7 @@ public:
             ini[CONFIG_SETTINGS][CONFIG_SETTINGS_MEDIA_BACKEND] = "ffmpeg";
             ini[CONFIG_SETTINGS][CONFIG_SETTINGS_RENDER_BACKEND] = "opengl";
             ini[CONFIG_SETTINGS][CONFIG_SETTINGS_DARK_MODE] = "true";
+            ini[CONFIG_SETTINGS][CONFIG_SETTINGS_DAMAGED_FRAME_POLICY] = "decode";
         }
 
         if (read_success) {
@@ -232,12 +250,14 @@ public:
 
         Instance().ini_[CONFIG_WIFI][WIFI_ALINK_ENABLED] = WfbngLink::Instance().get_alink_enabled() ? "true" : "false";
         Instance().ini_[CONFIG_WIFI][WIFI_ALINK_TX_POWER] = std::to_string(WfbngLink::Instance().get_alink_tx_power());
+        Instance().ini_[CONFIG_WIFI][WIFI_ALINK_FEC_POLICY] = WfbngLink::Instance().get_fec_policy();
 
         Instance().ini_[CONFIG_SETTINGS][CONFIG_SETTINGS_LANG] = Instance().locale_;
         Instance().ini_[CONFIG_SETTINGS][CONFIG_SETTINGS_MEDIA_BACKEND] =
             Instance().use_gstreamer_ ? "gstreamer" : "ffmpeg";
         Instance().ini_[CONFIG_SETTINGS][CONFIG_SETTINGS_RENDER_BACKEND] = Instance().use_vulkan_ ? "vulkan" : "opengl";
         Instance().ini_[CONFIG_SETTINGS][CONFIG_SETTINGS_DARK_MODE] = Instance().dark_mode_ ? "true" : "false";
+        Instance().ini_[CONFIG_SETTINGS][CONFIG_SETTINGS_DAMAGED_FRAME_POLICY] = Instance().damaged_frame_policy_;
 
         Instance().ini_[CONFIG_LOCALHOST][CONFIG_LOCALHOST_CODEC] = Instance().rtp_codec_;
 
@@ -261,8 +281,14 @@ public:
         return write_success;
     }
 
-    static bool Start(const DeviceId &deviceId, int channel, int channelWidthMode, std::string gsKeyPath) {
-        Instance().ini_[CONFIG_WIFI][WIFI_DEVICE] = deviceId.display_name;
+    /// The first device is the primary one, the others add diversity.
+    static bool Start(const std::vector<DeviceId> &deviceIds,
+                      int channel,
+                      int channelWidthMode,
+                      std::string gsKeyPath) {
+        if (!deviceIds.empty()) {
+            Instance().ini_[CONFIG_WIFI][WIFI_DEVICE] = deviceIds[0].display_name;
+        }
         Instance().ini_[CONFIG_WIFI][WIFI_CHANNEL] = std::to_string(channel);
         Instance().ini_[CONFIG_WIFI][WIFI_CHANNEL_WIDTH_MODE] = std::to_string(channelWidthMode);
         Instance().ini_[CONFIG_WIFI][WIFI_GS_KEY] = gsKeyPath;
@@ -276,8 +302,64 @@ public:
             gsKeyPath = revector::get_asset_dir("gs.key");
             Instance().PutLog(LogLevel::Info, "Using GS key: {}", gsKeyPath);
         }
-        return WfbngLink::Instance().start(deviceId, channel, channelWidthMode, gsKeyPath);
+
+#ifdef __linux__
+        const auto captures = GetReplayCaptures();
+        if (!captures.empty()) {
+            return WfbngLink::Instance().start_replay(captures, gsKeyPath);
+        }
+
+        const auto forwarder_ports = GetForwarderPorts();
+        WfbngLink::Instance().set_forwarder_ports(forwarder_ports);
+        if (deviceIds.empty() && !forwarder_ports.empty()) {
+            return WfbngLink::Instance().start_forwarded(gsKeyPath);
+        }
+#endif
+
+        if (deviceIds.empty()) {
+            Instance().ShowTip("Null device");
+            return false;
+        }
+        return WfbngLink::Instance().start(deviceIds, channel, channelWidthMode, gsKeyPath);
+    }
+
+    static std::vector<std::string> GetReplayCaptures() {
+        std::vector<std::string> captures;
+        std::stringstream ss(Instance().ini_[CONFIG_WIFI][WIFI_REPLAY_CAPTURES]);
+        std::string path;
+        while (std::getline(ss, path, ',')) {
+            if (!path.empty()) {
+                captures.push_back(path);
+            }
+        }
+        return captures;
+    }
+
+#ifdef __linux__
+    static std::vector<ForwarderIngest::Port> GetForwarderPorts() {
+        std::vector<ForwarderIngest::Port> ports;
+        std::stringstream ss(Instance().ini_[CONFIG_WIFI][WIFI_FORWARDER_PORTS]);
+        std::string pair;
+        while (std::getline(ss, pair, ',')) {
+            if (pair.empty()) {
+                continue;
+            }
+            const auto colon = pair.find(':');
+            try {
+                if (colon == std::string::npos) {
+                    throw std::invalid_argument(pair);
+                }
+                ports.push_back({
+                    .udp_port = static_cast<uint16_t>(std::stoi(pair.substr(0, colon))),
+                    .radio_port = static_cast<uint8_t>(std::stoi(pair.substr(colon + 1))),
+                });
+            } catch (const std::exception &) {
+                Instance().PutLog(LogLevel::Warn, "Invalid forwarder port, expected <udp port>:<radio port>: {}", pair);
+            }
+        }
+        return ports;
     }
+#endif
 
     static bool Stop() {
         WfbngLink::Instance().stop();
@@ -293,6 +375,14 @@ public:
         WfbngLink::Instance().set_alink_tx_power(power);
     }
 
+    static void SetAlinkFecPolicy(const std::string &policy) {
+        WfbngLink::Instance().set_fec_policy(policy);
+    }
+
+    static AntennaStats::Snapshot GetAntennaStats() {
+        return WfbngLink::Instance().get_antenna_stats();
+    }
+
     static void BuildSdp(const std::string &filePath, const std::string &codec, int payloadType, int port) {
         auto absolutePath = std::filesystem::absolute(filePath);
         std::string dirPath = absolutePath.parent_path().string();
@@ -335,20 +425,35 @@ public:
         EmitRtpStream(sdpFile);
     }
 
+    /// Notify the player of an RTP stream delivered in-process through rtpRing_.
+    void NotifyRtpRingStream(const std::string &codec) {
+        PutLog(LogLevel::Debug, "In-process RTP stream: Codec: {}", codec);
+
+        EmitRtpStream(RTP_RING_URL_PREFIX + codec);
+    }
+
+    /// Publish the packet counters to subscribers. Called from the GUI thread on a timer,
+    /// the RX path only bumps the atomics.
     void UpdateCount() {
-        EmitWifiFrameCountUpdated(wifiFrameCount_);
-        EmitWfbFrameCountUpdated(wfbngFrameCount_);
-        EmitRtpPktCountUpdated(rtpPktCount_);
+        EmitWifiFrameCountUpdated(GetWifiFrameCount());
+        EmitWfbFrameCountUpdated(GetWfbngFrameCount());
+        EmitRtpPktCountUpdated(GetRtpPktCount());
+    }
+
+    void ResetCount() {
+        wifiFrameCount_.store(0, std::memory_order_relaxed);
+        wfbngFrameCount_.store(0, std::memory_order_relaxed);
+        rtpPktCount_.store(0, std::memory_order_relaxed);
     }
 
     long long GetWfbngFrameCount() const {
-        return wfbngFrameCount_;
+        return wfbngFrameCount_.load(std::memory_order_relaxed);
     }
     long long GetRtpPktCount() const {
-        return rtpPktCount_;
+        return rtpPktCount_.load(std::memory_order_relaxed);
     }
     long long GetWifiFrameCount() const {
-        return wifiFrameCount_;
+        return wifiFrameCount_.load(std::memory_order_relaxed);
     }
 
     int GetPlayerPort() const {
@@ -422,16 +527,20 @@ public:
 
     std::string locale_ = "en";
 
+    // Written by the RX path, sampled by the GUI. Only the totals matter, so relaxed ordering is enough.
     /// Number of received 802.11 frames
-    long long wifiFrameCount_ = 0;
+    std::atomic<long long> wifiFrameCount_{0};
     /// Number of received wfb-ng frames
-    long long wfbngFrameCount_ = 0;
+    std::atomic<long long> wfbngFrameCount_{0};
     /// Number of received RTP packets
-    long long rtpPktCount_ = 0;
+    std::atomic<long long> rtpPktCount_{0};
 
     int playerPort = 0;
     std::string playerCodec;
 
+    /// RTP packets from the Wi-Fi link to the FFmpeg player. Gstreamer still receives them on playerPort.
+    RtpRing rtpRing_;
+
     // Local RTP listener
     std::string rtp_codec_;
 
@@ -450,6 +559,9 @@ public:
 
     bool use_vulkan_ = false;
 
+    /// What the FFmpeg player does with damaged reference frames: "decode", "skip" or "freeze" (until a keyframe)
+    std::string damaged_frame_policy_ = "decode";
+
     // Signals.
     std::vector<revector::AnyCallable<void>> logCallbacks;
     std::vector<revector::AnyCallable<void>> tipCallbacks;
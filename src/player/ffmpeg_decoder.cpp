@@ -1,13 +1,28 @@
 ﻿#include "ffmpeg_decoder.h"
 
 #include <cassert>
+#include <cstring>
 #include <iostream>
 #include <vector>
 
 #include "src/gui_interface.h"
+#include "src/wifi/keyframe_requester.h"
 
 constexpr size_t MAX_AUDIO_PACKET = 2 * 1024 * 1024;
 
+/// How often a read blocked on the RTP ring re-checks the interrupt callback.
+constexpr std::chrono::milliseconds RING_POLL_INTERVAL{100};
+
+/// Seconds allowed for opening an input.
+constexpr int OPEN_INPUT_TIMEOUT = 10;
+
+static int OpenTimeoutCallback(void *timestamp) {
+    const auto now = std::chrono::steady_clock::now();
+    const std::chrono::duration<double> duration =
+        now - *(std::chrono::time_point<std::chrono::steady_clock> *)timestamp;
+    return duration.count() > OPEN_INPUT_TIMEOUT;
+}
+
 bool FfmpegDecoder::OpenInput(std::string &inputFile, bool forceSoftwareDecoding) {
 #ifndef NDEBUG
     av_log_set_level(AV_LOG_ERROR);
@@ -34,6 +49,14 @@ bool FfmpegDecoder::OpenInput(std::string &inputFile, bool forceSoftwareDecoding
         } while (decoderType != AV_HWDEVICE_TYPE_NONE);
     }
 
+    if (inputFile.starts_with(RTP_RING_URL_PREFIX)) {
+        if (!OpenRtpRing(inputFile.substr(strlen(RTP_RING_URL_PREFIX)))) {
+            CloseInput();
+            return false;
+        }
+        return true;
+    }
+
     AVDictionary *options = nullptr;
 
     av_dict_set(&options, "preset", "ultrafast", 0);
@@ -52,15 +75,9 @@ bool FfmpegDecoder::OpenInput(std::string &inputFile, bool forceSoftwareDecoding
     }
 
     // Timeout
-    static constexpr int timeout = 10;
     startTime = std::chrono::steady_clock::now();
 
-    pFormatCtx->interrupt_callback.callback = [](void *timestamp) -> int {
-        const auto now = std::chrono::steady_clock::now();
-        const std::chrono::duration<double> duration =
-            now - *(std::chrono::time_point<std::chrono::steady_clock> *)timestamp;
-        return duration.count() > timeout;
-    };
+    pFormatCtx->interrupt_callback.callback = OpenTimeoutCallback;
     pFormatCtx->interrupt_callback.opaque = &startTime;
 
     if (avformat_find_stream_info(pFormatCtx, nullptr) < 0) {
@@ -70,7 +87,7 @@ bool FfmpegDecoder::OpenInput(std::string &inputFile, bool forceSoftwareDecoding
 
     // Timeout
     if (const std::chrono::duration<double> duration = std::chrono::steady_clock::now() - startTime;
-        duration.count() > timeout) {
+        duration.count() > OPEN_INPUT_TIMEOUT) {
         CloseInput();
         return false;
     }
@@ -118,9 +135,29 @@ bool FfmpegDecoder::CloseInput() {
         pFormatCtx = nullptr;
     }
 
+    if (rtpDepacketizer) {
+        GuiInterface::Instance().PutLog(LogLevel::Info,
+                                        "Access units: {}, incomplete {}, not decoded {}",
+                                        accessUnitCount,
+                                        incompleteAccessUnitCount,
+                                        skippedAccessUnitCount);
+    }
+
+    rtpRing = nullptr;
+    rtpDepacketizer.reset();
+    ringFrame.reset();
+    frozenUntilKeyframe = false;
+
     return true;
 }
 
+bool FfmpegDecoder::IsInterrupted() const {
+    if (!pFormatCtx || !pFormatCtx->interrupt_callback.callback) {
+        return false;
+    }
+    return pFormatCtx->interrupt_callback.callback(pFormatCtx->interrupt_callback.opaque);
+}
+
 void freeFrame(AVFrame *f) {
     av_frame_free(&f);
 }
@@ -146,6 +183,10 @@ std::shared_ptr<AVFrame> FfmpegDecoder::GetNextFrame() {
         return res;
     }
 
+    if (rtpRing) {
+        return GetNextRingFrame();
+    }
+
     while (true) {
         if (!pFormatCtx) {
             throw std::runtime_error("AVFormatContext is null");
@@ -166,23 +207,7 @@ std::shared_ptr<AVFrame> FfmpegDecoder::GetNextFrame() {
 
         timestamp->record("av_read_frame");
 
-        // Calculate bitrate
-        {
-            bytesSecond += packet->size;
-
-            uint64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
-                               std::chrono::system_clock::now().time_since_epoch())
-                               .count();
-            if (now - lastCountBitrateTime >= 1000) {
-                // 计算码率定时器
-                bitrate = bytesSecond * 8 * 1000 / (now - lastCountBitrateTime);
-                bytesSecond = 0;
-
-                emitBitrateUpdate(bitrate);
-
-                lastCountBitrateTime = now;
-            }
-        }
+        CountBitrate(packet->size);
 
         // Handle video
         if (packet->stream_index == videoStreamIndex) {
@@ -235,6 +260,202 @@ std::shared_ptr<AVFrame> FfmpegDecoder::GetNextFrame() {
     return res;
 }
 
+void FfmpegDecoder::CountBitrate(int packetSize) {
+    bytesSecond += packetSize;
+
+    uint64_t now =
+        std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch())
+            .count();
+    if (now - lastCountBitrateTime >= 1000) {
+        // 计算码率定时器
+        bitrate = bytesSecond * 8 * 1000 / (now - lastCountBitrateTime);
+        bytesSecond = 0;
+
+        emitBitrateUpdate(bitrate);
+
+        lastCountBitrateTime = now;
+    }
+}
+
+bool FfmpegDecoder::OpenRtpRing(const std::string &codecName) {
+    GuiInterface::Instance().PutLog(LogLevel::Info, "Open in-process RTP stream: {}", codecName);
+
+    rtpDepacketizer = std::make_unique<RtpDepacketizer>(RtpDepacketizer::CodecFromName(codecName));
+    rtpDepacketizer->onAccessUnit = [this](AVPacket *packet, const RtpDepacketizer::AccessUnitInfo &info) {
+        DecodeAccessUnit(packet, info);
+    };
+
+    // A bare format context describing the stream, so that recording works as with a demuxed input.
+    pFormatCtx = avformat_alloc_context();
+    if (!pFormatCtx) {
+        return false;
+    }
+    AVStream *stream = avformat_new_stream(pFormatCtx, nullptr);
+    if (!stream) {
+        return false;
+    }
+    stream->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
+    stream->codecpar->codec_id = rtpDepacketizer->GetCodecId();
+    stream->time_base = {1, RTP_VIDEO_CLOCK_RATE};
+
+    hasVideoStream = OpenVideo();
+    hasAudioStream = false;
+    if (!hasVideoStream) {
+        return false;
+    }
+    videoBaseTime = av_q2d(stream->time_base);
+
+    rtpRing = &GuiInterface::Instance().rtpRing_;
+    // Whatever queued up before the player was ready would only add latency.
+    rtpRing->flush();
+
+    startTime = std::chrono::steady_clock::now();
+    pFormatCtx->interrupt_callback.callback = OpenTimeoutCallback;
+    pFormatCtx->interrupt_callback.opaque = &startTime;
+
+    sourceIsOpened = true;
+
+    // Decode up to the first picture, which gives the video size, plus one more access unit for the frame rate.
+    // This ends with the first keyframe instead of a probing heuristic.
+    std::shared_ptr<AVFrame> firstFrame;
+    while (!firstFrame || rtpDepacketizer->GetFrameDuration() == 0) {
+        try {
+            if (auto frame = GetNextRingFrame()) {
+                firstFrame = frame;
+            }
+        }
+        // Expected until the first keyframe arrives.
+        catch (const SendPacketException &) {
+        }
+        // Timed out.
+        catch (const ReadFrameException &) {
+            return false;
+        }
+    }
+    // Returned by the first GetNextFrame().
+    ringFrame = firstFrame;
+
+    pFormatCtx->interrupt_callback.callback = nullptr;
+    pFormatCtx->interrupt_callback.opaque = nullptr;
+
+    width = pVideoCodecCtx->width;
+    height = pVideoCodecCtx->height;
+    videoFps = static_cast<float>(RTP_VIDEO_CLOCK_RATE) / rtpDepacketizer->GetFrameDuration();
+    avcodec_parameters_from_context(stream->codecpar, pVideoCodecCtx);
+
+    GuiInterface::Instance().PutLog(LogLevel::Info, "Video FPS: {}", videoFps);
+
+    return true;
+}
+
+std::shared_ptr<AVFrame> FfmpegDecoder::GetNextRingFrame() {
+    while (!ringFrame) {
+        if (IsInterrupted()) {
+            throw ReadFrameException("Reading the RTP ring was interrupted");
+        }
+
+        const RtpRingPacket *packet = rtpRing->wait_front(RING_POLL_INTERVAL);
+        if (!packet) {
+            continue;
+        }
+
+        // Decoding happens inside Push() through DecodeAccessUnit().
+        try {
+            rtpDepacketizer->Push(packet->data, packet->size, packet->lost_before);
+        } catch (...) {
+            rtpRing->pop();
+            throw;
+        }
+        rtpRing->pop();
+    }
+
+    return std::move(ringFrame);
+}
+
+void FfmpegDecoder::DecodeAccessUnit(AVPacket *packet, const RtpDepacketizer::AccessUnitInfo &info) {
+    accessUnitCount++;
+    if (!info.complete()) {
+        incompleteAccessUnitCount++;
+        GuiInterface::Instance().PutLog(LogLevel::Debug,
+                                        "Incomplete access unit (RTP seq {}-{}): {} packets missing{}{}",
+                                        info.firstSeq,
+                                        info.lastSeq,
+                                        info.missingPackets,
+                                        info.missingMarker ? ", no marker" : "",
+                                        info.truncated ? ", truncated" : "");
+        KeyframeRequester::get_instance().report(KeyframeReason::IncompleteAccessUnit);
+    } else if (info.keyframe) {
+        KeyframeRequester::get_instance().on_keyframe();
+    }
+
+    packet->stream_index = videoStreamIndex;
+
+    CountBitrate(packet->size);
+
+    // Recordings get everything, damaged or not.
+    if (gotPktCallback) {
+        // Shares the buffer, no copy.
+        gotPktCallback(std::shared_ptr<AVPacket>(av_packet_clone(packet), &freePkt));
+    }
+
+    // The renderer keeps showing the last picture.
+    if (ShouldSkipAccessUnit(info)) {
+        skippedAccessUnitCount++;
+        return;
+    }
+
+    std::shared_ptr<AVFrame> pFrameVideo = std::shared_ptr<AVFrame>(av_frame_alloc(), &freeFrame);
+
+    if (DecodeVideo(packet, pFrameVideo)) {
+        ringFrame = pFrameVideo;
+    }
+
+    if (gotVideoFrameCallback) {
+        gotVideoFrameCallback(pFrameVideo);
+    }
+}
+
+bool FfmpegDecoder::ShouldSkipAccessUnit(const RtpDepacketizer::AccessUnitInfo &info) {
+    if (info.complete()) {
+        if (info.keyframe) {
+            frozenUntilKeyframe = false;
+        }
+        if (!frozenUntilKeyframe) {
+            return false;
+        }
+    }
+
+    if (frozenUntilKeyframe) {
+        // Keeps the keyframe request alive, it's renewed if the keyframe takes too long.
+        KeyframeRequester::get_instance().report(KeyframeReason::IncompleteAccessUnit);
+        return true;
+    }
+
+    if (!info.reference) {
+        return true;
+    }
+
+    switch (damagedReferencePolicy) {
+        case DamagedReferencePolicy::Skip:
+            return true;
+        case DamagedReferencePolicy::FreezeUntilKeyframe:
+            frozenUntilKeyframe = true;
+            return true;
+        default:
+            return false;
+    }
+}
+
+FfmpegDecoder::DamagedReferencePolicy FfmpegDecoder::DamagedReferencePolicyFromName(const std::string &name) {
+    if (name == "skip") {
+        return DamagedReferencePolicy::Skip;
+    }
+    if (name == "freeze") {
+        return DamagedReferencePolicy::FreezeUntilKeyframe;
+    }
+    return DamagedReferencePolicy::Decode;
+}
+
 bool FfmpegDecoder::createHwCtx(AVCodecContext *ctx, const AVHWDeviceType type) {
     if (av_hwdevice_ctx_create(&hwDeviceCtx, type, nullptr, nullptr, 0) < 0) {
         return false;
@@ -345,6 +566,8 @@ bool FfmpegDecoder::DecodeVideo(const AVPacket *av_pkt, std::shared_ptr<AVFrame>
     if (pVideoCodecCtx && av_pkt && pOutFrame) {
         int ret = avcodec_send_packet(pVideoCodecCtx, av_pkt);
         if (ret < 0) {
+            KeyframeRequester::get_instance().report(KeyframeReason::DecodeError);
+
             char errStr[AV_ERROR_MAX_STRING_SIZE];
             av_strerror(ret, errStr, AV_ERROR_MAX_STRING_SIZE);
             throw SendPacketException("avcodec_send_packet failed: " + std::string(errStr));
@@ -371,6 +594,12 @@ bool FfmpegDecoder::DecodeVideo(const AVPacket *av_pkt, std::shared_ptr<AVFrame>
         } else {
             // Successfully decoded a frame
             res = true;
+
+            // Concealed errors, e.g. a missing reference, leave the picture broken until the next keyframe.
+            const AVFrame *frame = hwDecoderEnabled ? hwFrame.get() : pOutFrame.get();
+            if (frame->decode_error_flags || (frame->flags & AV_FRAME_FLAG_CORRUPT)) {
+                KeyframeRequester::get_instance().report(KeyframeReason::CorruptFrame);
+            }
         }
 
         if (res && hwDecoderEnabled) {
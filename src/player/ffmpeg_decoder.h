@@ -7,6 +7,9 @@
 #include <string>
 
 #include "ffmpeg_include.h"
+#include "rtp_depacketizer.h"
+
+class RtpRing;
 
 class ReadFrameException : public std::runtime_error {
 public:
@@ -22,6 +25,20 @@ class FfmpegDecoder {
     friend class RealTimePlayer;
 
 public:
+    /// What to do with an access unit from the RTP ring that lost packets and that other frames may reference.
+    /// Damaged non-reference frames are always skipped, nothing is lost by not decoding them.
+    enum class DamagedReferencePolicy {
+        /// Decode it anyway, the picture smears until the next keyframe
+        Decode,
+        /// Skip it, the frames referencing it decode against an older picture
+        Skip,
+        /// Hold the last good picture and decode nothing until a complete keyframe arrives
+        FreezeUntilKeyframe,
+    };
+
+    /// "decode", "skip" or "freeze", anything else is Decode.
+    static DamagedReferencePolicy DamagedReferencePolicyFromName(const std::string &name);
+
     FfmpegDecoder() = default;
 
     ~FfmpegDecoder() {
@@ -106,6 +123,21 @@ private:
 
     bool createHwCtx(AVCodecContext *ctx, enum AVHWDeviceType type);
 
+    /// Open the in-process RTP ring (see RTP_RING_URL_PREFIX). No demuxer or stream probing is involved:
+    /// access units go from the depacketizer straight to the decoder, and opening returns with the first picture.
+    bool OpenRtpRing(const std::string &codecName);
+
+    std::shared_ptr<AVFrame> GetNextRingFrame();
+
+    void DecodeAccessUnit(AVPacket *packet, const RtpDepacketizer::AccessUnitInfo &info);
+
+    /// Whether decoding the access unit is a waste, see DamagedReferencePolicy.
+    bool ShouldSkipAccessUnit(const RtpDepacketizer::AccessUnitInfo &info);
+
+    void CountBitrate(int packetSize);
+
+    bool IsInterrupted() const;
+
     void emitBitrateUpdate(uint64_t pBitrate) {
         bitrateUpdateCallback(pBitrate);
     }
@@ -114,6 +146,18 @@ private:
 
     AVFormatContext *pFormatCtx = nullptr;
 
+    // In-process RTP input
+    RtpRing *rtpRing = nullptr;
+    std::unique_ptr<RtpDepacketizer> rtpDepacketizer;
+    /// Latest picture decoded from the ring
+    std::shared_ptr<AVFrame> ringFrame;
+    uint64_t accessUnitCount = 0;
+    uint64_t incompleteAccessUnitCount = 0;
+    uint64_t skippedAccessUnitCount = 0;
+    DamagedReferencePolicy damagedReferencePolicy = DamagedReferencePolicy::Decode;
+    /// Waiting for a keyframe under FreezeUntilKeyframe
+    bool frozenUntilKeyframe = false;
+
     AVCodecContext *pVideoCodecCtx = nullptr;
 
     AVCodecContext *pAudioCodecCtx = nullptr;
@@ -87,6 +87,8 @@ void RealTimePlayer::play(const std::string &playUrl, bool forceSoftwareDecoding
     url = playUrl;
 
     decoder = std::make_shared<FfmpegDecoder>();
+    decoder->damagedReferencePolicy =
+        FfmpegDecoder::DamagedReferencePolicyFromName(GuiInterface::Instance().damaged_frame_policy_);
 
     analysisThread = std::thread([this, forceSoftwareDecoding] {
         // Indicate we are using ffmpeg resources in a detached thread.
@@ -169,6 +171,10 @@ void RealTimePlayer::stop() {
     if (decoder && decoder->pFormatCtx) {
         decoder->pFormatCtx->interrupt_callback.callback = [](void *) { return 1; };
     }
+    // Don't wait for the next poll of the in-process RTP ring.
+    if (decoder && decoder->rtpRing) {
+        decoder->rtpRing->wake();
+    }
 
     // The thread will be unjoinable after calling detach().
     // if (analysisThread.joinable()) {
@@ -0,0 +1,403 @@
+#include "rtp_depacketizer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <exception>
+
+namespace {
+
+constexpr uint8_t START_CODE[] = {0, 0, 0, 1};
+
+constexpr size_t RTP_HEADER_SIZE = 12;
+
+constexpr uint8_t H264_NAL_SLICE = 1;
+constexpr uint8_t H264_NAL_IDR = 5;
+constexpr uint8_t H264_NAL_STAP_A = 24;
+constexpr uint8_t H264_NAL_FU_A = 28;
+
+constexpr uint8_t H265_NAL_RSV_VCL_N14 = 14;
+constexpr uint8_t H265_NAL_BLA_W_LP = 16;
+constexpr uint8_t H265_NAL_CRA = 21;
+constexpr uint8_t H265_NAL_VCL_MAX = 31;
+constexpr uint8_t H265_NAL_AP = 48;
+constexpr uint8_t H265_NAL_FU = 49;
+
+struct RtpPacketView {
+    uint16_t seq;
+    uint32_t timestamp;
+    bool marker;
+    const uint8_t *payload;
+    size_t payloadSize;
+};
+
+/// Strip the RTP header (CSRCs, extension, padding). Returns false for anything that isn't RTP v2.
+bool ParseRtp(const uint8_t *packet, size_t size, RtpPacketView &view) {
+    if (size < RTP_HEADER_SIZE || (packet[0] >> 6) != 2) {
+        return false;
+    }
+
+    size_t offset = RTP_HEADER_SIZE + (packet[0] & 0x0F) * 4;
+
+    // Header extension
+    if (packet[0] & 0x10) {
+        if (size < offset + 4) {
+            return false;
+        }
+        offset += 4 + ((packet[offset + 2] << 8) | packet[offset + 3]) * 4;
+    }
+
+    size_t padding = 0;
+    if (packet[0] & 0x20) {
+        padding = packet[size - 1];
+    }
+
+    if (size <= offset + padding) {
+        return false;
+    }
+
+    view.marker = packet[1] & 0x80;
+    view.seq = (packet[2] << 8) | packet[3];
+    view.timestamp = (packet[4] << 24) | (packet[5] << 16) | (packet[6] << 8) | packet[7];
+    view.payload = packet + offset;
+    view.payloadSize = size - offset - padding;
+
+    return true;
+}
+
+} // namespace
+
+RtpDepacketizer::RtpDepacketizer(Codec codec) : codec(codec) {
+    bufferPool = av_buffer_pool_init(MAX_ACCESS_UNIT_SIZE + AV_INPUT_BUFFER_PADDING_SIZE, nullptr);
+    for (auto &readyPacket : readyPackets) {
+        readyPacket = av_packet_alloc();
+    }
+}
+
+RtpDepacketizer::~RtpDepacketizer() {
+    for (auto &readyPacket : readyPackets) {
+        av_packet_free(&readyPacket);
+    }
+    av_buffer_unref(&buffer);
+    // Buffers still held by the decoder keep the pool alive until they're released.
+    av_buffer_pool_uninit(&bufferPool);
+}
+
+RtpDepacketizer::Codec RtpDepacketizer::CodecFromName(const std::string &name) {
+    return name == "H265" ? Codec::H265 : Codec::H264;
+}
+
+void RtpDepacketizer::Push(const uint8_t *rtpPacket, size_t rtpSize, uint32_t lostBefore) {
+    RtpPacketView rtp{};
+    if (!ParseRtp(rtpPacket, rtpSize, rtp)) {
+        pendingLost += lostBefore;
+        return;
+    }
+
+    uint32_t gap = 0;
+    if (haveSeq) {
+        const uint16_t seqGap = rtp.seq - expectedSeq;
+        // Late or duplicate packet, the access unit it belongs to is gone.
+        if (seqGap >= 0x8000) {
+            pendingLost += lostBefore;
+            return;
+        }
+        gap = seqGap;
+    }
+    // The RX path knows about losses the sequence numbers can't show, e.g. before the first packet.
+    // Mostly both count the same packets, so take the larger.
+    gap = std::max(gap, lostBefore + pendingLost);
+    pendingLost = 0;
+    haveSeq = true;
+    expectedSeq = rtp.seq + 1;
+
+    const int64_t timestamp = UnwrapTimestamp(rtp.timestamp);
+
+    if (accessUnitOpen && timestamp != info.timestamp) {
+        // The lost packets may have been the tail of this unit.
+        info.missingPackets += gap;
+        info.missingMarker = true;
+        EmitAccessUnit();
+    }
+
+    if (!accessUnitOpen) {
+        BeginAccessUnit(timestamp, rtp.seq);
+    }
+
+    if (gap > 0) {
+        info.missingPackets += gap;
+        // Whatever fragment was in progress can't be completed anymore.
+        inFragment = false;
+    }
+    info.lastSeq = rtp.seq;
+
+    if (codec == Codec::H265) {
+        AppendH265(rtp.payload, rtp.payloadSize);
+    } else {
+        AppendH264(rtp.payload, rtp.payloadSize);
+    }
+
+    if (rtp.marker) {
+        EmitAccessUnit();
+    }
+
+    // Only now, an exception from the callback must not leave this packet half taken in.
+    DeliverAccessUnits();
+}
+
+void RtpDepacketizer::BeginAccessUnit(int64_t timestamp, uint16_t seq) {
+    if (!buffer) {
+        buffer = av_buffer_pool_get(bufferPool);
+    }
+    bufferSize = 0;
+
+    info = {};
+    sliceSeen = false;
+    info.timestamp = timestamp;
+    info.firstSeq = seq;
+    info.lastSeq = seq;
+
+    accessUnitOpen = true;
+    inFragment = false;
+}
+
+void RtpDepacketizer::EmitAccessUnit() {
+    accessUnitOpen = false;
+    inFragment = false;
+
+    if (!buffer || bufferSize == 0) {
+        return;
+    }
+
+    if (lastAccessUnitTimestamp >= 0 && info.timestamp > lastAccessUnitTimestamp) {
+        frameDuration = info.timestamp - lastAccessUnitTimestamp;
+    }
+    lastAccessUnitTimestamp = info.timestamp;
+
+    memset(buffer->data + bufferSize, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+
+    // If no slice header made it, we can't tell.
+    if (!sliceSeen) {
+        info.reference = true;
+    }
+
+    // Hand the buffer over to the packet, the next unit takes a fresh one from the pool.
+    AVPacket *packet = readyPackets[readyCount];
+    av_packet_unref(packet);
+    packet->buf = buffer;
+    packet->data = buffer->data;
+    packet->size = static_cast<int>(bufferSize);
+    packet->pts = info.timestamp;
+    packet->dts = info.timestamp;
+    packet->flags = 0;
+    if (info.keyframe) {
+        packet->flags |= AV_PKT_FLAG_KEY;
+    }
+    if (!info.complete()) {
+        packet->flags |= AV_PKT_FLAG_CORRUPT;
+    }
+    buffer = nullptr;
+    bufferSize = 0;
+
+    readyInfo[readyCount] = info;
+    readyCount++;
+}
+
+void RtpDepacketizer::DeliverAccessUnits() {
+    std::exception_ptr error;
+
+    for (size_t i = 0; i < readyCount; i++) {
+        if (onAccessUnit) {
+            try {
+                onAccessUnit(readyPackets[i], readyInfo[i]);
+            } catch (...) {
+                if (!error) {
+                    error = std::current_exception();
+                }
+            }
+        }
+        av_packet_unref(readyPackets[i]);
+    }
+    readyCount = 0;
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+void RtpDepacketizer::AppendH264(const uint8_t *payload, size_t size) {
+    const uint8_t nalType = payload[0] & 0x1F;
+
+    if (nalType == H264_NAL_STAP_A) {
+        AppendAggregate(payload + 1, size - 1);
+        return;
+    }
+
+    if (nalType == H264_NAL_FU_A) {
+        if (size < 2) {
+            info.truncated = true;
+            return;
+        }
+
+        const bool start = payload[1] & 0x80;
+        const bool end = payload[1] & 0x40;
+
+        // Original NAL header: F and NRI from the FU indicator, type from the FU header.
+        // Every fragment carries it, so the unit can be classified even if its start was lost.
+        const uint8_t header = (payload[0] & 0xE0) | (payload[1] & 0x1F);
+        ClassifyNal(&header);
+
+        if (start) {
+            AppendFragmentStart(&header, 1, payload + 2, size - 2);
+        } else if (inFragment) {
+            Append(payload + 2, size - 2);
+        } else {
+            // The start of this NAL unit was lost, the rest is useless.
+            info.truncated = true;
+        }
+
+        if (end) {
+            inFragment = false;
+        }
+        return;
+    }
+
+    AppendNal(payload, size);
+}
+
+void RtpDepacketizer::AppendH265(const uint8_t *payload, size_t size) {
+    if (size < 2) {
+        info.truncated = true;
+        return;
+    }
+
+    const uint8_t nalType = (payload[0] >> 1) & 0x3F;
+
+    if (nalType == H265_NAL_AP) {
+        AppendAggregate(payload + 2, size - 2);
+        return;
+    }
+
+    if (nalType == H265_NAL_FU) {
+        if (size < 3) {
+            info.truncated = true;
+            return;
+        }
+
+        const bool start = payload[2] & 0x80;
+        const bool end = payload[2] & 0x40;
+
+        // Original NAL header: F and LayerId from the payload header, type from the FU header.
+        const uint8_t header[2] = {
+            static_cast<uint8_t>((payload[0] & 0x81) | ((payload[2] & 0x3F) << 1)),
+            payload[1],
+        };
+        ClassifyNal(header);
+
+        if (start) {
+            AppendFragmentStart(header, 2, payload + 3, size - 3);
+        } else if (inFragment) {
+            Append(payload + 3, size - 3);
+        } else {
+            info.truncated = true;
+        }
+
+        if (end) {
+            inFragment = false;
+        }
+        return;
+    }
+
+    AppendNal(payload, size);
+}
+
+void RtpDepacketizer::AppendAggregate(const uint8_t *data, size_t size) {
+    inFragment = false;
+
+    while (size > 2) {
+        const size_t nalSize = (data[0] << 8) | data[1];
+        data += 2;
+        size -= 2;
+
+        if (nalSize == 0 || nalSize > size) {
+            info.truncated = true;
+            break;
+        }
+
+        AppendNal(data, nalSize);
+
+        data += nalSize;
+        size -= nalSize;
+    }
+}
+
+void RtpDepacketizer::AppendNal(const uint8_t *nal, size_t size) {
+    inFragment = false;
+
+    if (size == 0 || !Append(START_CODE, sizeof(START_CODE))) {
+        return;
+    }
+    ClassifyNal(nal);
+    Append(nal, size);
+}
+
+void RtpDepacketizer::AppendFragmentStart(const uint8_t *header,
+                                          size_t headerSize,
+                                          const uint8_t *data,
+                                          size_t size) {
+    inFragment = Append(START_CODE, sizeof(START_CODE)) && Append(header, headerSize) && Append(data, size);
+}
+
+bool RtpDepacketizer::Append(const uint8_t *data, size_t size) {
+    if (!buffer || bufferSize + size > MAX_ACCESS_UNIT_SIZE) {
+        info.truncated = true;
+        return false;
+    }
+
+    memcpy(buffer->data + bufferSize, data, size);
+    bufferSize += size;
+
+    return true;
+}
+
+void RtpDepacketizer::ClassifyNal(const uint8_t *nalHeader) {
+    if (codec == Codec::H265) {
+        const uint8_t nalType = (nalHeader[0] >> 1) & 0x3F;
+        if (nalType >= H265_NAL_BLA_W_LP && nalType <= H265_NAL_CRA) {
+            info.keyframe = true;
+        }
+        if (nalType <= H265_NAL_VCL_MAX) {
+            sliceSeen = true;
+            // Even types below 16 are the sub-layer non-reference pictures (TRAIL_N, TSA_N, RADL_N, ...).
+            // Streams from the air unit have a single temporal layer, so nothing references them.
+            if (nalType > H265_NAL_RSV_VCL_N14 || nalType % 2 == 1) {
+                info.reference = true;
+            }
+        }
+    } else {
+        const uint8_t nalType = nalHeader[0] & 0x1F;
+        if (nalType == H264_NAL_IDR) {
+            info.keyframe = true;
+        }
+        if (nalType >= H264_NAL_SLICE && nalType <= H264_NAL_IDR) {
+            sliceSeen = true;
+            // nal_ref_idc, the same for all slices of a picture
+            if (nalHeader[0] & 0x60) {
+                info.reference = true;
+            }
+        }
+    }
+}
+
+int64_t RtpDepacketizer::UnwrapTimestamp(uint32_t timestamp) {
+    if (!haveTimestamp) {
+        haveTimestamp = true;
+        lastRtpTimestamp = timestamp;
+        lastUnwrappedTimestamp = timestamp;
+        return lastUnwrappedTimestamp;
+    }
+
+    lastUnwrappedTimestamp += static_cast<int32_t>(timestamp - lastRtpTimestamp);
+    lastRtpTimestamp = timestamp;
+
+    return lastUnwrappedTimestamp;
+}
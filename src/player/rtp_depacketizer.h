@@ -0,0 +1,141 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include "ffmpeg_include.h"
+
+/// RTP clock rate of H.264/H.265 video.
+constexpr int RTP_VIDEO_CLOCK_RATE = 90000;
+
+/// Largest access unit we assemble. Bigger ones are cut off and reported as truncated.
+constexpr size_t MAX_ACCESS_UNIT_SIZE = 2 * 1024 * 1024;
+
+/// Assembles access units from RTP packets carrying H.264 (RFC 6184) or H.265 (RFC 7798).
+/// Output is Annex B in pooled, padded buffers, ready for avcodec_send_packet() without another copy.
+/// Packets must arrive in order (the wfb-ng aggregator guarantees that); late ones are dropped.
+class RtpDepacketizer {
+public:
+    enum class Codec {
+        H264,
+        H265,
+    };
+
+    /// How complete an access unit is, as far as the RTP sequence numbers can tell.
+    struct AccessUnitInfo {
+        /// Unwrapped RTP timestamp
+        int64_t timestamp;
+        uint16_t firstSeq;
+        uint16_t lastSeq;
+        /// Packets lost inside the access unit or right before it
+        uint32_t missingPackets;
+        /// The marker packet never arrived, the unit was closed by the next timestamp
+        bool missingMarker;
+        /// Data was dropped: a fragment without its start, or the unit didn't fit
+        bool truncated;
+        bool keyframe;
+        /// Other pictures may reference this one. Also set when no slice header arrived to tell.
+        bool reference;
+
+        bool complete() const {
+            return missingPackets == 0 && !missingMarker && !truncated;
+        }
+    };
+
+    explicit RtpDepacketizer(Codec codec);
+
+    ~RtpDepacketizer();
+
+    RtpDepacketizer(const RtpDepacketizer &) = delete;
+    RtpDepacketizer &operator=(const RtpDepacketizer &) = delete;
+
+    /// "H265" selects H.265, anything else H.264 (matches GuiInterface::playerCodec).
+    static Codec CodecFromName(const std::string &name);
+
+    AVCodecID GetCodecId() const {
+        return codec == Codec::H265 ? AV_CODEC_ID_HEVC : AV_CODEC_ID_H264;
+    }
+
+    /// Feed one RTP packet. Completed access units are passed to onAccessUnit.
+    /// `lostBefore` is the number of packets the RX path knows were lost right before this one.
+    /// The packet is fully taken in before onAccessUnit runs. If it throws, the other unit completed by this packet
+    /// is still delivered, then the first exception is rethrown.
+    void Push(const uint8_t *rtpPacket, size_t rtpSize, uint32_t lostBefore = 0);
+
+    /// RTP ticks between the last two access units, 0 if not known yet.
+    int64_t GetFrameDuration() const {
+        return frameDuration;
+    }
+
+    /// Called with every completed access unit. The packet is only valid during the call,
+    /// use av_packet_ref() to keep it.
+    std::function<void(AVPacket *packet, const AccessUnitInfo &info)> onAccessUnit;
+
+private:
+    void BeginAccessUnit(int64_t timestamp, uint16_t seq);
+
+    /// Close the access unit in progress and queue it for DeliverAccessUnits().
+    void EmitAccessUnit();
+
+    /// Pass the queued access units to onAccessUnit.
+    void DeliverAccessUnits();
+
+    void AppendH264(const uint8_t *payload, size_t size);
+
+    void AppendH265(const uint8_t *payload, size_t size);
+
+    /// Append an aggregation packet (STAP-A/AP) made of [16-bit size][NAL] units.
+    void AppendAggregate(const uint8_t *data, size_t size);
+
+    /// Append a whole NAL unit behind a start code.
+    void AppendNal(const uint8_t *nal, size_t size);
+
+    /// Append the first fragment of a NAL unit: start code, rebuilt NAL header, then data.
+    void AppendFragmentStart(const uint8_t *header, size_t headerSize, const uint8_t *data, size_t size);
+
+    bool Append(const uint8_t *data, size_t size);
+
+    /// Note keyframe and reference NAL units in `info`.
+    void ClassifyNal(const uint8_t *nalHeader);
+
+    int64_t UnwrapTimestamp(uint32_t timestamp);
+
+    Codec codec;
+
+    AVBufferPool *bufferPool = nullptr;
+
+    /// Buffer of the access unit in progress
+    AVBufferRef *buffer = nullptr;
+    size_t bufferSize = 0;
+
+    /// A packet completes at most two access units: the one its timestamp closes and its own, if it has the marker.
+    static constexpr size_t MAX_READY_ACCESS_UNITS = 2;
+
+    /// Access units completed by the current Push(), delivered once its state update is done
+    AVPacket *readyPackets[MAX_READY_ACCESS_UNITS] = {};
+    AccessUnitInfo readyInfo[MAX_READY_ACCESS_UNITS] = {};
+    size_t readyCount = 0;
+
+    AccessUnitInfo info{};
+    bool accessUnitOpen = false;
+
+    /// We've seen the start of the fragmentation unit in progress, so continuation fragments are usable.
+    bool inFragment = false;
+
+    /// A slice NAL header of the access unit in progress was seen, so `info.reference` is known.
+    bool sliceSeen = false;
+
+    bool haveSeq = false;
+    uint16_t expectedSeq = 0;
+    /// Losses reported with packets that were dropped, passed on with the next one
+    uint32_t pendingLost = 0;
+
+    bool haveTimestamp = false;
+    uint32_t lastRtpTimestamp = 0;
+    int64_t lastUnwrappedTimestamp = 0;
+
+    int64_t lastAccessUnitTimestamp = -1;
+    int64_t frameDuration = 0;
+};
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+/// Wakes the adaptive link sender as soon as a loss burst shows up, instead of waiting for its next heartbeat.
+///
+/// The RX side reports lost and FEC-recovered packets from its 10 ms tick. Once they cross a threshold since the
+/// last send, the sender is woken. Rate limiting keeps triggered sends at least kMinTriggerInterval apart, and
+/// hysteresis keeps a trigger from firing again until a send interval ends below the release thresholds.
+class AlinkTrigger {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // Same thresholds the FEC decision uses, but counted since the last send rather than over a second,
+    // so only a burst trips them.
+    static constexpr uint32_t kLostTrigger = 3;
+    static constexpr uint32_t kRecoveredTrigger = 19;
+    static constexpr uint32_t kRecoveredRelease = 9;
+    static constexpr std::chrono::milliseconds kMinTriggerInterval{20};
+
+    struct Stats {
+        uint64_t triggered_sends;
+        uint64_t periodic_sends;
+        /// Sends that carried a loss, and the time from the first of those losses to the send
+        uint64_t loss_sends;
+        double avg_loss_to_send_ms;
+        double max_loss_to_send_ms;
+    };
+
+    /// RX side: packets lost/recovered since the previous report. Returns true if this report fired the trigger.
+    /// `before_wake` runs only then, right before the sender is woken, e.g. to refresh what it's going to send.
+    /// It runs under the trigger's lock, so it must not call back into the trigger.
+    template <typename BeforeWake>
+    bool report(uint32_t lost, uint32_t recovered, BeforeWake &&before_wake) {
+        if (lost == 0 && recovered == 0) {
+            return false;
+        }
+
+        std::lock_guard lock(mutex_);
+
+        if (lost > 0 && !first_loss_) {
+            first_loss_ = true;
+            first_loss_time_ = Clock::now();
+        }
+
+        lost_ += lost;
+        recovered_ += recovered;
+
+        if (armed_ && !triggered_ && (lost_ >= kLostTrigger || recovered_ >= kRecoveredTrigger)) {
+            triggered_ = true;
+            before_wake();
+            cv_.notify_one();
+            return true;
+        }
+
+        return false;
+    }
+
+    /// Sender: sleep until triggered, requested, woken or `timeout`. Returns true if a trigger or request ended the
+    /// wait.
+    bool wait_for(std::chrono::milliseconds timeout) {
+        std::unique_lock lock(mutex_);
+
+        const auto heartbeat = Clock::now() + timeout;
+
+        cv_.wait_until(lock, heartbeat, [this] { return woken_ || triggered_ || requested_; });
+        if ((triggered_ || requested_) && !woken_) {
+            // Rate limit: hold a trigger that came too soon after the previous send.
+            cv_.wait_until(lock, std::min(last_send_ + kMinTriggerInterval, heartbeat), [this] { return woken_; });
+        }
+        woken_ = false;
+
+        return triggered_ || requested_;
+    }
+
+    /// Sender: a feedback message went out, `triggered` as returned by wait_for().
+    void on_sent(bool triggered) {
+        std::lock_guard lock(mutex_);
+
+        last_send_ = Clock::now();
+
+        if (triggered) {
+            stats_.triggered_sends++;
+            // A request alone doesn't say anything about losses, only a burst disarms.
+            if (triggered_) {
+                armed_ = false;
+            }
+        } else {
+            stats_.periodic_sends++;
+        }
+
+        if (first_loss_) {
+            const double latency =
+                std::chrono::duration<double, std::milli>(last_send_ - first_loss_time_).count();
+            stats_.avg_loss_to_send_ms += (latency - stats_.avg_loss_to_send_ms) / ++stats_.loss_sends;
+            if (latency > stats_.max_loss_to_send_ms) {
+                stats_.max_loss_to_send_ms = latency;
+            }
+            first_loss_ = false;
+        }
+
+        // Hysteresis: re-arm once an interval ends quiet.
+        if (!triggered && lost_ == 0 && recovered_ <= kRecoveredRelease) {
+            armed_ = true;
+        }
+
+        lost_ = 0;
+        recovered_ = 0;
+        triggered_ = false;
+        requested_ = false;
+    }
+
+    /// Any thread: something must go out with the next message, e.g. a keyframe request. Bypasses the thresholds
+    /// and hysteresis, but not the rate limit.
+    void request() {
+        std::lock_guard lock(mutex_);
+        requested_ = true;
+        cv_.notify_one();
+    }
+
+    /// Any thread: make a waiting sender return now, e.g. to stop it.
+    void wake() {
+        std::lock_guard lock(mutex_);
+        woken_ = true;
+        cv_.notify_one();
+    }
+
+    Stats stats() const {
+        std::lock_guard lock(mutex_);
+        return stats_;
+    }
+
+    /// Forget pending reports and the stats, e.g. when the sender restarts.
+    void reset() {
+        std::lock_guard lock(mutex_);
+        lost_ = 0;
+        recovered_ = 0;
+        armed_ = true;
+        triggered_ = false;
+        requested_ = false;
+        woken_ = false;
+        first_loss_ = false;
+        stats_ = {};
+    }
+
+private:
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+
+    uint32_t lost_ = 0;
+    uint32_t recovered_ = 0;
+    bool armed_ = true;
+    bool triggered_ = false;
+    bool requested_ = false;
+    bool woken_ = false;
+
+    bool first_loss_ = false;
+    Clock::time_point first_loss_time_;
+    Clock::time_point last_send_;
+
+    Stats stats_{};
+};
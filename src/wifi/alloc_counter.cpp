@@ -0,0 +1,57 @@
+#include "alloc_counter.h"
+
+#ifdef AVIATEUR_COUNT_ALLOCATIONS
+
+    #include <cstdlib>
+    #include <new>
+
+namespace {
+
+thread_local uint64_t allocation_count = 0;
+
+void *counted_alloc(std::size_t size) {
+    allocation_count++;
+    if (void *ptr = std::malloc(size ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+} // namespace
+
+// The default nothrow forms call these. The aligned ones aren't counted.
+void *operator new(std::size_t size) {
+    return counted_alloc(size);
+}
+
+void *operator new[](std::size_t size) {
+    return counted_alloc(size);
+}
+
+void operator delete(void *ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+uint64_t thread_allocation_count() {
+    return allocation_count;
+}
+
+#else
+
+uint64_t thread_allocation_count() {
+    return 0;
+}
+
+#endif
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstdint>
+
+/// Whether thread_allocation_count() counts anything, i.e. this is a build with AVIATEUR_COUNT_ALLOCATIONS.
+#ifdef AVIATEUR_COUNT_ALLOCATIONS
+constexpr bool ALLOCATION_COUNTING = true;
+#else
+constexpr bool ALLOCATION_COUNTING = false;
+#endif
+
+/// Number of times the calling thread has called operator new, to check that a hot path doesn't allocate.
+/// Always 0 unless ALLOCATION_COUNTING.
+uint64_t thread_allocation_count();
@@ -0,0 +1,183 @@
+#include "antenna_stats.h"
+
+#include <algorithm>
+#include <climits>
+
+namespace {
+
+size_t histogram_bin(int value, int min, size_t bins) {
+    const int bin = (value - min) / AntennaStats::kBinDb;
+    return static_cast<size_t>(std::clamp(bin, 0, static_cast<int>(bins) - 1));
+}
+
+// Single writer, so no read-modify-write is needed.
+template <typename T>
+void add_relaxed(std::atomic<T> &counter, T value) {
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+} // namespace
+
+void AntennaStats::add(uint8_t adapter,
+                       const uint8_t *antenna,
+                       const int8_t *rssi,
+                       const int8_t *noise,
+                       uint64_t fragment_seq,
+                       bool duplicate,
+                       uint64_t now_ms) {
+    if (adapter >= kMaxAdapters) {
+        return;
+    }
+
+    for (size_t i = 0; i < kMaxAntennas && antenna[i] != 0xff; i++) {
+        if (antenna[i] >= kMaxAntennas) {
+            continue;
+        }
+        // Like rxAntennaItem, SCHAR_MAX is an unknown noise level.
+        const int snr = noise[i] != SCHAR_MAX ? rssi[i] - noise[i] : 0;
+        add_sample(antennas_[adapter][antenna[i]], rssi[i], snr, now_ms);
+    }
+
+    AdapterSlot &slot = adapters_[adapter];
+    if (duplicate) {
+        add_relaxed<uint64_t>(slot.duplicate, 1);
+    }
+
+    if (slot.has_seq && fragment_seq > slot.last_seq && fragment_seq - slot.last_seq <= kMaxSeqGap) {
+        add_relaxed<uint64_t>(slot.lost, fragment_seq - slot.last_seq - 1);
+    } else if (slot.has_seq && fragment_seq <= slot.last_seq && slot.last_seq - fragment_seq <= kMaxSeqGap) {
+        // Reordered or repeated, already accounted for
+        add_relaxed<uint64_t>(slot.received, 1);
+        return;
+    }
+    slot.last_seq = fragment_seq;
+    slot.has_seq = true;
+    add_relaxed<uint64_t>(slot.received, 1);
+}
+
+void AntennaStats::add_sample(AntennaSlot &slot, int rssi, int snr, uint64_t now_ms) {
+    const uint64_t packets = slot.packets.load(std::memory_order_relaxed);
+    const uint64_t last_ms = slot.last_ms.load(std::memory_order_relaxed);
+
+    if (packets == 0) {
+        slot.rssi_min.store(rssi, std::memory_order_relaxed);
+        slot.rssi_max.store(rssi, std::memory_order_relaxed);
+        slot.snr_min.store(snr, std::memory_order_relaxed);
+        slot.snr_max.store(snr, std::memory_order_relaxed);
+        slot.rssi_recent.store(static_cast<float>(rssi), std::memory_order_relaxed);
+        slot.snr_recent.store(static_cast<float>(snr), std::memory_order_relaxed);
+    } else {
+        slot.rssi_min.store(std::min(rssi, slot.rssi_min.load(std::memory_order_relaxed)), std::memory_order_relaxed);
+        slot.rssi_max.store(std::max(rssi, slot.rssi_max.load(std::memory_order_relaxed)), std::memory_order_relaxed);
+        slot.snr_min.store(std::min(snr, slot.snr_min.load(std::memory_order_relaxed)), std::memory_order_relaxed);
+        slot.snr_max.store(std::max(snr, slot.snr_max.load(std::memory_order_relaxed)), std::memory_order_relaxed);
+
+        // Same weighting as the signal quality Ewma, so the estimate doesn't depend on the packet rate
+        const float dt = static_cast<float>(now_ms - std::min(last_ms, now_ms));
+        const float weight = dt / (kEwmaTauMs + dt);
+        const float rssi_recent = slot.rssi_recent.load(std::memory_order_relaxed);
+        const float snr_recent = slot.snr_recent.load(std::memory_order_relaxed);
+        slot.rssi_recent.store(rssi_recent + (rssi - rssi_recent) * weight, std::memory_order_relaxed);
+        slot.snr_recent.store(snr_recent + (snr - snr_recent) * weight, std::memory_order_relaxed);
+    }
+
+    add_relaxed<int64_t>(slot.rssi_sum, rssi);
+    add_relaxed<int64_t>(slot.snr_sum, snr);
+    add_relaxed<uint32_t>(slot.rssi_histogram[histogram_bin(rssi, kRssiMinDbm, kRssiBins)], 1);
+    add_relaxed<uint32_t>(slot.snr_histogram[histogram_bin(snr, kSnrMinDb, kSnrBins)], 1);
+    slot.last_ms.store(now_ms, std::memory_order_relaxed);
+    // Published last, readers skip a slot without packets.
+    slot.packets.store(packets + 1, std::memory_order_release);
+}
+
+AntennaStats::Snapshot AntennaStats::snapshot(uint64_t now_ms) const {
+    Snapshot snapshot;
+
+    float best_snr = 0.f;
+
+    for (size_t adapter = 0; adapter < kMaxAdapters; adapter++) {
+        for (size_t antenna = 0; antenna < kMaxAntennas; antenna++) {
+            const AntennaSlot &slot = antennas_[adapter][antenna];
+
+            const uint64_t packets = slot.packets.load(std::memory_order_acquire);
+            if (packets == 0) {
+                continue;
+            }
+
+            Antenna item{};
+            item.adapter = static_cast<uint8_t>(adapter);
+            item.antenna = static_cast<uint8_t>(antenna);
+            item.packets = packets;
+            item.rssi_min = slot.rssi_min.load(std::memory_order_relaxed);
+            item.rssi_max = slot.rssi_max.load(std::memory_order_relaxed);
+            item.rssi_avg = static_cast<float>(slot.rssi_sum.load(std::memory_order_relaxed)) / packets;
+            item.snr_min = slot.snr_min.load(std::memory_order_relaxed);
+            item.snr_max = slot.snr_max.load(std::memory_order_relaxed);
+            item.snr_avg = static_cast<float>(slot.snr_sum.load(std::memory_order_relaxed)) / packets;
+            item.rssi_recent = slot.rssi_recent.load(std::memory_order_relaxed);
+            item.snr_recent = slot.snr_recent.load(std::memory_order_relaxed);
+
+            const uint64_t last_ms = slot.last_ms.load(std::memory_order_relaxed);
+            item.active = now_ms < last_ms + kActiveTimeoutMs;
+
+            for (size_t i = 0; i < kRssiBins; i++) {
+                item.rssi_histogram[i] = slot.rssi_histogram[i].load(std::memory_order_relaxed);
+            }
+            for (size_t i = 0; i < kSnrBins; i++) {
+                item.snr_histogram[i] = slot.snr_histogram[i].load(std::memory_order_relaxed);
+            }
+
+            if (item.active) {
+                snapshot.active_antennas++;
+                if (snapshot.best < 0 || item.snr_recent > best_snr) {
+                    snapshot.best = static_cast<int>(snapshot.antennas.size());
+                    best_snr = item.snr_recent;
+                }
+            }
+
+            snapshot.antennas.push_back(item);
+        }
+    }
+
+    for (size_t adapter = 0; adapter < kMaxAdapters; adapter++) {
+        const AdapterSlot &slot = adapters_[adapter];
+
+        const uint64_t received = slot.received.load(std::memory_order_relaxed);
+        if (received == 0) {
+            continue;
+        }
+        snapshot.adapters.push_back(Adapter{
+            .adapter = static_cast<uint8_t>(adapter),
+            .received = received,
+            .duplicate = slot.duplicate.load(std::memory_order_relaxed),
+            .lost = slot.lost.load(std::memory_order_relaxed),
+        });
+    }
+
+    return snapshot;
+}
+
+void AntennaStats::reset() {
+    for (auto &adapter : antennas_) {
+        for (auto &slot : adapter) {
+            slot.packets.store(0, std::memory_order_relaxed);
+            slot.rssi_sum.store(0, std::memory_order_relaxed);
+            slot.snr_sum.store(0, std::memory_order_relaxed);
+            slot.last_ms.store(0, std::memory_order_relaxed);
+            for (auto &bin : slot.rssi_histogram) {
+                bin.store(0, std::memory_order_relaxed);
+            }
+            for (auto &bin : slot.snr_histogram) {
+                bin.store(0, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    for (auto &slot : adapters_) {
+        slot.received.store(0, std::memory_order_relaxed);
+        slot.duplicate.store(0, std::memory_order_relaxed);
+        slot.lost.store(0, std::memory_order_relaxed);
+        slot.last_seq = 0;
+        slot.has_seq = false;
+    }
+}
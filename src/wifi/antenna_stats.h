@@ -0,0 +1,145 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/// RX statistics of the video channel per adapter and antenna: RSSI and SNR histograms, packet counts,
+/// and per-adapter fragment loss.
+///
+/// One writer (the video channel's RX worker), any number of readers through snapshot(). The counters are relaxed
+/// atomics, so a snapshot may be a packet or so inconsistent between fields, but never blocks the writer.
+class AntennaStats {
+public:
+    static constexpr size_t kMaxAdapters = 4;
+    /// Same as wfb-ng's RX_ANT_MAX
+    static constexpr size_t kMaxAntennas = 4;
+
+    /// Histogram bins are kBinDb wide, samples outside the range go to the first or last bin.
+    static constexpr int kBinDb = 2;
+    static constexpr int kRssiMinDbm = -100;
+    static constexpr int kRssiMaxDbm = 0;
+    static constexpr int kSnrMinDb = 0;
+    static constexpr int kSnrMaxDb = 60;
+    static constexpr size_t kRssiBins = (kRssiMaxDbm - kRssiMinDbm) / kBinDb;
+    static constexpr size_t kSnrBins = (kSnrMaxDb - kSnrMinDb) / kBinDb;
+
+    /// Time constant of the recent RSSI/SNR estimates
+    static constexpr float kEwmaTauMs = 500.f;
+    /// An antenna without packets for this long doesn't count as active.
+    static constexpr uint64_t kActiveTimeoutMs = 1000;
+
+    struct Antenna {
+        uint8_t adapter;
+        uint8_t antenna;
+        uint64_t packets;
+        int rssi_min;
+        int rssi_max;
+        float rssi_avg;
+        int snr_min;
+        int snr_max;
+        float snr_avg;
+        /// Estimates over the last kEwmaTauMs or so, for link scoring
+        float rssi_recent;
+        float snr_recent;
+        /// Had packets within kActiveTimeoutMs
+        bool active;
+        /// Bin i counts samples in [kRssiMinDbm + i * kBinDb, kRssiMinDbm + (i + 1) * kBinDb)
+        std::array<uint32_t, kRssiBins> rssi_histogram;
+        /// Bin i counts samples in [kSnrMinDb + i * kBinDb, kSnrMinDb + (i + 1) * kBinDb)
+        std::array<uint32_t, kSnrBins> snr_histogram;
+    };
+
+    struct Adapter {
+        uint8_t adapter;
+        /// Authenticated fragments this adapter received
+        uint64_t received;
+        /// Of those, ones another adapter had delivered already. received - duplicate is what this adapter
+        /// contributed.
+        uint64_t duplicate;
+        /// Fragments missing from this adapter's sequence, whether or not another adapter or FEC made up for them
+        uint64_t lost;
+
+        float loss_ratio() const {
+            return received + lost ? static_cast<float>(lost) / static_cast<float>(received + lost) : 0.f;
+        }
+    };
+
+    struct Snapshot {
+        /// Antennas that received anything, by adapter and antenna index
+        std::vector<Antenna> antennas;
+        std::vector<Adapter> adapters;
+        /// Index into `antennas` of the active one with the best recent SNR, -1 if none is active
+        int best = -1;
+        /// Number of active antennas
+        int active_antennas = 0;
+    };
+
+    AntennaStats() = default;
+
+    AntennaStats(const AntennaStats &) = delete;
+    AntennaStats &operator=(const AntennaStats &) = delete;
+
+    /// Writer: an authenticated fragment arrived on `adapter`. `antenna`, `rssi` and `noise` are in the layout of
+    /// Aggregator::process_packet(), up to kMaxAntennas entries ending at antenna index 0xff. `fragment_seq` numbers
+    /// the fragments of the session consecutively, see Aggregator::on_packet().
+    void add(uint8_t adapter,
+             const uint8_t *antenna,
+             const int8_t *rssi,
+             const int8_t *noise,
+             uint64_t fragment_seq,
+             bool duplicate,
+             uint64_t now_ms);
+
+    /// Any thread.
+    Snapshot snapshot(uint64_t now_ms) const;
+
+    /// Start over. Not while the writer runs, e.g. before the link starts.
+    void reset();
+
+private:
+    /// A fragment sequence jump further than this (or backwards) is a new session, not loss.
+    static constexpr uint64_t kMaxSeqGap = 1 << 16;
+
+    struct AntennaSlot {
+        std::atomic<uint64_t> packets{0};
+        std::atomic<int64_t> rssi_sum{0};
+        std::atomic<int64_t> snr_sum{0};
+        std::atomic<int> rssi_min{0};
+        std::atomic<int> rssi_max{0};
+        std::atomic<int> snr_min{0};
+        std::atomic<int> snr_max{0};
+        std::atomic<float> rssi_recent{0.f};
+        std::atomic<float> snr_recent{0.f};
+        std::atomic<uint64_t> last_ms{0};
+        std::array<std::atomic<uint32_t>, kRssiBins> rssi_histogram{};
+        std::array<std::atomic<uint32_t>, kSnrBins> snr_histogram{};
+    };
+
+    struct AdapterSlot {
+        std::atomic<uint64_t> received{0};
+        std::atomic<uint64_t> duplicate{0};
+        std::atomic<uint64_t> lost{0};
+
+        // Writer only
+        uint64_t last_seq = 0;
+        bool has_seq = false;
+    };
+
+    void add_sample(AntennaSlot &slot, int rssi, int snr, uint64_t now_ms);
+
+    std::array<std::array<AntennaSlot, kMaxAntennas>, kMaxAdapters> antennas_;
+    std::array<AdapterSlot, kMaxAdapters> adapters_;
+};
+
+/// Devourer reports RSSI as a 0..100 percentage, which the Realtek drivers map linearly from -100..0 dBm.
+inline int8_t rssi_percent_to_dbm(uint8_t percent) {
+    return static_cast<int8_t>(static_cast<int>(percent > 100 ? 100 : percent) - 100);
+}
+
+/// The other way round, for frames that didn't come from devourer. 0 means no signal, so the result is at least 1.
+inline uint8_t rssi_dbm_to_percent(int dbm) {
+    return static_cast<uint8_t>(dbm + 100 < 1 ? 1 : dbm + 100 > 100 ? 100 : dbm + 100);
+}
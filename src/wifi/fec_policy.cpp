@@ -0,0 +1,131 @@
+#include "fec_policy.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace {
+
+// Prior for an unknown link: rare, short bursts.
+constexpr double PRIOR_TRANSITIONS[2][2] = {{1000.0, 1.0}, {1.0, 1.0}};
+
+} // namespace
+
+int ThresholdFecPolicy::required_level(const SignalQualityCalculator::SignalQuality &quality, int) {
+    if (quality.lost_last_second > 2) {
+        return 5;
+    }
+    if (quality.recovered_last_second > 30) {
+        return 5;
+    }
+    if (quality.recovered_last_second > 24) {
+        return 3;
+    }
+    if (quality.recovered_last_second > 22) {
+        return 2;
+    }
+    if (quality.recovered_last_second > 18) {
+        return 1;
+    }
+    return 0;
+}
+
+BurstFecPolicy::BurstFecPolicy() {
+    std::copy(&PRIOR_TRANSITIONS[0][0], &PRIOR_TRANSITIONS[0][0] + 4, &transitions_[0][0]);
+}
+
+void BurstFecPolicy::on_block(const size_t *fragment_map, int observed, int k, int n) {
+    std::lock_guard lock(mutex_);
+
+    k_ = k;
+    n_ = n;
+
+    for (int i = 1; i < observed; i++) {
+        transitions_[fragment_map[i - 1] == 0][fragment_map[i] == 0] += 1.0;
+    }
+}
+
+void BurstFecPolicy::decay(Clock::time_point now) {
+    if (last_decay_ == Clock::time_point{} || now < last_decay_) {
+        last_decay_ = now;
+        return;
+    }
+
+    const double elapsed = std::chrono::duration<double>(now - last_decay_).count();
+    last_decay_ = now;
+
+    const double factor = std::exp(-elapsed / std::chrono::duration<double>(kMemory).count());
+    for (int from = 0; from < 2; from++) {
+        for (int to = 0; to < 2; to++) {
+            // Never forget below the prior, so the estimate stays defined on a silent link.
+            transitions_[from][to] = std::max(transitions_[from][to] * factor, PRIOR_TRANSITIONS[from][to]);
+        }
+    }
+}
+
+BurstFecPolicy::Model BurstFecPolicy::model() const {
+    std::lock_guard lock(mutex_);
+
+    Model model{};
+    model.p_gb = transitions_[0][1] / (transitions_[0][0] + transitions_[0][1]);
+    model.p_bg = transitions_[1][0] / (transitions_[1][0] + transitions_[1][1]);
+    model.k = k_;
+    model.n = n_;
+
+    return model;
+}
+
+int BurstFecPolicy::required_level(const SignalQualityCalculator::SignalQuality &, int current_level) {
+    {
+        std::lock_guard lock(mutex_);
+        decay(now());
+    }
+
+    const Model m = model();
+    if (m.k <= 0) {
+        return 0;
+    }
+
+    for (int level = 0; level < kMaxLevel; level++) {
+        const int n = m.n + level - current_level;
+        if (n > m.k && block_failure_probability(m.p_gb, m.p_bg, m.k, n) <= kTargetBlockLoss) {
+            return level;
+        }
+    }
+    return kMaxLevel;
+}
+
+double BurstFecPolicy::block_failure_probability(double p_gb, double p_bg, int k, int n) {
+    const int tolerable = n - k;
+    if (tolerable < 0) {
+        return 1.0;
+    }
+    if (p_gb + p_bg <= 0.0) {
+        return 0.0;
+    }
+
+    // received[j]/lost[j]: probability of having lost j fragments so far, the last one received/lost.
+    // Index tolerable + 1 collects everything beyond, the block is gone then.
+    std::vector<double> received(tolerable + 2, 0.0), lost(tolerable + 2, 0.0);
+    std::vector<double> next_received(tolerable + 2), next_lost(tolerable + 2);
+
+    const double p_bad = p_gb / (p_gb + p_bg);
+    received[0] = 1.0 - p_bad;
+    lost[std::min(1, tolerable + 1)] = p_bad;
+
+    for (int i = 1; i < n; i++) {
+        std::fill(next_received.begin(), next_received.end(), 0.0);
+        std::fill(next_lost.begin(), next_lost.end(), 0.0);
+
+        for (int j = 0; j <= tolerable + 1; j++) {
+            const int j_lost = std::min(j + 1, tolerable + 1);
+            next_received[j] += received[j] * (1.0 - p_gb) + lost[j] * p_bg;
+            next_lost[j_lost] += received[j] * p_gb + lost[j] * (1.0 - p_bg);
+        }
+
+        std::swap(received, next_received);
+        std::swap(lost, next_lost);
+    }
+
+    return received[tolerable + 1] + lost[tolerable + 1];
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+
+#include "signal_quality.h"
+
+/// Decides how much extra FEC (the alink fec_change, 0..5) to ask the drone for.
+/// The result goes to FecController::bump(), which holds it and decays it one step per second.
+class FecPolicy {
+public:
+    static constexpr int kMaxLevel = 5;
+
+    virtual ~FecPolicy() = default;
+
+    /// Name used in the config and the logs.
+    virtual const char *name() const = 0;
+
+    /// Alink thread: level the link needs now. `current_level` is what the drone was last told.
+    virtual int required_level(const SignalQualityCalculator::SignalQuality &quality, int current_level) = 0;
+
+    /// RX worker: a video FEC block left the RX ring, see Aggregator::on_block_done().
+    virtual void on_block(const size_t * /*fragment_map*/, int /*observed*/, int /*k*/, int /*n*/) {}
+};
+
+/// The original hand-tuned thresholds on last second's lost and FEC-recovered packets.
+class ThresholdFecPolicy : public FecPolicy {
+public:
+    const char *name() const override {
+        return "threshold";
+    }
+
+    int required_level(const SignalQualityCalculator::SignalQuality &quality, int current_level) override;
+};
+
+/// Fits a Gilbert-Elliott channel to the fragment loss patterns within FEC blocks and picks the smallest level
+/// that keeps the predicted probability of an unrecoverable block under a target.
+///
+/// The model is the two-state (Gilbert) variant: fragments are lost in the bad state and received in the good one.
+/// Transition counts are taken inside blocks only, and forget with a time constant of kMemory.
+///
+/// Assumption: the drone keeps k and adds one FEC fragment per block for each fec_change step, so a block
+/// seen at `current_level` with n fragments would have n + (level - current_level) at `level`.
+class BurstFecPolicy : public FecPolicy {
+public:
+    /// Acceptable probability of a block FEC can't recover
+    static constexpr double kTargetBlockLoss = 1e-3;
+    static constexpr std::chrono::seconds kMemory{5};
+
+    struct Model {
+        /// P(good -> bad), P(bad -> good) per fragment
+        double p_gb;
+        double p_bg;
+        int k;
+        int n;
+    };
+
+    BurstFecPolicy();
+
+    const char *name() const override {
+        return "burst";
+    }
+
+    int required_level(const SignalQualityCalculator::SignalQuality &quality, int current_level) override;
+
+    void on_block(const size_t *fragment_map, int observed, int k, int n) override;
+
+    Model model() const;
+
+    /// Probability that more than n - k of n fragments are lost, starting in the stationary state.
+    static double block_failure_probability(double p_gb, double p_bg, int k, int n);
+
+protected:
+    using Clock = std::chrono::steady_clock;
+
+    /// Clock for forgetting old transitions, can be replaced for simulation
+    virtual Clock::time_point now() const {
+        return Clock::now();
+    }
+
+private:
+    void decay(Clock::time_point now);
+
+    mutable std::mutex mutex_;
+
+    // Decayed transition counts between consecutive fragments, [from][to] with 0 = received, 1 = lost
+    double transitions_[2][2];
+    int k_ = 0;
+    int n_ = 0;
+    Clock::time_point last_decay_{};
+};
@@ -0,0 +1,99 @@
+#include "keyframe_requester.h"
+
+#include <random>
+
+namespace {
+
+/// 26^4 distinct codes
+constexpr uint32_t CODE_SPACE = 26 * 26 * 26 * 26;
+
+uint32_t pack_code(uint32_t counter) {
+    uint32_t packed = 0;
+    for (int i = 0; i < 4; i++) {
+        packed = (packed << 8) | static_cast<uint32_t>('a' + counter % 26);
+        counter /= 26;
+    }
+    return packed;
+}
+
+} // namespace
+
+KeyframeRequester::KeyframeRequester() {
+    // Seeded once, generating a code is then only a counter step.
+    code_counter_ = std::random_device{}() % CODE_SPACE;
+    code_.store(pack_code(code_counter_), std::memory_order_relaxed);
+}
+
+void KeyframeRequester::next_code() {
+    code_counter_ = (code_counter_ + 1) % CODE_SPACE;
+    code_.store(pack_code(code_counter_), std::memory_order_relaxed);
+}
+
+void KeyframeRequester::report(KeyframeReason reason) {
+    std::lock_guard lock(mutex_);
+
+    const auto now = Clock::now();
+    const auto since_last = now - last_request_;
+
+    const bool start = !outstanding_ && since_last >= kMinRequestInterval;
+    const bool retry = outstanding_ && since_last >= kRetryInterval;
+    if (!start && !retry) {
+        stats_.debounced++;
+        return;
+    }
+
+    next_code();
+    outstanding_ = true;
+    last_request_ = now;
+
+    stats_.requests++;
+    stats_.requests_by_reason[static_cast<size_t>(reason)]++;
+
+    if (on_request_) {
+        on_request_();
+    }
+}
+
+void KeyframeRequester::on_keyframe() {
+    std::lock_guard lock(mutex_);
+
+    stats_.keyframes++;
+
+    if (!outstanding_) {
+        return;
+    }
+    outstanding_ = false;
+
+    const double latency = std::chrono::duration<double, std::milli>(Clock::now() - last_request_).count();
+    stats_.avg_request_to_keyframe_ms += (latency - stats_.avg_request_to_keyframe_ms) / ++stats_.answered;
+    if (latency > stats_.max_request_to_keyframe_ms) {
+        stats_.max_request_to_keyframe_ms = latency;
+    }
+}
+
+std::array<char, 5> KeyframeRequester::code() const {
+    const uint32_t packed = code_.load(std::memory_order_relaxed);
+
+    std::array<char, 5> code{};
+    for (int i = 0; i < 4; i++) {
+        code[i] = static_cast<char>(packed >> (8 * (3 - i)));
+    }
+    return code;
+}
+
+void KeyframeRequester::set_on_request(std::function<void()> callback) {
+    std::lock_guard lock(mutex_);
+    on_request_ = std::move(callback);
+}
+
+KeyframeRequester::Stats KeyframeRequester::stats() const {
+    std::lock_guard lock(mutex_);
+    return stats_;
+}
+
+void KeyframeRequester::reset() {
+    std::lock_guard lock(mutex_);
+    outstanding_ = false;
+    last_request_ = {};
+    stats_ = {};
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+
+/// Where a keyframe request came from
+enum class KeyframeReason {
+    /// The video aggregator lost packets FEC couldn't recover
+    PacketLoss,
+    /// RTP sequence gap in the aggregator output
+    RtpGap,
+    /// The depacketizer assembled an access unit with packets missing
+    IncompleteAccessUnit,
+    /// avcodec_send_packet() failed
+    DecodeError,
+    /// The decoder output a frame with errors, e.g. missing references
+    CorruptFrame,
+    Count,
+};
+
+/// Turns corruption reports from the RX path and the decoder into keyframe requests for the drone.
+///
+/// A request is a new 4-letter code in the alink message's idr_request_code field; the drone sends one keyframe per
+/// new code. Reports are debounced: while a request is outstanding, more reports only renew it after kRetryInterval
+/// without a keyframe. A received keyframe ends the request. New codes are at least kMinRequestInterval apart.
+class KeyframeRequester {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr std::chrono::milliseconds kMinRequestInterval{200};
+    /// Keyframe round trip we're willing to wait for before asking again
+    static constexpr std::chrono::milliseconds kRetryInterval{500};
+
+    struct Stats {
+        uint64_t requests;
+        /// Reports that started or renewed a request, by KeyframeReason
+        uint64_t requests_by_reason[static_cast<size_t>(KeyframeReason::Count)];
+        /// Reports absorbed by a request already outstanding or the rate limit
+        uint64_t debounced;
+        uint64_t keyframes;
+        /// Requests ended by a keyframe, and the time it took
+        uint64_t answered;
+        double avg_request_to_keyframe_ms;
+        double max_request_to_keyframe_ms;
+    };
+
+    static KeyframeRequester &get_instance() {
+        static KeyframeRequester instance;
+        return instance;
+    }
+
+    /// Any thread: the video is or will be corrupted.
+    void report(KeyframeReason reason);
+
+    /// Decoder: a complete keyframe arrived, the picture recovers.
+    void on_keyframe();
+
+    /// Code for the next alink message, NUL-terminated. Lock-free, any thread.
+    std::array<char, 5> code() const;
+
+    /// Called right after a new code is made, so the alink sender can go out at once. Empty to clear.
+    void set_on_request(std::function<void()> callback);
+
+    Stats stats() const;
+
+    /// Forget the outstanding request and the stats, e.g. when the link restarts.
+    void reset();
+
+private:
+    KeyframeRequester();
+
+    /// Step to a fresh code, the mutex must be held.
+    void next_code();
+
+    mutable std::mutex mutex_;
+
+    /// Four letters packed into 32 bits, read by the alink thread without the mutex
+    std::atomic<uint32_t> code_;
+    /// Base-26 counter behind the code, starting at a random point so a restart doesn't repeat codes
+    uint32_t code_counter_;
+
+    bool outstanding_ = false;
+    Clock::time_point last_request_{};
+
+    std::function<void()> on_request_;
+
+    Stats stats_{};
+};
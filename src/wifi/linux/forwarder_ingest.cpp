@@ -0,0 +1,183 @@
+#include "forwarder_ingest.h"
+
+#ifdef __linux__
+
+    #include <poll.h>
+    #include <sys/eventfd.h>
+    #include <unistd.h>
+
+    #include <cerrno>
+    #include <climits>
+    #include <cstring>
+    #include <iterator>
+    #include <stdexcept>
+
+    #include "../antenna_stats.h"
+
+ForwarderIngest::ForwarderIngest(const std::vector<Port> &ports, uint32_t link_id, uint8_t first_adapter)
+    : slots_(std::make_unique<Slot[]>(kBatchSize)), next_adapter_(first_adapter) {
+    stop_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (stop_fd_ < 0) {
+        throw std::runtime_error(std::string("eventfd: ") + strerror(errno));
+    }
+
+    try {
+        for (const auto &port : ports) {
+            Socket socket;
+            socket.fd = open_udp_socket_for_rx(port.udp_port, kRcvBufSize);
+
+            const uint32_t channel_id = htonl(link_id << 8 | port.radio_port);
+            memcpy(socket.header, ieee80211_header, sizeof(ieee80211_header));
+            memcpy(socket.header + SRC_MAC_THIRD_BYTE, &channel_id, sizeof(channel_id));
+            memcpy(socket.header + DST_MAC_THIRD_BYTE, &channel_id, sizeof(channel_id));
+
+            sockets_.push_back(socket);
+        }
+    } catch (...) {
+        for (const auto &socket : sockets_) {
+            close(socket.fd);
+        }
+        close(stop_fd_);
+        throw;
+    }
+
+    for (size_t i = 0; i < kBatchSize; i++) {
+        Slot &slot = slots_[i];
+        slot.iov[0] = {.iov_base = &slot.hdr, .iov_len = sizeof(slot.hdr)};
+        slot.iov[1] = {.iov_base = slot.frame + sizeof(ieee80211_header), .iov_len = MAX_FORWARDER_PACKET_SIZE};
+
+        msgs_[i].msg_hdr.msg_name = &slot.from;
+        msgs_[i].msg_hdr.msg_iov = slot.iov;
+        msgs_[i].msg_hdr.msg_iovlen = std::size(slot.iov);
+    }
+}
+
+ForwarderIngest::~ForwarderIngest() {
+    for (const auto &socket : sockets_) {
+        close(socket.fd);
+    }
+    close(stop_fd_);
+}
+
+void ForwarderIngest::run(const Callback &callback) {
+    std::vector<pollfd> fds;
+    for (const auto &socket : sockets_) {
+        fds.push_back({.fd = socket.fd, .events = POLLIN, .revents = 0});
+    }
+    fds.push_back({.fd = stop_fd_, .events = POLLIN, .revents = 0});
+
+    for (;;) {
+        int rc = poll(fds.data(), fds.size(), -1);
+        if (rc < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error(std::string("poll: ") + strerror(errno));
+        }
+
+        if (fds.back().revents & POLLIN) {
+            return;
+        }
+
+        for (size_t i = 0; i < sockets_.size(); i++) {
+            if (fds[i].revents & (POLLERR | POLLNVAL)) {
+                throw std::runtime_error(std::string("forwarder socket error: ") + strerror(errno));
+            }
+            if (fds[i].revents & POLLIN) {
+                receive(sockets_[i], callback);
+            }
+        }
+    }
+}
+
+void ForwarderIngest::stop() {
+    const uint64_t one = 1;
+    write(stop_fd_, &one, sizeof(one));
+}
+
+ForwarderIngest::Stats ForwarderIngest::stats() const {
+    return {
+        .datagrams = datagrams_.load(std::memory_order_relaxed),
+        .batches = batches_.load(std::memory_order_relaxed),
+        .malformed = malformed_.load(std::memory_order_relaxed),
+        .sources = num_sources_.load(std::memory_order_relaxed),
+    };
+}
+
+void ForwarderIngest::receive(const Socket &socket, const Callback &callback) {
+    for (;;) {
+        // The kernel overwrites these, the rest of the headers stays as set up.
+        for (auto &msg : msgs_) {
+            msg.msg_hdr.msg_namelen = sizeof(sockaddr_in);
+            msg.msg_hdr.msg_flags = 0;
+        }
+
+        const int count = recvmmsg(socket.fd, msgs_, kBatchSize, MSG_DONTWAIT, nullptr);
+        if (count < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                return;
+            }
+            throw std::runtime_error(std::string("recvmmsg: ") + strerror(errno));
+        }
+
+        batches_.store(batches_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        datagrams_.store(datagrams_.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+
+        for (int i = 0; i < count; i++) {
+            Slot &slot = slots_[i];
+            const size_t size = msgs_[i].msg_len;
+            if (size < sizeof(wrxfwd_t) || (msgs_[i].msg_hdr.msg_flags & MSG_TRUNC)) {
+                malformed_.store(malformed_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                continue;
+            }
+
+            // Back into the frame the node's adapter received. The FCS isn't forwarded and nobody checks it.
+            const size_t payload_size = size - sizeof(wrxfwd_t);
+            memcpy(slot.frame, socket.header, sizeof(socket.header));
+            memset(slot.frame + sizeof(ieee80211_header) + payload_size, 0, 4);
+
+            // And its signal levels into what devourer reports
+            decltype(Packet::RxAtrib) attrib{};
+            for (int a = 0; a < RX_ANT_MAX && slot.hdr.antenna[a] != 0xff; a++) {
+                const uint8_t antenna = slot.hdr.antenna[a];
+                if (antenna >= std::size(attrib.rssi) || slot.hdr.rssi[a] == SCHAR_MIN) {
+                    continue;
+                }
+                attrib.rssi[antenna] = rssi_dbm_to_percent(slot.hdr.rssi[a]);
+                attrib.snr[antenna] = slot.hdr.noise[a] != SCHAR_MAX ? slot.hdr.rssi[a] - slot.hdr.noise[a] : 0;
+            }
+
+            const RxSource source{
+                .adapter = source_adapter(slot.from, slot.hdr.wlan_idx),
+                .remote_addr = slot.from.sin_addr.s_addr,
+                .freq = ntohs(slot.hdr.freq),
+                .bandwidth = slot.hdr.bandwidth,
+            };
+
+            callback(Packet{attrib, std::span<uint8_t>(slot.frame, sizeof(ieee80211_header) + payload_size + 4)},
+                     source);
+        }
+
+        if (static_cast<size_t>(count) < kBatchSize) {
+            return;
+        }
+    }
+}
+
+uint8_t ForwarderIngest::source_adapter(const sockaddr_in &from, uint8_t wlan_idx) {
+    // Like Aggregator::log_rssi(), the port doesn't matter: all forwarders of a node share its adapters.
+    const uint64_t key = static_cast<uint64_t>(ntohl(from.sin_addr.s_addr)) << 8 | wlan_idx;
+
+    auto it = sources_.find(key);
+    if (it == sources_.end()) {
+        it = sources_.emplace(key, next_adapter_).first;
+        // Past the last index everything shares it, the aggregator doesn't care.
+        if (next_adapter_ < UINT8_MAX) {
+            next_adapter_++;
+        }
+        num_sources_.store(sources_.size(), std::memory_order_relaxed);
+    }
+    return it->second;
+}
+
+#endif
@@ -0,0 +1,104 @@
+#pragma once
+
+#ifdef __linux__
+
+    #include <netinet/in.h>
+    #include <sys/socket.h>
+
+    #include <atomic>
+    #include <cstdint>
+    #include <functional>
+    #include <memory>
+    #include <unordered_map>
+    #include <vector>
+
+    #include "../rx_pipeline.h"
+    #include "../wfb-ng/wifibroadcast.hpp"
+
+/// Takes the streams of wfb-ng forwarders (`wfb_rx -f`) on remote RX nodes, so receive-only boxes at the field edge
+/// can feed one display station, alone or next to its own adapters.
+/// A forwarder sends a wrxfwd_t header and the payload of one frame per datagram, and only one channel, so every UDP
+/// port stands for a radio port. Frames come out as if an adapter had received them, with the RX node and its
+/// adapter in the RxSource.
+class ForwarderIngest {
+public:
+    struct Port {
+        uint16_t udp_port;
+        uint8_t radio_port;
+    };
+
+    /// Called on the run() thread.
+    using Callback = std::function<void(const Packet &packet, const RxSource &source)>;
+
+    struct Stats {
+        uint64_t datagrams;
+        /// recvmmsg() calls that returned datagrams
+        uint64_t batches;
+        /// Shorter than the forwarder header, or truncated
+        uint64_t malformed;
+        /// Remote adapters seen, by node address and wlan_idx
+        size_t sources;
+    };
+
+    /// Datagrams per recvmmsg() call. A full batch is ~30 fragments, a few ms of video at high rates.
+    static constexpr size_t kBatchSize = 32;
+
+    /// Socket receive buffer, room for bursts from several nodes while the thread is busy
+    static constexpr int kRcvBufSize = 4 << 20;
+
+    /// Binds all `ports`. `link_id` goes into the 802.11 headers of the rebuilt frames, remote adapters are numbered
+    /// from `first_adapter` on in the order they show up. Throws std::runtime_error if a port can't be bound.
+    ForwarderIngest(const std::vector<Port> &ports, uint32_t link_id, uint8_t first_adapter);
+
+    ~ForwarderIngest();
+
+    ForwarderIngest(const ForwarderIngest &) = delete;
+    ForwarderIngest &operator=(const ForwarderIngest &) = delete;
+
+    /// Receive until stop(). Throws std::runtime_error on socket errors.
+    void run(const Callback &callback);
+
+    /// Any thread, also before run().
+    void stop();
+
+    /// Any thread.
+    Stats stats() const;
+
+private:
+    struct Socket {
+        int fd = -1;
+        /// The 802.11 header a local adapter would have seen for this port's channel
+        uint8_t header[sizeof(ieee80211_header)];
+    };
+
+    /// One datagram of a batch, rebuilt in place into a frame: 802.11 header, payload, FCS
+    struct Slot {
+        wrxfwd_t hdr;
+        sockaddr_in from;
+        iovec iov[2];
+        uint8_t frame[sizeof(ieee80211_header) + MAX_FORWARDER_PACKET_SIZE + 4];
+    };
+
+    /// Drain `socket` a batch at a time.
+    void receive(const Socket &socket, const Callback &callback);
+
+    uint8_t source_adapter(const sockaddr_in &from, uint8_t wlan_idx);
+
+    std::vector<Socket> sockets_;
+    int stop_fd_ = -1;
+
+    std::unique_ptr<Slot[]> slots_;
+    mmsghdr msgs_[kBatchSize]{};
+
+    /// (IPv4 address << 8) | wlan_idx to adapter index, run() thread only
+    std::unordered_map<uint64_t, uint8_t> sources_;
+    uint8_t next_adapter_;
+
+    // Written by the run() thread only
+    std::atomic<uint64_t> datagrams_{0};
+    std::atomic<uint64_t> batches_{0};
+    std::atomic<uint64_t> malformed_{0};
+    std::atomic<size_t> num_sources_{0};
+};
+
+#endif
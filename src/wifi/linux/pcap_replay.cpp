@@ -0,0 +1,211 @@
+#include "pcap_replay.h"
+
+#ifdef __linux__
+
+    #include <cerrno>
+    #include <climits>
+    #include <cstring>
+    #include <iterator>
+    #include <stdexcept>
+    #include <thread>
+
+    #include "../antenna_stats.h"
+
+extern "C" {
+    #include "ieee80211_radiotap.h"
+}
+
+namespace {
+
+/// Antenna slots per frame, wfb-ng's RX_ANT_MAX
+constexpr int RADIOTAP_ANT_MAX = 4;
+
+pcap_t *open_capture(const std::string &path) {
+    char errbuf[PCAP_ERRBUF_SIZE];
+    pcap_t *pcap = pcap_open_offline(path.c_str(), errbuf);
+    if (!pcap) {
+        throw std::runtime_error(path + ": " + errbuf);
+    }
+    if (pcap_datalink(pcap) != DLT_IEEE802_11_RADIO) {
+        pcap_close(pcap);
+        throw std::runtime_error(path + ": not a radiotap capture");
+    }
+    return pcap;
+}
+
+std::chrono::microseconds to_duration(const timeval &tv) {
+    return std::chrono::seconds(tv.tv_sec) + std::chrono::microseconds(tv.tv_usec);
+}
+
+} // namespace
+
+PcapReplay::PcapReplay(const std::vector<std::string> &paths) {
+    bool has_base = false;
+
+    for (const auto &path : paths) {
+        Capture capture;
+        capture.path = path;
+
+        // Peek at the first frame for the common time base, then start over.
+        pcap_t *pcap = open_capture(path);
+        pcap_pkthdr *hdr;
+        const u_char *data;
+        if (pcap_next_ex(pcap, &hdr, &data) == 1) {
+            const auto first = to_duration(hdr->ts);
+            if (!has_base || first < base_time_) {
+                base_time_ = first;
+                has_base = true;
+            }
+        }
+        pcap_close(pcap);
+
+        captures_.push_back(capture);
+    }
+
+    // Opened last, so a failure above leaves nothing to close.
+    try {
+        for (auto &capture : captures_) {
+            capture.pcap = open_capture(capture.path);
+        }
+    } catch (...) {
+        for (auto &capture : captures_) {
+            if (capture.pcap) {
+                pcap_close(capture.pcap);
+            }
+        }
+        throw;
+    }
+}
+
+PcapReplay::~PcapReplay() {
+    for (auto &capture : captures_) {
+        pcap_close(capture.pcap);
+    }
+}
+
+void PcapReplay::run(const Callback &callback) {
+    should_stop_ = false;
+    start_ = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < captures_.size(); i++) {
+        threads.emplace_back(&PcapReplay::play, this, std::ref(captures_[i]), static_cast<uint8_t>(i), callback);
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+}
+
+void PcapReplay::stop() {
+    {
+        std::lock_guard lock(mutex_);
+        should_stop_ = true;
+    }
+    stop_cv_.notify_all();
+}
+
+std::vector<PcapReplay::Stats> PcapReplay::stats() const {
+    std::vector<Stats> result;
+    for (const auto &capture : captures_) {
+        result.push_back(capture.stats);
+    }
+    return result;
+}
+
+bool PcapReplay::wait_until(std::chrono::steady_clock::time_point deadline) {
+    std::unique_lock lock(mutex_);
+    return !stop_cv_.wait_until(lock, deadline, [this] { return should_stop_.load(); });
+}
+
+void PcapReplay::play(Capture &capture, uint8_t adapter, const Callback &callback) {
+    std::vector<uint8_t> frame;
+
+    pcap_pkthdr *hdr;
+    const u_char *pkt;
+    while (!should_stop_ && pcap_next_ex(capture.pcap, &hdr, &pkt) == 1) {
+        if (!wait_until(start_ + (to_duration(hdr->ts) - base_time_))) {
+            break;
+        }
+
+        // Same radiotap fields as wfb-ng's Receiver::loop_iter()
+        int ant_idx = 0;
+        uint8_t antenna[RADIOTAP_ANT_MAX];
+        int8_t rssi[RADIOTAP_ANT_MAX];
+        int8_t noise[RADIOTAP_ANT_MAX];
+        uint8_t flags = 0;
+        bool self_injected = false;
+
+        memset(antenna, 0xff, sizeof(antenna));
+        memset(rssi, SCHAR_MIN, sizeof(rssi));
+        memset(noise, SCHAR_MAX, sizeof(noise));
+
+        ieee80211_radiotap_iterator iterator;
+        int ret = ieee80211_radiotap_iterator_init(&iterator, (ieee80211_radiotap_header *)pkt, hdr->caplen, NULL);
+
+        while (ret == 0 && ant_idx < RADIOTAP_ANT_MAX) {
+            ret = ieee80211_radiotap_iterator_next(&iterator);
+            if (ret) {
+                continue;
+            }
+
+            switch (iterator.this_arg_index) {
+                case IEEE80211_RADIOTAP_ANTENNA:
+                    antenna[ant_idx] = *(uint8_t *)(iterator.this_arg);
+                    ant_idx += 1;
+                    break;
+                case IEEE80211_RADIOTAP_DBM_ANTSIGNAL:
+                    rssi[ant_idx] = *(int8_t *)(iterator.this_arg);
+                    break;
+                case IEEE80211_RADIOTAP_DBM_ANTNOISE:
+                    noise[ant_idx] = *(int8_t *)(iterator.this_arg);
+                    break;
+                case IEEE80211_RADIOTAP_FLAGS:
+                    flags = *(uint8_t *)(iterator.this_arg);
+                    break;
+                case IEEE80211_RADIOTAP_TX_FLAGS:
+                    self_injected = true;
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        const bool parse_error = ret != -ENOENT && ant_idx < RADIOTAP_ANT_MAX;
+        if (parse_error || self_injected || (flags & IEEE80211_RADIOTAP_F_BADFCS)) {
+            capture.stats.skipped++;
+            continue;
+        }
+
+        // Only a combined signal, no per-antenna fields: call it path 0.
+        if (ant_idx == 0 && rssi[0] != SCHAR_MIN) {
+            antenna[0] = 0;
+            ant_idx = 1;
+        }
+
+        // Back to what devourer reports
+        decltype(Packet::RxAtrib) attrib{};
+        for (int i = 0; i < ant_idx; i++) {
+            if (antenna[i] >= std::size(attrib.rssi) || rssi[i] == SCHAR_MIN) {
+                continue;
+            }
+            attrib.rssi[antenna[i]] = rssi_dbm_to_percent(rssi[i]);
+            attrib.snr[antenna[i]] = noise[i] != SCHAR_MAX ? rssi[i] - noise[i] : 0;
+        }
+
+        // The RX path expects the FCS at the end, like it comes from the adapter.
+        const size_t radiotap_len = iterator._max_length;
+        const size_t fcs_len = (flags & IEEE80211_RADIOTAP_F_FCS) ? 4 : 0;
+        if (hdr->caplen < radiotap_len + fcs_len) {
+            capture.stats.skipped++;
+            continue;
+        }
+        const size_t frame_len = hdr->caplen - radiotap_len - fcs_len;
+        frame.assign(pkt + radiotap_len, pkt + radiotap_len + frame_len);
+        frame.resize(frame_len + 4);
+
+        capture.stats.frames++;
+        callback(Packet{attrib, std::span<uint8_t>(frame.data(), frame.size())}, adapter);
+    }
+}
+
+#endif
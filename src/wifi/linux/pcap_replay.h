@@ -0,0 +1,76 @@
+#pragma once
+
+#ifdef __linux__
+
+    #include <pcap.h>
+
+    #include <atomic>
+    #include <chrono>
+    #include <condition_variable>
+    #include <cstdint>
+    #include <functional>
+    #include <mutex>
+    #include <string>
+    #include <vector>
+
+    #include "Rtl8812aDevice.h"
+
+/// Plays back radiotap captures of a monitor-mode interface (e.g. `tcpdump -i wlan0 -w a.pcap`) as if each one
+/// came from its own adapter, so diversity reception can be tested without the hardware.
+/// All captures share one time base, so ones recorded side by side interleave like they did on air.
+class PcapReplay {
+public:
+    /// Called on the capture's own thread, with the capture's index as the adapter.
+    using Callback = std::function<void(const Packet &packet, uint8_t adapter)>;
+
+    struct Stats {
+        uint64_t frames;
+        /// Not radiotap, bad FCS or self-injected
+        uint64_t skipped;
+    };
+
+    /// Throws std::runtime_error if a capture can't be opened or has no radiotap headers.
+    explicit PcapReplay(const std::vector<std::string> &paths);
+
+    ~PcapReplay();
+
+    PcapReplay(const PcapReplay &) = delete;
+    PcapReplay &operator=(const PcapReplay &) = delete;
+
+    /// Play all captures, one thread each, and return when they're done or stop() was called.
+    void run(const Callback &callback);
+
+    /// Any thread.
+    void stop();
+
+    size_t size() const {
+        return captures_.size();
+    }
+
+    /// After run(), per capture.
+    std::vector<Stats> stats() const;
+
+private:
+    struct Capture {
+        std::string path;
+        pcap_t *pcap = nullptr;
+        Stats stats{};
+    };
+
+    void play(Capture &capture, uint8_t adapter, const Callback &callback);
+
+    /// Sleep until `deadline` or stop(). Returns false on stop().
+    bool wait_until(std::chrono::steady_clock::time_point deadline);
+
+    std::vector<Capture> captures_;
+
+    /// Capture time that maps to the start of run(), the earliest first frame of all captures
+    std::chrono::microseconds base_time_{};
+    std::chrono::steady_clock::time_point start_;
+
+    std::mutex mutex_;
+    std::condition_variable stop_cv_;
+    std::atomic<bool> should_stop_{false};
+};
+
+#endif
@@ -13,9 +13,15 @@
 // Transmitter
 //-------------------------------------------------------------
 
-Transmitter::Transmitter(const int k, const int n, const std::string &keypair, uint64_t epoch, uint32_t channelId)
+Transmitter::Transmitter(const int k,
+                         const int n,
+                         const std::string &keypair,
+                         uint64_t epoch,
+                         uint32_t channelId,
+                         size_t headroom)
     : fecPtr_(nullptr, FecDeleter{}), fecK_(k), fecN_(n), blockIndex_(0), fragmentIndex_(0),
-      block_(static_cast<size_t>(n)), maxPacketSize_(0), epoch_(epoch), channelId_(channelId) {
+      block_(static_cast<size_t>(n)), fragmentSize_(static_cast<size_t>(k)), maxPacketSize_(0), headroom_(headroom),
+      frame_(new uint8_t[headroom + MAX_FORWARDER_PACKET_SIZE]), epoch_(epoch), channelId_(channelId) {
     // Create a new fec object
     fec_t *rawFec;
     fec_new(fecK_, fecN_, &rawFec);
@@ -78,11 +84,7 @@ bool Transmitter::sendPacket(const uint8_t *buf, const size_t size, const uint8_
     std::memcpy(block_[fragmentIndex_].get() + wpacketHdrSize, buf, size);
 
     const size_t fecPayloadSize = wpacketHdrSize + size;
-
-    // Zero out the remainder
-    if (fecPayloadSize < MAX_FEC_PAYLOAD) {
-        std::memset(block_[fragmentIndex_].get() + fecPayloadSize, 0, MAX_FEC_PAYLOAD - fecPayloadSize);
-    }
+    fragmentSize_[fragmentIndex_] = fecPayloadSize;
 
     // Send this fragment
     sendBlockFragment(fecPayloadSize);
@@ -96,6 +98,11 @@ bool Transmitter::sendPacket(const uint8_t *buf, const size_t size, const uint8_
         return true;
     }
 
+    // FEC needs the fragments zero-padded to the same size, but only to the longest in this block
+    for (size_t i = 0; i < fecK_; i++) {
+        std::memset(block_[i].get() + fragmentSize_[i], 0, maxPacketSize_ - fragmentSize_[i]);
+    }
+
     // If we have k fragments, encode the parity
     fec_encode_simd(fecPtr_.get(),
                     reinterpret_cast<uint8_t **>(block_.data()),
@@ -123,21 +130,28 @@ bool Transmitter::sendPacket(const uint8_t *buf, const size_t size, const uint8_
 }
 
 void Transmitter::sendSessionKey() {
-    injectPacket(sessionKeyPacket_, sizeof(sessionKeyPacket_));
+    uint8_t *packet = frame_.get() + headroom_;
+    std::memcpy(packet, sessionKeyPacket_, sizeof(sessionKeyPacket_));
+    injectPacket(packet, sizeof(sessionKeyPacket_));
+}
+
+std::unique_ptr<uint8_t[]> Transmitter::swapFrame(std::unique_ptr<uint8_t[]> frame) {
+    frame_.swap(frame);
+    return frame;
 }
 
 void Transmitter::sendBlockFragment(const size_t packetSize) {
-    // Prepare local buffer for encryption
-    uint8_t cipherBuf[MAX_FORWARDER_PACKET_SIZE] = {};
+    // Encrypt straight into the packet to inject
+    uint8_t *packet = frame_.get() + headroom_;
 
-    auto *blockHdr = reinterpret_cast<wblock_hdr_t *>(cipherBuf);
+    auto *blockHdr = reinterpret_cast<wblock_hdr_t *>(packet);
     blockHdr->packet_type = WFB_PACKET_DATA;
     blockHdr->data_nonce = htobe64(((blockIndex_ & BLOCK_IDX_MASK) << 8) + fragmentIndex_);
 
     unsigned long long cipherLen = 0;
 
     // AEAD encrypt
-    const int rc = crypto_aead_chacha20poly1305_encrypt(cipherBuf + sizeof(wblock_hdr_t),
+    const int rc = crypto_aead_chacha20poly1305_encrypt(packet + sizeof(wblock_hdr_t),
                                                         &cipherLen,
                                                         block_[fragmentIndex_].get(),
                                                         packetSize,
@@ -151,7 +165,7 @@ void Transmitter::sendBlockFragment(const size_t packetSize) {
     }
 
     const size_t finalSize = sizeof(wblock_hdr_t) + cipherLen;
-    injectPacket(cipherBuf, finalSize);
+    injectPacket(packet, finalSize);
 }
 
 void Transmitter::makeSessionKey() {
@@ -240,7 +254,7 @@ RawSocketTransmitter::~RawSocketTransmitter() {
     }
 }
 
-void RawSocketTransmitter::injectPacket(const uint8_t *buf, size_t size) {
+void RawSocketTransmitter::injectPacket(uint8_t *buf, size_t size) {
     if (size > MAX_FORWARDER_PACKET_SIZE) {
         throw std::runtime_error("RawSocketTransmitter::injectPacket - packet too large");
     }
@@ -266,7 +280,7 @@ void RawSocketTransmitter::injectPacket(const uint8_t *buf, size_t size) {
     iov[0].iov_len = radiotapHeaderLen_;
     iov[1].iov_base = const_cast<uint8_t *>(ieeeHdr);
     iov[1].iov_len = sizeof(ieeeHdr);
-    iov[2].iov_base = const_cast<uint8_t *>(buf);
+    iov[2].iov_base = buf;
     iov[2].iov_len = size;
 
     msghdr msg = {};
@@ -360,7 +374,7 @@ void UdpTransmitter::selectOutput(int idx) {
     saddr_.sin_port = htons(static_cast<unsigned short>(basePort_ + idx));
 }
 
-void UdpTransmitter::injectPacket(const uint8_t *buf, size_t size) {
+void UdpTransmitter::injectPacket(uint8_t *buf, size_t size) {
     // Create a random wrxfwd_t header
     wrxfwd_t fwdHeader = {};
     fwdHeader.wlan_idx = static_cast<uint8_t>(std::rand() % 2);
@@ -375,7 +389,7 @@ void UdpTransmitter::injectPacket(const uint8_t *buf, size_t size) {
     iovec iov[2];
     iov[0].iov_base = reinterpret_cast<void *>(&fwdHeader);
     iov[0].iov_len = sizeof(fwdHeader);
-    iov[1].iov_base = const_cast<uint8_t *>(buf);
+    iov[1].iov_base = buf;
     iov[1].iov_len = size;
 
     msghdr msg = {};
@@ -400,12 +414,37 @@ UsbTransmitter::UsbTransmitter(int k,
                                size_t radiotapHeaderLen,
                                uint8_t frameType,
                                Rtl8812aDevice *device)
-    : Transmitter(k, n, keypair, epoch, channelId), channelId_(channelId), currentOutput_(0), ieee80211Sequence_(0),
-      radiotapHeader_(radiotapHeader), radiotapHeaderLen_(radiotapHeaderLen), frameType_(frameType),
-      rtlDevice_(device) {}
+    : Transmitter(k, n, keypair, epoch, channelId, radiotapHeaderLen + sizeof(ieee80211_header)),
+      ieee80211Sequence_(0), headers_(new uint8_t[radiotapHeaderLen + sizeof(ieee80211_header)]),
+      radiotapHeaderLen_(radiotapHeaderLen), rtlDevice_(device),
+      spare_(new uint8_t[radiotapHeaderLen + sizeof(ieee80211_header) + MAX_FORWARDER_PACKET_SIZE]) {
+    std::memcpy(headers_.get(), radiotapHeader, radiotapHeaderLen);
+
+    uint8_t *ieeeHdr = headers_.get() + radiotapHeaderLen;
+    std::memcpy(ieeeHdr, ieee80211_header, sizeof(ieee80211_header));
+
+    // Patch frame type
+    ieeeHdr[0] = frameType;
+    const uint32_t channelIdBE = htonl(channelId);
+    std::memcpy(ieeeHdr + SRC_MAC_THIRD_BYTE, &channelIdBE, sizeof(uint32_t));
+    std::memcpy(ieeeHdr + DST_MAC_THIRD_BYTE, &channelIdBE, sizeof(uint32_t));
+
+    submitter_ = std::thread(&UsbTransmitter::submitLoop, this);
+}
+
+UsbTransmitter::~UsbTransmitter() {
+    {
+        std::lock_guard lock(mutex_);
+        stopping_ = true;
+    }
+    frameQueued_.notify_all();
+    frameSent_.notify_all();
+
+    submitter_.join();
+}
 
 void UsbTransmitter::selectOutput(int idx) {
-    currentOutput_ = idx;
+    // A single device, mirroring or not
 }
 
 void UsbTransmitter::dumpStats(FILE *fp,
@@ -413,29 +452,37 @@ void UsbTransmitter::dumpStats(FILE *fp,
                                uint32_t &injectedPackets,
                                uint32_t &droppedPackets,
                                uint32_t &injectedBytes) {
-    for (auto &kv : antennaStat_) {
-        const auto &stats = kv.second;
-        uint64_t countAll = stats.countPacketsInjected + stats.countPacketsDropped;
-        uint64_t avgLatency = (countAll == 0) ? 0 : (stats.latencySum / countAll);
-
-        // fprintf(fp,
-        //         "%" PRIu64 "\tTX_ANT\t%" PRIx64 "\t%u:%u:%" PRIu64 ":%" PRIu64 ":%" PRIu64 "\n",
-        //         ts,
-        //         kv.first,
-        //         stats.countPacketsInjected,
-        //         stats.countPacketsDropped,
-        //         stats.latencyMin,
-        //         avgLatency,
-        //         stats.latencyMax);
+    TxAntennaItem stats;
+    uint32_t stalls;
+    uint64_t stallUs;
+    {
+        std::lock_guard lock(mutex_);
+        stats = antennaStat_;
+        stalls = stalls_;
+        stallUs = stallUs_;
+        antennaStat_ = TxAntennaItem();
+        stalls_ = 0;
+        stallUs_ = 0;
+    }
 
-        injectedPackets += stats.countPacketsInjected;
-        droppedPackets += stats.countPacketsDropped;
-        injectedBytes += stats.countBytesInjected;
+    injectedPackets += stats.countPacketsInjected;
+    droppedPackets += stats.countPacketsDropped;
+    injectedBytes += stats.countBytesInjected;
+
+    if (stalls) {
+        const uint64_t countAll = stats.countPacketsInjected + stats.countPacketsDropped;
+        std::fprintf(fp,
+                     "USB TX: waited %" PRIu64 " us for the previous transfer %u times, latency %" PRIu64 ":%" PRIu64
+                     ":%" PRIu64 " us\n",
+                     stallUs,
+                     stalls,
+                     stats.latencyMin,
+                     countAll ? stats.latencySum / countAll : 0,
+                     stats.latencyMax);
     }
-    antennaStat_.clear();
 }
 
-void UsbTransmitter::injectPacket(const uint8_t *buf, const size_t size) {
+void UsbTransmitter::injectPacket(uint8_t *buf, const size_t size) {
     if (!rtlDevice_ || rtlDevice_->should_stop) {
         throw std::runtime_error("UsbTransmitter: main thread exit, should stop");
     }
@@ -444,36 +491,67 @@ void UsbTransmitter::injectPacket(const uint8_t *buf, const size_t size) {
         throw std::runtime_error("UsbTransmitter:: packet too large");
     }
 
-    uint8_t ieeeHdr[sizeof(ieee80211_header)];
-    std::memcpy(ieeeHdr, ieee80211_header, sizeof(ieee80211_header));
-
-    // Patch frame type
-    ieeeHdr[0] = frameType_;
-    const uint32_t channelIdBE = htonl(channelId_);
-    std::memcpy(ieeeHdr + SRC_MAC_THIRD_BYTE, &channelIdBE, sizeof(uint32_t));
-    std::memcpy(ieeeHdr + DST_MAC_THIRD_BYTE, &channelIdBE, sizeof(uint32_t));
+    // Headers go into the headroom right in front of the packet, so the frame is sent from the buffer it was built in
+    const size_t headersLen = radiotapHeaderLen_ + sizeof(ieee80211_header);
+    uint8_t *frame = buf - headersLen;
+    std::memcpy(frame, headers_.get(), headersLen);
 
+    uint8_t *ieeeHdr = frame + radiotapHeaderLen_;
     ieeeHdr[FRAME_SEQ_LB] = static_cast<uint8_t>(ieee80211Sequence_ & 0xff);
     ieeeHdr[FRAME_SEQ_HB] = static_cast<uint8_t>((ieee80211Sequence_ >> 8) & 0xff);
     ieee80211Sequence_ += 16;
 
     const uint64_t startUs = get_time_us();
 
-    // Merge into one contiguous buffer
-    const size_t totalSize = radiotapHeaderLen_ + sizeof(ieeeHdr) + size;
-    std::unique_ptr<uint8_t[]> buffer(new uint8_t[totalSize]);
-
-    std::memcpy(buffer.get(), radiotapHeader_, radiotapHeaderLen_);
-    std::memcpy(buffer.get() + radiotapHeaderLen_, ieeeHdr, sizeof(ieeeHdr));
-    std::memcpy(buffer.get() + radiotapHeaderLen_ + sizeof(ieeeHdr), buf, size);
+    {
+        std::unique_lock lock(mutex_);
+        if (!spare_) {
+            // Backpressure. Dropping instead would lose FEC fragments while the device is merely busy.
+            ++stalls_;
+            while (!spare_) {
+                // should_stop is set without notifying us, so check it now and then
+                frameSent_.wait_for(lock, std::chrono::milliseconds(100));
+                if (stopping_ || rtlDevice_->should_stop) {
+                    throw std::runtime_error("UsbTransmitter: main thread exit, should stop");
+                }
+            }
+            stallUs_ += get_time_us() - startUs;
+        }
 
-    const bool result = rtlDevice_->send_packet(buffer.get(), totalSize);
-    if (!result) {
-        printf("Rtl8812aDevice::send_packet failed!\n");
+        // The previous transfer is done, so the slot is empty. Hand the buffer over as is, the next packet is built in
+        // the one just sent.
+        slot_.frame = swapFrame(std::move(spare_));
+        slot_.size = headersLen + size;
+        slot_.payloadSize = size;
+        slot_.queuedUs = startUs;
     }
+    frameQueued_.notify_one();
+}
 
-    const uint64_t key = (static_cast<uint64_t>(currentOutput_) << 8) | 0xff;
-    antennaStat_[key].logLatency(get_time_us() - startUs, result, static_cast<uint32_t>(size));
+void UsbTransmitter::submitLoop() {
+    while (true) {
+        TxSlot slot;
+        {
+            std::unique_lock lock(mutex_);
+            frameQueued_.wait(lock, [this] { return slot_.frame || stopping_; });
+            if (stopping_) {
+                return;
+            }
+            slot = std::move(slot_);
+        }
+
+        const bool result = !rtlDevice_->should_stop && rtlDevice_->send_packet(slot.frame.get(), slot.size);
+        if (!result && !rtlDevice_->should_stop) {
+            printf("Rtl8812aDevice::send_packet failed!\n");
+        }
+
+        {
+            std::lock_guard lock(mutex_);
+            antennaStat_.logLatency(get_time_us() - slot.queuedUs, result, static_cast<uint32_t>(slot.payloadSize));
+            spare_ = std::move(slot.frame);
+        }
+        frameSent_.notify_one();
+    }
 }
 
 #endif
@@ -16,7 +16,10 @@ extern "C" {
 
     #include <algorithm>
     #include <cerrno>
+    #include <condition_variable>
     #include <memory>
+    #include <mutex>
+    #include <thread>
     #include <unordered_map>
     #include <vector>
 
@@ -47,8 +50,9 @@ public:
      * @param keypair File path to keypair file.
      * @param epoch Unique epoch for the session.
      * @param channelId Channel identifier (e.g., linkId << 8 | radioPort).
+     * @param headroom Bytes in front of each injected packet that injectPacket() may write its own headers into.
      */
-    Transmitter(int k, int n, const std::string &keypair, uint64_t epoch, uint32_t channelId);
+    Transmitter(int k, int n, const std::string &keypair, uint64_t epoch, uint32_t channelId, size_t headroom = 0);
 
     /**
      * @brief Virtual destructor to ensure proper cleanup in derived classes.
@@ -92,10 +96,18 @@ public:
 protected:
     /**
      * @brief Actually injects (sends) the final buffer. Implemented by derived classes.
-     * @param buf Pointer to data to send.
+     * @param buf Pointer to data to send, preceded by the headroom given to the constructor.
      * @param size Byte length of data to send.
      */
-    virtual void injectPacket(const uint8_t *buf, size_t size) = 0;
+    virtual void injectPacket(uint8_t *buf, size_t size) = 0;
+
+    /**
+     * @brief Takes the buffer of the packet being injected and builds the next packets in `frame` instead.
+     * Lets injectPacket() hand its packet on without copying it. The buffer is not touched once injectPacket() returns.
+     * @param frame A free buffer as large as the one returned.
+     * @return The buffer holding the packet, starting with the headroom.
+     */
+    std::unique_ptr<uint8_t[]> swapFrame(std::unique_ptr<uint8_t[]> frame);
 
 private:
     void sendBlockFragment(size_t packetSize);
@@ -111,8 +123,15 @@ private:
     uint64_t blockIndex_;
     uint8_t fragmentIndex_;
     std::vector<std::unique_ptr<uint8_t[]>> block_;
+    // Bytes written to each data fragment. The rest is only zeroed up to maxPacketSize_, right before FEC encoding.
+    std::vector<size_t> fragmentSize_;
     size_t maxPacketSize_;
 
+    // The packet being injected, after headroom_ bytes for the derived class. Encryption can't work in place,
+    // the block needs its plaintext fragments until the parity is encoded. swapFrame() may replace the buffer.
+    const size_t headroom_;
+    std::unique_ptr<uint8_t[]> frame_;
+
     // Session properties
     const uint64_t epoch_;
     const uint32_t channelId_;
@@ -205,7 +224,7 @@ public:
                    uint32_t &injectedBytes) override;
 
 private:
-    void injectPacket(const uint8_t *buf, size_t size) override;
+    void injectPacket(uint8_t *buf, size_t size) override;
 
 private:
     const uint32_t channelId_;
@@ -245,7 +264,7 @@ public:
     void selectOutput(int idx) override;
 
 private:
-    void injectPacket(const uint8_t *buf, size_t size) override;
+    void injectPacket(uint8_t *buf, size_t size) override;
 
 private:
     int sockFd_;
@@ -256,6 +275,12 @@ private:
 /**
  * @class UsbTransmitter
  * @brief Sends packets via an attached USB Wi-Fi device.
+ *
+ * The radiotap and 802.11 headers are written into the headroom in front of each packet, then the whole buffer is
+ * handed to a submitter thread, which gives the device one frame at a time, in order. The Transmitter gets the buffer
+ * of the last frame sent back to build the next packet in, so nothing is copied and the TX thread encrypts and
+ * FEC-encodes the next packet while the previous transfer runs. If that transfer hasn't completed by the time the
+ * next frame is ready, injectPacket() blocks until it has.
  */
 class UsbTransmitter : public Transmitter {
 public:
@@ -269,7 +294,10 @@ public:
                    uint8_t frameType,
                    Rtl8812aDevice *device);
 
-    ~UsbTransmitter() override = default;
+    /**
+     * @brief Stops the submitter thread. A frame still waiting for it is dropped.
+     */
+    ~UsbTransmitter() override;
 
     void selectOutput(int idx) override;
 
@@ -280,17 +308,42 @@ public:
                    uint32_t &injectedBytes) override;
 
 private:
-    void injectPacket(const uint8_t *buf, size_t size) override;
+    void injectPacket(uint8_t *buf, size_t size) override;
+
+    /// A frame handed to the submitter
+    struct TxSlot {
+        std::unique_ptr<uint8_t[]> frame;
+        size_t size = 0;
+        size_t payloadSize = 0;
+        uint64_t queuedUs = 0;
+    };
+
+    /// Submitter thread: send handed over frames until the destructor.
+    void submitLoop();
 
 private:
-    const uint32_t channelId_;
-    int currentOutput_;
     uint16_t ieee80211Sequence_;
-    TxAntennaStat antennaStat_;
-    uint8_t *radiotapHeader_;
+    /// Radiotap header and 802.11 header with everything but the sequence number
+    std::unique_ptr<uint8_t[]> headers_;
     size_t radiotapHeaderLen_;
-    uint8_t frameType_;
     Rtl8812aDevice *rtlDevice_;
+
+    // Everything below is guarded by mutex_. There are two frame buffers: one the Transmitter builds the next packet
+    // in, the other handed over in slot_, in its transfer, or back in spare_ once that transfer is done.
+    std::mutex mutex_;
+    std::condition_variable frameQueued_;
+    std::condition_variable frameSent_;
+    TxSlot slot_;
+    std::unique_ptr<uint8_t[]> spare_;
+    bool stopping_ = false;
+
+    /// One device, so one output to keep stats for. Latency runs from the handover to the end of the transfer.
+    TxAntennaItem antennaStat_;
+    /// injectPacket() calls that had to wait for the previous transfer, and how long they waited
+    uint32_t stalls_ = 0;
+    uint64_t stallUs_ = 0;
+
+    std::thread submitter_;
 };
 
 #endif
@@ -6,13 +6,15 @@
     #include <fcntl.h>
     #include <linux/if_tun.h>
     #include <net/if.h>
-    #include <poll.h>
     #include <stdio.h>
     #include <stdlib.h>
     #include <string.h>
+    #include <sys/epoll.h>
+    #include <sys/eventfd.h>
     #include <sys/ioctl.h>
     #include <unistd.h>
 
+    #include <cinttypes>
     #include <cstring>
     #include <stdexcept>
 
@@ -135,135 +137,213 @@ int netlink_link_up(int netlink_fd, const char *iface_name) {
     return 0;
 }
 
-int Tun::run_proxy(int tun_fd, int send_fd, int recv_fd) const {
-    pollfd poll_fds[2];
-    poll_fds[0].fd = tun_fd;
-    poll_fds[0].events = POLLIN;
-    poll_fds[1].fd = recv_fd;
-    poll_fds[1].events = POLLIN;
+TunQueue::TunQueue() {
+    event_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (event_fd_ == -1) {
+        throw std::runtime_error(std::string("eventfd: ") + strerror(errno));
+    }
+}
 
-    char recv_buf[UINT16_MAX];
+TunQueue::~TunQueue() {
+    close(event_fd_);
+}
 
-    while (!should_stop) {
-        if (const int rc = poll(poll_fds, 2, 0) == -1; rc < 0) {
-            if (errno == EINTR || errno == EAGAIN) {
-                continue;
-            }
-            throw std::runtime_error("poll error");
-        }
+bool TunQueue::push(const uint8_t *data, size_t size) {
+    if (size > kSlotSize) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
 
-        // 1) Thread to capture [ TUN → local localport:8001 UDP ] → rtl8812
-        if ((poll_fds[0].revents & POLLIN) != 0) {
-            // Receive from TUN
-            ssize_t count = read(tun_fd, recv_buf, UINT16_MAX);
-            if (count < 0) {
-                return -1;
-            }
+    Slot *slot = acquire();
+    if (!slot) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    memcpy(slot->data, data, size);
+    slot->size = static_cast<uint16_t>(size);
+    commit();
+    notify();
 
-            // Prepend the packet size in network byte order
-            char size_bytes[2];
-            size_bytes[0] = (char)((count >> 8) & 0xFF); // High byte
-            size_bytes[1] = (char)(count & 0xFF);        // Low byte
+    return true;
+}
 
-            // Combine the size bytes and actual packet data
-            char new_buf[2 + count];
-            memcpy(new_buf, size_bytes, 2);
-            memcpy(new_buf + 2, recv_buf, count);
+void TunQueue::notify() {
+    // Same handshake as Doorbell: either the consumer sees the new packet, or we see it waiting.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiting_.exchange(false)) {
+        const uint64_t one = 1;
+        write(event_fd_, &one, sizeof(one));
+    }
+}
 
-            // Forward to UDP:8001 on localhost
-            send(send_fd, new_buf, 2 + count, 0);
+void TunQueue::clear_notification() const {
+    uint64_t count;
+    read(event_fd_, &count, sizeof(count));
+}
 
-            printf("TUN -> localhost:8001, data size %lu+2\n", count);
-        }
+bool TunQueue::prepare_wait() {
+    waiting_.store(true);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return ring_.front() == nullptr;
+}
 
-        // 2) Thread to capture rtl8812 → [ localport:8000 UDP → TUN ]
-        if ((poll_fds[1].revents & POLLIN) != 0) {
-            const ssize_t count = recv(recv_fd, recv_buf, UINT16_MAX, 0);
-            if (count < 0) {
-                return -1;
-            }
+namespace {
 
-            if (write(tun_fd, recv_buf + 2, count - 2) == -1) {
-                return -1;
+/// Packets moved per wakeup and direction, so the other direction gets its turn
+constexpr unsigned kBatchSize = 32;
+
+} // namespace
+
+int Tun::read_tun() {
+    unsigned count = 0;
+    while (count < kBatchSize) {
+        // Read straight into the queue, behind room for the length header. When it's full, the packet is dropped.
+        uint8_t scratch[TunQueue::kSlotSize];
+        TunQueue::Slot *slot = to_radio_.acquire();
+        uint8_t *buf = slot ? slot->data : scratch;
+
+        const ssize_t size = read(tun_fd, buf + 2, TunQueue::kSlotSize - 2);
+        if (size < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
             }
+            return -1;
+        }
 
-            printf("localhost:8001 -> TUN\n");
+        if (slot) {
+            buf[0] = static_cast<uint8_t>(size >> 8);
+            buf[1] = static_cast<uint8_t>(size & 0xff);
+            slot->size = static_cast<uint16_t>(2 + size);
+            to_radio_.commit();
+        } else {
+            to_radio_.drop();
         }
+        count++;
     }
 
-    close_fds();
+    if (count) {
+        to_radio_.notify();
+    }
 
     return 0;
 }
 
-int connect_localhost_udp(const uint16_t port) {
-    int fd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (fd == -1) {
-        return -1;
-    }
+int Tun::write_tun() {
+    for (unsigned count = 0; count < kBatchSize; count++) {
+        const TunQueue::Slot *slot = from_radio_.front();
+        if (!slot) {
+            break;
+        }
 
-    sockaddr_in addr = {};
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(port);
-    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+        // One or more packets, each behind its length header
+        size_t offset = 0;
+        while (offset + 2 <= slot->size) {
+            const size_t packet_size = slot->data[offset] << 8 | slot->data[offset + 1];
+            offset += 2;
+            if (packet_size == 0 || packet_size > slot->size - offset) {
+                // Malformed, drop the rest
+                break;
+            }
+            // A full TUN queue drops the packet like a full link would
+            if (write(tun_fd, slot->data + offset, packet_size) == -1 && errno != EAGAIN) {
+                from_radio_.pop();
+                return -1;
+            }
+            offset += packet_size;
+        }
 
-    if (int rc = connect(fd, (struct sockaddr *)&addr, sizeof addr); rc == -1) {
-        int connect_errno = errno;
-        close(fd);
-        errno = connect_errno;
-        return -1;
+        from_radio_.pop();
     }
 
-    return fd;
+    return 0;
 }
 
-int bind_localhost_udp(const uint16_t port) {
-    int fd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (fd == -1) {
+int Tun::run_proxy() {
+    const int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1) {
+        fprintf(stderr, "epoll_create1 failed: %s\n", strerror(errno));
         return -1;
     }
 
-    sockaddr_in addr = {};
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(port);
-    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    for (const int fd : {tun_fd, from_radio_.fd(), stop_fd}) {
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+            fprintf(stderr, "epoll_ctl failed: %s\n", strerror(errno));
+            close(epoll_fd);
+            return -1;
+        }
+    }
 
-    if (int rc = bind(fd, (struct sockaddr *)&addr, sizeof addr); rc == -1) {
-        int bind_errno = errno;
-        close(fd);
-        errno = bind_errno;
-        return -1;
+    int result = 0;
+
+    // Sleeps in epoll_wait() until there's traffic or stop()
+    for (bool running = true; running;) {
+        epoll_event events[3];
+        const int count = epoll_wait(epoll_fd, events, 3, from_radio_.prepare_wait() ? -1 : 0);
+        if (count == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "epoll_wait failed: %s\n", strerror(errno));
+            result = -1;
+            break;
+        }
+
+        for (int i = 0; i < count && running; i++) {
+            const int fd = events[i].data.fd;
+
+            if (fd == stop_fd) {
+                running = false;
+            } else if (fd == from_radio_.fd()) {
+                from_radio_.clear_notification();
+            } else if (fd == tun_fd) {
+                // 1) TUN → TX thread → rtl8812
+                if (read_tun() == -1) {
+                    fprintf(stderr, "TUN read failed: %s\n", strerror(errno));
+                    result = -1;
+                    running = false;
+                }
+            }
+        }
+
+        // 2) rtl8812 → RX worker → TUN
+        if (running && write_tun() == -1) {
+            fprintf(stderr, "TUN write failed: %s\n", strerror(errno));
+            result = -1;
+            running = false;
+        }
     }
 
-    return fd;
+    close(epoll_fd);
+
+    return result;
 }
 
 Tun::~Tun() {
     stop();
+    close_fds();
 }
 
-bool Tun::init(const char *address, uint8_t prefix_bits, uint16_t send_port, uint16_t recv_port) {
+bool Tun::init(const char *address, uint8_t prefix_bits) {
     char iface_name[IFNAMSIZ];
 
-    // Whatever received from the IP address will be forwarded to localhost:send_port
-    send_fd = connect_localhost_udp(send_port);
-    if (send_fd == -1) {
-        fprintf(stderr, "Failed to bind_localhost_udp(%u) failed!", send_port);
-        close_fds();
-        return false;
-    }
-
-    // Whatever sent to localhost:recv_port will be forwarded to the IP address
-    recv_fd = bind_localhost_udp(recv_port);
-    if (recv_fd == -1) {
-        fprintf(stderr, "connect_localhost_udp(%u) failed!", recv_port);
+    tun_fd = tun_connect(NULL, IFF_TUN | IFF_NO_PI, iface_name);
+    if (tun_fd == -1) {
+        fprintf(stderr, "tun_connect failed!");
         close_fds();
         return false;
     }
+    // Drained a batch at a time
+    fcntl(tun_fd, F_SETFL, fcntl(tun_fd, F_GETFL) | O_NONBLOCK);
 
-    tun_fd = tun_connect(NULL, IFF_TUN | IFF_NO_PI, iface_name);
-    if (tun_fd == -1) {
-        fprintf(stderr, "tun_connect failed!");
+    stop_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (stop_fd == -1) {
+        fprintf(stderr, "eventfd failed!");
         close_fds();
         return false;
     }
@@ -296,27 +376,42 @@ bool Tun::init(const char *address, uint8_t prefix_bits, uint16_t send_port, uin
 }
 
 bool Tun::start() {
-    tun_thread = std::make_unique<std::thread>([=, this] { run_proxy(tun_fd, send_fd, recv_fd); });
+    if (tun_fd == -1 || stop_fd == -1 || tun_thread) {
+        return false;
+    }
 
-    tun_thread->detach();
+    tun_thread = std::make_unique<std::thread>([this] { run_proxy(); });
 
     return true;
 }
 
 void Tun::stop() {
-    should_stop = true;
-}
-
-void Tun::close_fds() const {
-    if (send_fd != -1) {
-        close(send_fd);
+    if (!tun_thread) {
+        return;
     }
-    if (recv_fd != -1) {
-        close(recv_fd);
+
+    const uint64_t one = 1;
+    write(stop_fd, &one, sizeof(one));
+
+    tun_thread->join();
+    tun_thread.reset();
+
+    if (to_radio_.dropped() || from_radio_.dropped()) {
+        fprintf(stderr,
+                "TUN: %" PRIu64 " packets dropped towards the radio, %" PRIu64 " towards the TUN\n",
+                to_radio_.dropped(),
+                from_radio_.dropped());
     }
+}
+
+void Tun::close_fds() {
     if (tun_fd != -1) {
         close(tun_fd);
     }
+    if (stop_fd != -1) {
+        close(stop_fd);
+    }
+    tun_fd = stop_fd = -1;
 }
 
 #endif
@@ -1,10 +1,93 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include <memory>
 #include <thread>
 
+#include "../spsc_ring.h"
+#include "../wfb-ng/wifibroadcast.hpp"
+
+/// Packets between the TUN proxy and the radio side, one direction, single producer and single consumer.
+/// Packets are in the wfb-ng tunnel format: a 2-byte length header in network byte order, then the IP packet.
+/// The consumer sleeps in poll()/epoll_wait() on fd(), which the producer only signals when the consumer is about to.
+class TunQueue {
+public:
+    /// Room for a whole wfb-ng payload: downlink ones carry several aggregated packets, each behind its length header
+    static constexpr size_t kSlotSize = MAX_PAYLOAD_SIZE;
+
+    struct Slot {
+        uint16_t size;
+        uint8_t data[kSlotSize];
+    };
+
+    /// Throws std::runtime_error if the eventfd can't be created.
+    TunQueue();
+
+    ~TunQueue();
+
+    TunQueue(const TunQueue &) = delete;
+    TunQueue &operator=(const TunQueue &) = delete;
+
+    /// Producer: slot to fill in place, or nullptr if the queue is full.
+    Slot *acquire() {
+        return ring_.acquire();
+    }
+
+    /// Producer: publish the slot returned by acquire(). Call notify() after one or a batch of these.
+    void commit() {
+        ring_.commit();
+    }
+
+    /// Producer: acquire, copy, commit and notify. False if dropped.
+    bool push(const uint8_t *data, size_t size);
+
+    /// Producer: count a packet that didn't get a slot.
+    void drop() {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /// Producer: wake the consumer if it's waiting.
+    void notify();
+
+    /// Consumer: oldest packet, or nullptr.
+    Slot *front() {
+        return ring_.front();
+    }
+
+    /// Consumer: release the slot returned by front().
+    void pop() {
+        ring_.pop();
+    }
+
+    /// Consumer: readable when notified.
+    int fd() const {
+        return event_fd_;
+    }
+
+    /// Consumer: call when fd() was readable, before taking the packets.
+    void clear_notification() const;
+
+    /// Consumer: call right before waiting on fd(). False if there's something queued, then don't wait.
+    bool prepare_wait();
+
+    /// Packets dropped because the queue was full or, in push(), too big
+    uint64_t dropped() const {
+        return dropped_.load(std::memory_order_relaxed);
+    }
+
+private:
+    SpscRing<Slot, 256> ring_;
+    int event_fd_ = -1;
+    std::atomic<bool> waiting_{false};
+    std::atomic<uint64_t> dropped_{0};
+};
+
+/// Bridges a TUN interface and the radio link in-process. Packets read from the TUN go to to_radio() for TxFrame,
+/// packets the tunnel's aggregator puts into from_radio() are written to the TUN.
 class Tun {
 public:
+    /// Throws std::runtime_error if the queues can't be set up.
     Tun() = default;
 
     ~Tun();
@@ -12,28 +95,45 @@ public:
     ///
     /// @param address
     /// @param prefix_bits
-    /// @param send_port Port to send data
-    /// @param recv_port Port to listen to, receiving data
     /// @return
-    bool init(const char *address, uint8_t prefix_bits, uint16_t send_port, uint16_t recv_port);
+    bool init(const char *address, uint8_t prefix_bits);
 
+    /// Runs the proxy on its own thread. False if init() failed or it's already running.
     bool start();
 
+    /// Wakes the proxy thread, waits for it to exit and logs the packets either queue dropped.
     void stop();
 
+    /// TUN → radio, consumed by the TX thread
+    TunQueue &to_radio() {
+        return to_radio_;
+    }
+
+    /// Radio → TUN, produced by the RX worker of the tunnel's channel
+    TunQueue &from_radio() {
+        return from_radio_;
+    }
+
 private:
-    void close_fds() const;
+    void close_fds();
 
-    int run_proxy(int tun_fd, int send_fd, int recv_fd) const;
+    /// Forwards in both directions until stop_fd is signalled. Returns -1 on errors.
+    int run_proxy();
+
+    /// Moves up to a batch of packets from the TUN into to_radio_. Returns -1 on read errors.
+    int read_tun();
+
+    /// Writes everything queued in from_radio_ to the TUN. Returns -1 on write errors.
+    int write_tun();
 
-    bool should_stop = false;
     const char *address = nullptr;
     uint8_t prefix_bits = 0;
-    uint16_t send_port = 0;
-    uint16_t recv_port = 0;
     int tun_fd = -1;
-    int send_fd = -1;
-    int recv_fd = -1;
+    /// eventfd waking the proxy thread up for stop()
+    int stop_fd = -1;
+
+    TunQueue to_radio_;
+    TunQueue from_radio_;
 
     std::unique_ptr<std::thread> tun_thread;
 };
@@ -10,8 +10,11 @@
     #include <cinttypes>
     #include <cstring>
 
-TxFrame::TxFrame(const bool tun_enabled) {
+    #include "../alloc_counter.h"
+
+TxFrame::TxFrame(const bool tun_enabled, TunQueue *fromTun) {
     tun_enabled_ = tun_enabled;
+    fromTun_ = fromTun;
 }
 
 TxFrame::~TxFrame() = default;
@@ -78,21 +81,43 @@ int TxFrame::open_udp_socket_for_rx(int port, int buf_size) {
     return fd;
 }
 
-uint16_t inet_csum(const void *buf, size_t hdr_len) {
-    unsigned long sum = 0;
+namespace {
+
+/// Datagrams per recvmmsg() call
+constexpr size_t kBatchSize = 32;
+
+/// Room in front of every datagram for the 2-byte length prefix of the TUN framing and the IP and UDP headers,
+/// which TxFrame makes up itself when there's no TUN
+constexpr size_t kIpHeadroom = 2 + sizeof(iphdr) + sizeof(udphdr);
+
+/// One datagram of a batch
+struct RxSlot {
+    uint8_t buf[kIpHeadroom + MAX_PAYLOAD_SIZE + 1];
+    uint8_t cmsg[CMSG_SPACE(sizeof(uint32_t))];
+    iovec iov;
+};
 
-    const auto *ip1 = (const uint16_t *)buf;
-    while (hdr_len > 1) {
-        sum += *ip1++;
-        if (sum & 0x80000000) sum = (sum & 0xFFFF) + (sum >> 16);
-        hdr_len -= 2;
+/// One's complement sum of 16-bit words, not yet folded
+uint32_t inet_csum_partial(const void *buf, size_t len) {
+    uint32_t sum = 0;
+
+    const auto *word = static_cast<const uint16_t *>(buf);
+    while (len > 1) {
+        sum += *word++;
+        len -= 2;
     }
 
+    return sum;
+}
+
+uint16_t inet_csum_fold(uint32_t sum) {
     while (sum >> 16) sum = (sum & 0xFFFF) + (sum >> 16);
 
-    return ~sum;
+    return static_cast<uint16_t>(~sum);
 }
 
+} // namespace
+
 void TxFrame::dataSource(std::shared_ptr<Transmitter> &transmitter,
                          std::vector<int> &rxFds,
                          int fecTimeout,
@@ -118,6 +143,10 @@ void TxFrame::dataSource(std::shared_ptr<Transmitter> &transmitter,
         fds[i].fd = rxFds[i];
         fds[i].events = POLLIN;
     }
+    // The TUN queue's eventfd goes last, after the sockets
+    if (fromTun_) {
+        fds.push_back({.fd = fromTun_->fd(), .events = POLLIN, .revents = 0});
+    }
 
     uint64_t sessionKeyAnnounceTs = 0;
     uint32_t rxqOverflowCount = 0;
@@ -132,9 +161,41 @@ void TxFrame::dataSource(std::shared_ptr<Transmitter> &transmitter,
     uint32_t countBInjected = 0;
     uint32_t countPDropped = 0;
     uint32_t countPTruncated = 0;
+    uint64_t allocationCount = thread_allocation_count();
 
     int startFdIndex = 0;
 
+    // Receive buffers for a whole batch, each with headroom for the IP and UDP headers
+    const auto slots = std::make_unique<RxSlot[]>(kBatchSize);
+    mmsghdr msgs[kBatchSize] = {};
+    for (size_t m = 0; m < kBatchSize; ++m) {
+        slots[m].iov.iov_base = slots[m].buf + kIpHeadroom;
+        slots[m].iov.iov_len = MAX_PAYLOAD_SIZE + 1;
+        msgs[m].msg_hdr.msg_iov = &slots[m].iov;
+        msgs[m].msg_hdr.msg_iovlen = 1;
+        msgs[m].msg_hdr.msg_control = slots[m].cmsg;
+    }
+
+    // The made-up IP packets must still fit into a wfb-ng packet
+    const size_t maxDatagramSize = tun_enabled_ ? MAX_PAYLOAD_SIZE : MAX_PAYLOAD_SIZE - kIpHeadroom;
+
+    // Length prefix, IP and UDP headers of the made-up packets, with tot_len, id and the checksums left at 0
+    uint8_t ipTemplate[kIpHeadroom] = {};
+    {
+        auto *ip = reinterpret_cast<iphdr *>(ipTemplate + 2);
+        ip->saddr = inet_addr("10.5.0.1");
+        ip->daddr = inet_addr("10.5.0.10");
+        ip->ihl = 5;
+        ip->version = 4;
+        ip->ttl = 64;
+        ip->protocol = IPPROTO_UDP;
+
+        auto *udp = reinterpret_cast<udphdr *>(ip + 1);
+        udp->source = htons(54321); // Doesn't matter
+        udp->dest = htons(9999);
+    }
+    const uint32_t ipTemplateSum = inet_csum_partial(ipTemplate + 2, sizeof(iphdr));
+
     while (true) {
         if (shouldStop_) {
             printf("TxFrame: stopping main loop");
@@ -154,7 +215,12 @@ void TxFrame::dataSource(std::shared_ptr<Transmitter> &transmitter,
             }
         }
 
-        int rc = poll(fds.data(), nfds, pollTimeout);
+        // Don't sleep on packets the TUN proxy queued since the last round
+        if (fromTun_ && !fromTun_->prepare_wait()) {
+            pollTimeout = 0;
+        }
+
+        int rc = poll(fds.data(), fds.size(), pollTimeout);
         if (rc < 0) {
             if (errno == EINTR || errno == EAGAIN) {
                 continue;
@@ -185,6 +251,16 @@ void TxFrame::dataSource(std::shared_ptr<Transmitter> &transmitter,
             if (countPTruncated) {
                 std::fprintf(stderr, "%u packets truncated\n", countPTruncated);
             }
+            if (ALLOCATION_COUNTING) {
+                // Should stay 0 with the TUN on, the injection path doesn't allocate.
+                const uint64_t allocations = thread_allocation_count();
+                std::fprintf(stderr,
+                             "TX thread: %u packets in, %u injected, %" PRIu64 " heap allocations\n",
+                             countPIncoming,
+                             countPInjected,
+                             allocations - allocationCount);
+                allocationCount = allocations;
+            }
 
             // Reset counters
             countPFecTimeouts = 0;
@@ -197,7 +273,43 @@ void TxFrame::dataSource(std::shared_ptr<Transmitter> &transmitter,
             logSendTs = curTs + logInterval;
         }
 
-        if (rc == 0) {
+        // Packets from the TUN proxy, a batch per round so the sockets get their turn
+        bool tunData = false;
+        if (fromTun_) {
+            if (fds.back().revents & POLLIN) {
+                fromTun_->clear_notification();
+                --rc;
+            }
+
+            for (size_t n = 0; n < kBatchSize; ++n) {
+                const TunQueue::Slot *slot = fromTun_->front();
+                if (!slot) {
+                    break;
+                }
+                tunData = true;
+
+                ++countPIncoming;
+                countBIncoming += slot->size;
+
+                // Longer than the TUN's MTU allows for
+                if (slot->size > MAX_PAYLOAD_SIZE) {
+                    ++countPDropped;
+                    fromTun_->pop();
+                    continue;
+                }
+
+                uint64_t nowTs = get_time_ms();
+                if (nowTs >= sessionKeyAnnounceTs) {
+                    transmitter->sendSessionKey();
+                    sessionKeyAnnounceTs = nowTs + SESSION_KEY_ANNOUNCE_MSEC;
+                }
+
+                transmitter->sendPacket(slot->data, slot->size, 0);
+                fromTun_->pop();
+            }
+        }
+
+        if (rc == 0 && !tunData) {
             // Timed out
             if (fecTimeout > 0 && (curTs >= fecCloseTs)) {
                 // Send a FEC-only to close block if block is open
@@ -229,44 +341,17 @@ void TxFrame::dataSource(std::shared_ptr<Transmitter> &transmitter,
                         break;
                     }
 
-                    uint8_t buf[MAX_PAYLOAD_SIZE + 1] = {};
-
-                    uint8_t cmsgbuf[CMSG_SPACE(sizeof(uint32_t))] = {};
-
-                    iovec iov = {};
-                    iov.iov_base = buf;
-                    iov.iov_len = sizeof(buf);
-
-                    msghdr msg = {};
-                    msg.msg_iov = &iov;
-                    msg.msg_iovlen = 1;
-                    msg.msg_control = cmsgbuf;
-                    msg.msg_controllen = sizeof(cmsgbuf);
-
-                    ssize_t rsize = recvmsg(pfd.fd, &msg, 0);
-                    if (rsize < 0) {
-                        if (errno != EWOULDBLOCK && errno != EAGAIN && errno != ETIMEDOUT) {
-                            continue;
-                            throw std::runtime_error(string_format("Error receiving packet: %s", std::strerror(errno)));
-                        }
-                        break;
-                    }
-
-                    // Incoming stats
-                    ++countPIncoming;
-                    countBIncoming += static_cast<uint32_t>(rsize);
-
-                    if (rsize > static_cast<ssize_t>(MAX_PAYLOAD_SIZE)) {
-                        rsize = MAX_PAYLOAD_SIZE;
-                        ++countPTruncated;
+                    // The kernel overwrites these, the rest of the headers stays as set up
+                    for (size_t m = 0; m < kBatchSize; ++m) {
+                        msgs[m].msg_hdr.msg_controllen = sizeof(slots[m].cmsg);
+                        msgs[m].msg_hdr.msg_flags = 0;
                     }
 
-                    uint32_t curOverflow = extractRxqOverflow(&msg);
-                    if (curOverflow != rxqOverflowCount) {
-                        uint32_t diff = (curOverflow - rxqOverflowCount);
-                        countPDropped += diff;
-                        countPIncoming += diff; // All these overflows are potential incoming
-                        rxqOverflowCount = curOverflow;
+                    // Don't wait for more once the socket is drained, poll() also has the FEC timeout to watch
+                    const int count = recvmmsg(pfd.fd, msgs, kBatchSize, MSG_DONTWAIT, nullptr);
+                    if (count <= 0) {
+                        // Receive errors have never been fatal here, poll() reports a broken socket
+                        break;
                     }
 
                     // Possibly re-announce session key
@@ -276,56 +361,51 @@ void TxFrame::dataSource(std::shared_ptr<Transmitter> &transmitter,
                         sessionKeyAnnounceTs = nowTs + SESSION_KEY_ANNOUNCE_MSEC;
                     }
 
-                    // fixme: should move before size check
+                    for (int m = 0; m < count; ++m) {
+                        RxSlot &slot = slots[m];
+                        size_t rsize = msgs[m].msg_len;
 
-                    // Craft IP packets manually.
-                    if (!tun_enabled_) {
-                        int iphdr_len = sizeof(struct iphdr);
-                        int udphdr_len = sizeof(struct udphdr);
+                        // Incoming stats
+                        ++countPIncoming;
+                        countBIncoming += static_cast<uint32_t>(rsize);
 
-                        // Packet size
-                        size_t packet_size = 2 + iphdr_len + udphdr_len + rsize;
-
-                        // Packet
-                        auto packet = std::vector<unsigned char>(packet_size, 0);
+                        if (rsize > maxDatagramSize) {
+                            rsize = maxDatagramSize;
+                            ++countPTruncated;
+                        }
 
-                        uint16_t net_packet_size = htons(packet_size - 2);
-                        memcpy(packet.data(), &net_packet_size, 2);
+                        uint32_t curOverflow = extractRxqOverflow(&msgs[m].msg_hdr);
+                        if (curOverflow != rxqOverflowCount) {
+                            uint32_t diff = (curOverflow - rxqOverflowCount);
+                            countPDropped += diff;
+                            countPIncoming += diff; // All these overflows are potential incoming
+                            rxqOverflowCount = curOverflow;
+                        }
 
-                        static int packet_id = 0;
+                        if (tun_enabled_) {
+                            // Forward packet
+                            transmitter->sendPacket(slot.buf + kIpHeadroom, rsize, 0);
+                            continue;
+                        }
 
-                        // IP header
-                        struct iphdr *ip = (struct iphdr *)(packet.data() + 2);
-                        ip->saddr = inet_addr("10.5.0.1");
-                        ip->daddr = inet_addr("10.5.0.10");
-                        ip->ihl = 5;
-                        ip->version = 4;
-                        ip->tos = 0;
-                        ip->tot_len = htons(packet_size - 2);
-                        ip->id = htons(packet_id++);
-                        ip->frag_off = 0;
-                        ip->ttl = 64;
-                        ip->protocol = IPPROTO_UDP;
-                        ip->check = 0; // Will be calculated later
+                        // Craft IP packets manually, in the headroom right in front of the payload
+                        uint8_t *packet = slot.buf;
+                        std::memcpy(packet, ipTemplate, kIpHeadroom);
 
-                        // UDP header
-                        struct udphdr *udp = (struct udphdr *)(ip + 1);
-                        udp->source = htons(54321); // Doesn't matter
-                        udp->dest = htons(9999);
-                        udp->len = htons(udphdr_len + rsize);
-                        udp->check = 0;
+                        const uint16_t netPacketSize = htons(sizeof(iphdr) + sizeof(udphdr) + rsize);
+                        std::memcpy(packet, &netPacketSize, 2);
 
-                        ip->check = inet_csum((unsigned short *)ip, iphdr_len);
+                        auto *ip = reinterpret_cast<iphdr *>(packet + 2);
+                        ip->tot_len = netPacketSize;
+                        ip->id = htons(ipId_++);
+                        // Only tot_len and id differ from the template, so add them to its sum (RFC 1624)
+                        ip->check = inet_csum_fold(ipTemplateSum + ip->tot_len + ip->id);
 
-                        // Payload
-                        uint8_t *payload_buf = (uint8_t *)(udp + 1);
-                        memcpy(payload_buf, buf, rsize);
+                        auto *udp = reinterpret_cast<udphdr *>(ip + 1);
+                        udp->len = htons(sizeof(udphdr) + rsize);
 
                         // Forward packet
-                        transmitter->sendPacket(packet.data(), packet_size, 0);
-                    } else {
-                        // Forward packet
-                        transmitter->sendPacket(buf, static_cast<size_t>(rsize), 0);
+                        transmitter->sendPacket(packet, kIpHeadroom + rsize, 0);
                     }
 
                     // If we've hit a log boundary inside the same poll, break to flush stats
@@ -333,6 +413,10 @@ void TxFrame::dataSource(std::shared_ptr<Transmitter> &transmitter,
                         startFdIndex = i % nfds;
                         break;
                     }
+
+                    if (static_cast<size_t>(count) < kBatchSize) {
+                        break;
+                    }
                 }
             }
         }
@@ -8,6 +8,7 @@
     #include <vector>
 
     #include "transmitter.h"
+    #include "tun.h"
 
 class Rtl8812aDevice;
 
@@ -51,7 +52,11 @@ struct TxArgs {
  */
 class TxFrame {
 public:
-    explicit TxFrame(bool tun_enabled);
+    /**
+     * @param tun_enabled Whether UDP datagrams are already tunnel packets, or need made-up IP/UDP headers.
+     * @param fromTun Packets straight from the TUN proxy, if any. Must outlive run().
+     */
+    explicit TxFrame(bool tun_enabled, TunQueue *fromTun = nullptr);
 
     ~TxFrame();
 
@@ -93,6 +98,11 @@ private:
 
     bool tun_enabled_ = false;
 
+    TunQueue *fromTun_ = nullptr;
+
+    /// IP id of the packets made up when there's no TUN
+    uint16_t ipId_ = 0;
+
     /**
      * @brief Create a UDP socket for receiving data
      * @param port UDP port to bind to
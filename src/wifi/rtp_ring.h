@@ -0,0 +1,90 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "spsc_ring.h"
+
+/// URL prefix telling the player to read RTP from the in-process ring instead of a socket, e.g. "ring://H264".
+constexpr auto RTP_RING_URL_PREFIX = "ring://";
+
+/// Large enough for any RTP packet coming out of the wfb-ng aggregator.
+constexpr size_t RTP_RING_PACKET_SIZE = 4096;
+
+/// ~0.3 s of video at 30 Mbps with 1.4 KB packets.
+constexpr size_t RTP_RING_CAPACITY = 1024;
+
+struct RtpRingPacket {
+    uint16_t size;
+    /// Packets lost right before this one: given up on by the aggregator's FEC, or dropped by a full ring
+    uint16_t lost_before;
+    uint8_t data[RTP_RING_PACKET_SIZE];
+};
+
+/// Hands RTP packets from the aggregator to the decoder without going through a loopback socket.
+/// One producer (the wfb-ng RX path) and one consumer (the decoder thread).
+class RtpRing {
+public:
+    /// Producer: copy a packet into the ring. Drops it if the decoder is not keeping up.
+    /// `lost_before` is the number of packets the RX path lost right before this one.
+    bool push(const uint8_t *payload, uint16_t size, uint32_t lost_before = 0) {
+        RtpRingPacket *slot = ring_.acquire();
+        if (!slot || size > RTP_RING_PACKET_SIZE) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            // The next packet that makes it carries the loss on
+            pending_lost_ += lost_before + 1;
+            return false;
+        }
+
+        slot->size = size;
+        slot->lost_before = static_cast<uint16_t>(std::min<uint32_t>(lost_before + pending_lost_, UINT16_MAX));
+        pending_lost_ = 0;
+        memcpy(slot->data, payload, size);
+        ring_.commit();
+
+        doorbell_.ring();
+        return true;
+    }
+
+    /// Consumer: oldest packet, waiting up to `timeout` for one to arrive. Returns nullptr on timeout or wake().
+    const RtpRingPacket *wait_front(std::chrono::microseconds timeout) {
+        if (const RtpRingPacket *packet = ring_.front()) {
+            return packet;
+        }
+        doorbell_.wait_for([this] { return ring_.front() != nullptr; }, timeout);
+        return ring_.front();
+    }
+
+    /// Consumer: release the packet returned by wait_front().
+    void pop() {
+        ring_.pop();
+    }
+
+    /// Consumer: discard stale packets, e.g. left over from a previous playback.
+    void flush() {
+        ring_.clear();
+    }
+
+    /// Any thread: make a waiting consumer return early.
+    void wake() {
+        doorbell_.ring();
+    }
+
+    /// Packets dropped because the ring was full.
+    uint64_t dropped() const {
+        return dropped_.load(std::memory_order_relaxed);
+    }
+
+    size_t size() const {
+        return ring_.size();
+    }
+
+private:
+    SpscRing<RtpRingPacket, RTP_RING_CAPACITY> ring_;
+    Doorbell doorbell_;
+    std::atomic<uint64_t> dropped_{0};
+    /// Producer only: losses not yet passed on with a packet
+    uint32_t pending_lost_ = 0;
+};
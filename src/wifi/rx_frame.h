@@ -1,6 +1,9 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <cstdint>
+#include <optional>
 #include <span>
 #include <vector>
 
@@ -73,6 +76,17 @@ public:
                _data[21] == channel_id[3];
     }
 
+    /// (link_id << 8) + radio_port, if both addresses carry the same wfb-ng channel ID.
+    std::optional<uint32_t> GetChannelId() const {
+        if (_data[10] != 0x57 || _data[11] != 0x42 || _data[16] != 0x57 || _data[17] != 0x42) {
+            return std::nullopt;
+        }
+        if (!std::equal(_data.begin() + 12, _data.begin() + 16, _data.begin() + 18)) {
+            return std::nullopt;
+        }
+        return (uint32_t(_data[12]) << 24) | (uint32_t(_data[13]) << 16) | (uint32_t(_data[14]) << 8) | _data[15];
+    }
+
 private:
     std::span<uint8_t> _data;
 
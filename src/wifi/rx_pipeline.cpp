@@ -0,0 +1,150 @@
+#include "rx_pipeline.h"
+
+#include <algorithm>
+#include <cstring>
+
+/// How often an idle worker re-checks whether it should stop.
+constexpr std::chrono::milliseconds RX_WORKER_POLL_INTERVAL{100};
+
+RxPipeline::RxPipeline(size_t num_producers, size_t num_workers, Handler handler, TickHandler tick)
+    : num_producers_(std::max<size_t>(num_producers, 1)), handler_(std::move(handler)), tick_(std::move(tick)) {
+    for (size_t i = 0; i < std::max<size_t>(num_workers, 1); i++) {
+        auto worker = std::make_unique<Worker>();
+        for (size_t p = 0; p < num_producers_; p++) {
+            worker->rings.push_back(std::make_unique<Ring>());
+        }
+        workers_.push_back(std::move(worker));
+    }
+    // Start the threads only once the vector won't change anymore.
+    for (size_t i = 0; i < workers_.size(); i++) {
+        workers_[i]->thread = std::thread(&RxPipeline::run, this, std::ref(*workers_[i]), i);
+    }
+}
+
+RxPipeline::~RxPipeline() {
+    stop();
+}
+
+bool RxPipeline::push(const Packet &packet, size_t producer, size_t worker, const RxSource &source) {
+    Worker &w = *workers_[worker % workers_.size()];
+    Ring &ring = *w.rings[producer % num_producers_];
+
+    Item *item = ring.acquire();
+    if (!item || packet.Data.size() > RX_PIPELINE_FRAME_SIZE) {
+        w.dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    item->attrib = packet.RxAtrib;
+    item->enqueued = std::chrono::steady_clock::now();
+    item->source = source;
+    item->size = static_cast<uint16_t>(packet.Data.size());
+    memcpy(item->data, packet.Data.data(), packet.Data.size());
+    ring.commit();
+
+    w.doorbell.ring();
+    return true;
+}
+
+void RxPipeline::stop() {
+    if (stopping_.exchange(true)) {
+        return;
+    }
+
+    for (auto &worker : workers_) {
+        worker->doorbell.ring();
+    }
+    for (auto &worker : workers_) {
+        if (worker->thread.joinable()) {
+            worker->thread.join();
+        }
+    }
+}
+
+std::vector<RxPipeline::WorkerStats> RxPipeline::stats() const {
+    std::vector<WorkerStats> result;
+
+    for (const auto &worker : workers_) {
+        const uint64_t processed = worker->processed.load(std::memory_order_relaxed);
+        const uint64_t divisor = std::max<uint64_t>(processed, 1);
+
+        size_t queue_depth = 0;
+        for (const auto &ring : worker->rings) {
+            queue_depth += ring->size();
+        }
+
+        result.push_back({
+            .queue_depth = queue_depth,
+            .processed = processed,
+            .dropped = worker->dropped.load(std::memory_order_relaxed),
+            .avg_queue_latency =
+                std::chrono::nanoseconds(worker->queue_latency_ns.load(std::memory_order_relaxed) / divisor),
+            .max_queue_latency = std::chrono::nanoseconds(worker->max_queue_latency_ns.load(std::memory_order_relaxed)),
+            .avg_process_time =
+                std::chrono::nanoseconds(worker->process_time_ns.load(std::memory_order_relaxed) / divisor),
+        });
+    }
+
+    return result;
+}
+
+RxPipeline::Ring *RxPipeline::oldest_ring(Worker &worker) {
+    // Taking the oldest frame first keeps the adapters' copies of a burst roughly in air order.
+    Ring *oldest = nullptr;
+    std::chrono::steady_clock::time_point oldest_enqueued;
+
+    for (auto &ring : worker.rings) {
+        const Item *item = ring->front();
+        if (item && (!oldest || item->enqueued < oldest_enqueued)) {
+            oldest = ring.get();
+            oldest_enqueued = item->enqueued;
+        }
+    }
+    return oldest;
+}
+
+void RxPipeline::run(Worker &worker, size_t index) {
+    const auto wait_interval = tick_ ? RX_PIPELINE_TICK_INTERVAL : RX_WORKER_POLL_INTERVAL;
+
+    auto now = std::chrono::steady_clock::now();
+    auto next_tick = now + RX_PIPELINE_TICK_INTERVAL;
+
+    while (!stopping_.load(std::memory_order_relaxed)) {
+        if (tick_ && now >= next_tick) {
+            tick_(index);
+            next_tick = now + RX_PIPELINE_TICK_INTERVAL;
+        }
+
+        Ring *ring = oldest_ring(worker);
+        if (!ring) {
+            worker.doorbell.wait_for(
+                [&] { return oldest_ring(worker) != nullptr || stopping_.load(std::memory_order_relaxed); },
+                wait_interval);
+            now = std::chrono::steady_clock::now();
+            continue;
+        }
+
+        Item *item = ring->front();
+
+        const auto dequeued = std::chrono::steady_clock::now();
+        const uint64_t queue_latency =
+            std::chrono::duration_cast<std::chrono::nanoseconds>(dequeued - item->enqueued).count();
+
+        handler_(Packet{item->attrib, std::span<uint8_t>(item->data, item->size)}, item->source);
+
+        now = std::chrono::steady_clock::now();
+        ring->pop();
+
+        // Only this thread writes these, plain load + store is enough.
+        worker.queue_latency_ns.store(worker.queue_latency_ns.load(std::memory_order_relaxed) + queue_latency,
+                                      std::memory_order_relaxed);
+        if (queue_latency > worker.max_queue_latency_ns.load(std::memory_order_relaxed)) {
+            worker.max_queue_latency_ns.store(queue_latency, std::memory_order_relaxed);
+        }
+        worker.process_time_ns.store(
+            worker.process_time_ns.load(std::memory_order_relaxed) +
+                std::chrono::duration_cast<std::chrono::nanoseconds>(now - dequeued).count(),
+            std::memory_order_relaxed);
+        worker.processed.store(worker.processed.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+}
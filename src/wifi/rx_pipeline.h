@@ -0,0 +1,118 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "Rtl8812aDevice.h"
+#include "spsc_ring.h"
+
+/// Largest 802.11 frame the RX pipeline queues. Bigger ones are dropped.
+constexpr size_t RX_PIPELINE_FRAME_SIZE = 4608;
+
+/// Frames queued per worker and producer, ~80 ms at 40 MHz high-MCS rates.
+constexpr size_t RX_PIPELINE_QUEUE_SIZE = 1024;
+
+/// Resolution of the workers' timer, e.g. for FEC block deadlines.
+constexpr std::chrono::milliseconds RX_PIPELINE_TICK_INTERVAL{10};
+
+/// Where a queued frame came from
+struct RxSource {
+    /// Adapter index within the session: the local adapters first, then remote RX nodes' adapters
+    uint8_t adapter = 0;
+    /// IPv4 address (network byte order) of the RX node that forwarded the frame, 0 for a local adapter
+    uint32_t remote_addr = 0;
+    /// Radio settings the RX node reported, 0 for the session's
+    uint16_t freq = 0;
+    uint8_t bandwidth = 0;
+};
+
+/// Moves received frames off the USB threads, so a slow decrypt/FEC/send never delays servicing bulk-in transfers.
+/// A USB thread (producer) only copies each frame into the ring of the worker that owns its channel. Every worker has
+/// one ring per producer, so several adapters can feed the same channel without locking.
+/// The workers run the handler, i.e. everything from parsing the frame on.
+class RxPipeline {
+public:
+    using Handler = std::function<void(const Packet &packet, const RxSource &source)>;
+
+    /// Called on each worker every RX_PIPELINE_TICK_INTERVAL, busy or not.
+    using TickHandler = std::function<void(size_t worker)>;
+
+    struct WorkerStats {
+        /// Frames waiting in the queue right now
+        size_t queue_depth;
+        uint64_t processed;
+        /// Frames dropped because the queue was full or the frame too big
+        uint64_t dropped;
+        /// From being queued by the USB thread to being picked up by the worker
+        std::chrono::nanoseconds avg_queue_latency;
+        std::chrono::nanoseconds max_queue_latency;
+        /// Time the handler took per frame
+        std::chrono::nanoseconds avg_process_time;
+    };
+
+    /// Starts `num_workers` worker threads calling `handler`, and `tick` if given. Frames come from `num_producers`
+    /// threads, each pushing with its own index.
+    RxPipeline(size_t num_producers, size_t num_workers, Handler handler, TickHandler tick = nullptr);
+
+    ~RxPipeline();
+
+    RxPipeline(const RxPipeline &) = delete;
+    RxPipeline &operator=(const RxPipeline &) = delete;
+
+    /// Producer `producer`: queue a frame for a worker. Returns false if it had to be dropped.
+    bool push(const Packet &packet, size_t producer, size_t worker, const RxSource &source);
+
+    /// Stop and join the workers. Frames still queued are discarded.
+    void stop();
+
+    size_t num_workers() const {
+        return workers_.size();
+    }
+
+    size_t num_producers() const {
+        return num_producers_;
+    }
+
+    /// Any thread: counters since the pipeline was created.
+    std::vector<WorkerStats> stats() const;
+
+private:
+    struct Item {
+        decltype(Packet::RxAtrib) attrib;
+        std::chrono::steady_clock::time_point enqueued;
+        RxSource source;
+        uint16_t size;
+        uint8_t data[RX_PIPELINE_FRAME_SIZE];
+    };
+
+    using Ring = SpscRing<Item, RX_PIPELINE_QUEUE_SIZE>;
+
+    struct Worker {
+        /// One per producer
+        std::vector<std::unique_ptr<Ring>> rings;
+        Doorbell doorbell;
+        std::thread thread;
+
+        // Written by the worker, except for `dropped` which the producers count
+        std::atomic<uint64_t> processed{0};
+        std::atomic<uint64_t> dropped{0};
+        std::atomic<uint64_t> queue_latency_ns{0};
+        std::atomic<uint64_t> max_queue_latency_ns{0};
+        std::atomic<uint64_t> process_time_ns{0};
+    };
+
+    void run(Worker &worker, size_t index);
+
+    /// The ring whose front frame was queued first, nullptr if all are empty. Consumer only.
+    static Ring *oldest_ring(Worker &worker);
+
+    size_t num_producers_;
+    Handler handler_;
+    TickHandler tick_;
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::atomic<bool> stopping_{false};
+};
@@ -1,89 +1,52 @@
 #include <chrono>
-#include <random>
 
+#include "antenna_stats.h"
 #include "signal_quality.h"
 
-namespace {
-
-std::string generate_random_string(size_t length) {
-    const std::string characters = "abcdefghijklmnopqrstuvwxyz";
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_int_distribution<> distrib(0, characters.size() - 1);
-
-    std::string result;
-    result.reserve(length);
-    for (size_t i = 0; i < length; ++i) {
-        result += characters[distrib(gen)];
-    }
-    return result;
-}
-
-} // namespace
-
-// Remove RSSI samples older than 1 second
-void SignalQualityCalculator::cleanup_old_rssi_data() {
-    auto now = std::chrono::steady_clock::now();
-    auto cutoff = now - kAveragingWindow;
-
-    // Erase-remove idiom for data older than cutoff
-    m_rssis.erase(std::remove_if(m_rssis.begin(),
-                                 m_rssis.end(),
-                                 [&](const RssiEntry &entry) { return entry.timestamp < cutoff; }),
-                  m_rssis.end());
-}
-
-void SignalQualityCalculator::cleanup_old_snr_data() {
-    auto now = std::chrono::steady_clock::now();
-    auto cutoff = now - kAveragingWindow;
-
-    // Erase-remove idiom for data older than cutoff
-    m_snrs.erase(
-        std::remove_if(m_snrs.begin(), m_snrs.end(), [&](const SnrEntry &entry) { return entry.timestamp < cutoff; }),
-        m_snrs.end());
+uint64_t SignalQualityCalculator::now_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
 }
 
-void SignalQualityCalculator::cleanup_old_fec_data() {
-    auto now = std::chrono::steady_clock::now();
-    auto cutoff = now - kAveragingWindow;
-
-    m_fec_data.erase(std::remove_if(m_fec_data.begin(),
-                                    m_fec_data.end(),
-                                    [&](const FecEntry &entry) { return entry.timestamp < cutoff; }),
-                     m_fec_data.end());
+float SignalQualityCalculator::get_estimate(const Ewma (&ewma)[2], uint64_t now) {
+    float estimate = 0.f;
+    for (const auto &antenna : ewma) {
+        if (antenna.primed && now - antenna.last_ms <= static_cast<uint64_t>(kAveragingWindow.count())) {
+            estimate = std::max(estimate, antenna.value);
+        }
+    }
+    return estimate;
 }
 
 void SignalQualityCalculator::add_rssi(uint8_t ant1, uint8_t ant2) {
-    std::lock_guard lock(m_mutex);
-
-    RssiEntry entry;
-    entry.timestamp = std::chrono::steady_clock::now();
-    entry.ant1 = ant1;
-    entry.ant2 = ant2;
-    m_rssis.push_back(entry);
+    const uint64_t now = now_ms();
+    m_rssi_ewma[0].add(ant1, now, kEwmaTauMs);
+    m_rssi_ewma[1].add(ant2, now, kEwmaTauMs);
 }
 
 void SignalQualityCalculator::add_snr(int8_t ant1, int8_t ant2) {
-    std::lock_guard lock(m_mutex);
-
-    SnrEntry entry;
-    entry.timestamp = std::chrono::steady_clock::now();
-    entry.ant1 = ant1;
-    entry.ant2 = ant2;
-    m_snrs.push_back(entry);
+    const uint64_t now = now_ms();
+    m_snr_ewma[0].add(ant1, now, kEwmaTauMs);
+    m_snr_ewma[1].add(ant2, now, kEwmaTauMs);
 }
 
 SignalQualityCalculator::SignalQuality SignalQualityCalculator::calculate_signal_quality() {
     SignalQuality ret;
-    std::lock_guard lock(m_mutex);
-
-    // Make sure we clean up old data first
-    cleanup_old_rssi_data();
-    cleanup_old_snr_data();
-    cleanup_old_fec_data();
 
-    float avg_rssi = get_avg(m_rssis);
-    float avg_snr = get_avg(m_snrs);
+    const uint64_t now = now_ms();
+    float avg_rssi = get_estimate(m_rssi_ewma, now);
+    float avg_snr = get_estimate(m_snr_ewma, now);
+
+    // The per-antenna stats see every adapter's antennas, not just the two paths of whichever adapter delivered last
+    if (m_antenna_stats) {
+        const auto antennas = m_antenna_stats->snapshot(now);
+        if (antennas.best >= 0) {
+            const auto &best = antennas.antennas[antennas.best];
+            // Back to the percentage add_rssi() takes, see rssi_percent_to_dbm()
+            avg_rssi = best.rssi_recent + 100.f;
+            avg_snr = best.snr_recent;
+        }
+    }
 
     // Map the RSSI from range 10..80 to -1024..1024
     avg_rssi = map_range(avg_rssi, 0.f, 80.f, -1024.f, 1024.f);
@@ -92,47 +55,53 @@ SignalQualityCalculator::SignalQuality SignalQualityCalculator::calculate_signal
     // Return final clamped quality
     // formula: quality = avg_rssi - p_recovered * 5 - p_lost * 100
     // clamp between -1024 and 1024
-    auto [p_recovered, p_lost, p_total] = get_accumulated_fec_data();
+    const auto fec = get_fec_totals(kAveragingWindow);
 
     float quality = avg_rssi; // - static_cast<float>(p_recovered) * 12.f - static_cast<float>(p_lost) * 40.f;
     quality = std::max(-1024.f, std::min(1024.f, quality));
 
-    ret.lost_last_second = p_lost;
-    ret.recovered_last_second = p_recovered;
-    ret.total_last_second = p_total;
+    ret.lost_last_second = static_cast<int>(fec.lost);
+    ret.recovered_last_second = static_cast<int>(fec.recovered);
+    ret.total_last_second = static_cast<int>(fec.all);
 
     ret.quality = quality;
     ret.snr = avg_snr;
-    ret.idr_code = m_idr_code;
 
     return ret;
 }
 
-std::tuple<uint32_t, uint32_t, uint32_t> SignalQualityCalculator::get_accumulated_fec_data() const {
-    uint32_t p_recovered = 0;
-    uint32_t p_all = 0;
-    uint32_t p_lost = 0;
-    for (const auto &data : m_fec_data) {
-        p_all += data.all;
-        p_recovered += data.recovered;
-        p_lost += data.lost;
+void SignalQualityCalculator::add_fec_data(uint32_t p_all, uint32_t p_recovered, uint32_t p_lost) {
+    m_fec_data.add(now_ms(), {p_all, p_recovered, p_lost});
+}
+
+bool SignalQualityCalculator::update_snapshot(std::chrono::milliseconds min_interval) {
+    const uint64_t now = now_ms();
+    if (now - m_snapshot_ms < static_cast<uint64_t>(min_interval.count())) {
+        return false;
     }
+    m_snapshot_ms = now;
+
+    auto quality = calculate_signal_quality();
+
+    std::lock_guard lock(m_snapshot_mutex);
+    m_snapshot = std::move(quality);
 
-    return {p_recovered, p_lost, p_all};
+    return true;
 }
 
-void SignalQualityCalculator::add_fec_data(uint32_t p_all, uint32_t p_recovered, uint32_t p_lost) {
-    std::lock_guard lock(m_mutex);
+SignalQualityCalculator::SignalQuality SignalQualityCalculator::get_snapshot() const {
+    std::lock_guard lock(m_snapshot_mutex);
+    return m_snapshot;
+}
 
-    FecEntry entry;
-    entry.timestamp = std::chrono::steady_clock::now();
-    entry.all = p_all;
-    entry.recovered = p_recovered;
-    entry.lost = p_lost;
+SignalQualityCalculator::FecTotals SignalQualityCalculator::get_fec_totals(std::chrono::milliseconds window) const {
+    // all, recovered, lost
+    const auto sums = m_fec_data.sum(now_ms(), window.count());
 
-    if (p_lost > 0) {
-        m_idr_code = generate_random_string(4);
-    }
+    FecTotals totals;
+    totals.all = sums.sums[0];
+    totals.recovered = sums.sums[1];
+    totals.lost = sums.sums[2];
 
-    m_fec_data.push_back(entry);
+    return totals;
 }
@@ -4,27 +4,64 @@
 #include <chrono>
 #include <cstdint>
 #include <mutex>
-#include <utility>
-#include <vector>
+#include <string>
+
+#include "time_buckets.h"
+
+class AntennaStats;
 
 inline double map_range(double value, double inputMin, double inputMax, double outputMin, double outputMax) {
     return outputMin + ((value - inputMin) * (outputMax - outputMin) / (inputMax - inputMin));
 }
 
+/// Exponentially weighted moving average of samples arriving at irregular times.
+/// A sample's weight grows with the time since the previous one, so the time constant doesn't depend on the packet
+/// rate.
+struct Ewma {
+    float value = 0.f;
+    uint64_t last_ms = 0;
+    bool primed = false;
+
+    void add(float sample, uint64_t now_ms, float tau_ms) {
+        if (!primed) {
+            value = sample;
+            primed = true;
+        } else {
+            const float dt = static_cast<float>(now_ms - last_ms);
+            value += (sample - value) * dt / (tau_ms + dt);
+        }
+        last_ms = now_ms;
+    }
+};
+
 class SignalQualityCalculator {
 public:
     struct SignalQuality {
-        int lost_last_second;
-        int recovered_last_second;
-        int total_last_second;
-        int quality;
-        float snr;
-        std::string idr_code;
+        int lost_last_second = 0;
+        int recovered_last_second = 0;
+        int total_last_second = 0;
+        int quality = -1024;
+        float snr = 0.f;
+    };
+
+    /// FEC counters summed over a window
+    struct FecTotals {
+        uint64_t all = 0;
+        uint64_t recovered = 0;
+        uint64_t lost = 0;
     };
 
     SignalQualityCalculator() = default;
     ~SignalQualityCalculator() = default;
 
+    // The add_* calls come from the thread handling the video channel only, see TimeBuckets.
+
+    /// Score the link from the best antenna of any adapter in `stats` rather than from the two RF paths add_rssi() and
+    /// add_snr() are given, while it has an active one. nullptr for the RF paths only. Not while the link runs.
+    void set_antenna_stats(const AntennaStats *stats) {
+        m_antenna_stats = stats;
+    }
+
     /// Add a new RSSI entry with current timestamp
     void add_rssi(uint8_t ant1, uint8_t ant2);
 
@@ -33,34 +70,19 @@ public:
     /// Add new FEC data entry with current timestamp
     void add_fec_data(uint32_t p_all, uint32_t p_recovered, uint32_t p_lost);
 
-    /// Get fresh averages over the last second
-    template <class T>
-    float get_avg(const T &array) {
-        std::lock_guard lock(m_mutex);
-
-        // Remove old entries
-        cleanup_old_rssi_data();
-
-        float sum1 = 0.f;
-        float sum2 = 0.f;
-        int count = static_cast<int>(array.size());
-
-        if (count > 0) {
-            for (auto &entry : array) {
-                sum1 += entry.ant1;
-                sum2 += entry.ant2;
-            }
-            sum1 /= count;
-            sum2 /= count;
-        }
+    /// Calculate signal quality based on the best antenna's RSSI/SNR estimates and last-second FEC data.
+    /// Only from the thread adding the samples, others use get_snapshot().
+    SignalQuality calculate_signal_quality();
 
-        // We'll take the maximum of the two average RSSI values
-        float avg = std::max(sum1, sum2);
-        return avg;
-    }
+    /// Recalculate the shared snapshot if `min_interval` has passed since the last time.
+    /// Called regularly from the thread adding the samples. Returns true if the snapshot was refreshed.
+    bool update_snapshot(std::chrono::milliseconds min_interval = kSnapshotInterval);
 
-    /// Calculate signal quality based on last-second RSSI and FEC data
-    SignalQuality calculate_signal_quality();
+    /// Latest signal quality, at most kSnapshotInterval old while the link is running. Any thread.
+    SignalQuality get_snapshot() const;
+
+    /// FEC counters over the last `window`, up to 30 s. Any thread.
+    FecTotals get_fec_totals(std::chrono::milliseconds window) const;
 
     static SignalQualityCalculator &get_instance() {
         static SignalQualityCalculator instance;
@@ -68,45 +90,26 @@ public:
     }
 
 private:
-    /// Sum up FEC data over the last 1 second
-    std::tuple<uint32_t, uint32_t, uint32_t> get_accumulated_fec_data() const;
-
-    // Helper methods to remove old entries
-    void cleanup_old_rssi_data();
-    void cleanup_old_snr_data();
-    void cleanup_old_fec_data();
-
-    // We store a timestamp for each RSSI entry
-    struct RssiEntry {
-        std::chrono::steady_clock::time_point timestamp;
-        uint8_t ant1;
-        uint8_t ant2;
-    };
+    static constexpr std::chrono::milliseconds kAveragingWindow{std::chrono::seconds(1)};
+    static constexpr std::chrono::milliseconds kSnapshotInterval{100};
+    /// Time constant of the RSSI/SNR estimates
+    static constexpr float kEwmaTauMs = 500.f;
 
-    // We store a timestamp for each RSSI entry
-    struct SnrEntry {
-        std::chrono::steady_clock::time_point timestamp;
-        int8_t ant1;
-        int8_t ant2;
-    };
+    static uint64_t now_ms();
 
-    // We store a timestamp for each FEC entry
-    struct FecEntry {
-        std::chrono::steady_clock::time_point timestamp;
-        uint32_t all;
-        uint32_t recovered;
-        uint32_t lost;
-    };
-
-private:
-    const std::chrono::seconds kAveragingWindow{std::chrono::seconds(1)};
-    mutable std::recursive_mutex m_mutex;
+    /// Max of the two per-path estimates. No samples for kAveragingWindow counts as no signal.
+    static float get_estimate(const Ewma (&ewma)[2], uint64_t now);
 
-    std::vector<RssiEntry> m_rssis;
+    // all, recovered, lost
+    WindowedSums<3> m_fec_data;
 
-    std::vector<SnrEntry> m_snrs;
+    // Per-path estimates, writer thread only
+    Ewma m_rssi_ewma[2];
+    Ewma m_snr_ewma[2];
 
-    std::vector<FecEntry> m_fec_data;
+    const AntennaStats *m_antenna_stats = nullptr;
 
-    std::string m_idr_code{"aaaa"};
+    uint64_t m_snapshot_ms = 0;
+    mutable std::mutex m_snapshot_mutex;
+    SignalQuality m_snapshot;
 };
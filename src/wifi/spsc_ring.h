@@ -0,0 +1,114 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <semaphore>
+
+/// Lock-free single-producer/single-consumer ring of fixed-size slots.
+/// The producer fills a slot in place (acquire + commit) and the consumer reads it in place (front + pop),
+/// so nothing is copied besides what the caller writes into the slot.
+template <typename T, size_t Capacity>
+class SpscRing {
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    SpscRing() : slots_(std::make_unique<T[]>(Capacity)) {}
+
+    SpscRing(const SpscRing &) = delete;
+    SpscRing &operator=(const SpscRing &) = delete;
+
+    /// Producer: slot to fill, or nullptr if the ring is full.
+    T *acquire() {
+        const uint32_t head = head_.load(std::memory_order_relaxed);
+        if (head - tail_cache_ == Capacity) {
+            tail_cache_ = tail_.load(std::memory_order_acquire);
+            if (head - tail_cache_ == Capacity) {
+                return nullptr;
+            }
+        }
+        return &slots_[head & (Capacity - 1)];
+    }
+
+    /// Producer: publish the slot returned by acquire().
+    void commit() {
+        head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    /// Consumer: oldest slot, or nullptr if the ring is empty.
+    T *front() {
+        const uint32_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail == head_cache_) {
+            head_cache_ = head_.load(std::memory_order_acquire);
+            if (tail == head_cache_) {
+                return nullptr;
+            }
+        }
+        return &slots_[tail & (Capacity - 1)];
+    }
+
+    /// Consumer: release the slot returned by front().
+    void pop() {
+        tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    /// Consumer: drop everything queued so far.
+    void clear() {
+        head_cache_ = head_.load(std::memory_order_acquire);
+        tail_.store(head_cache_, std::memory_order_release);
+    }
+
+    /// Number of queued slots. Exact only when called from the producer or the consumer.
+    size_t size() const {
+        return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+    }
+
+    static constexpr size_t capacity() {
+        return Capacity;
+    }
+
+private:
+    std::unique_ptr<T[]> slots_;
+
+    // Keep the indices on separate cache lines so the two sides don't false-share.
+    alignas(64) std::atomic<uint32_t> head_{0};
+    uint32_t tail_cache_ = 0; // Producer's view of tail_
+    alignas(64) std::atomic<uint32_t> tail_{0};
+    uint32_t head_cache_ = 0; // Consumer's view of head_
+};
+
+/// Wakes a sleeping consumer. Ringing costs a fence and an atomic exchange unless the consumer is actually asleep.
+class Doorbell {
+public:
+    /// Producer: call after publishing new data.
+    void ring() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleeping_.exchange(false)) {
+            bell_.release();
+        }
+    }
+
+    /// Consumer: sleep until ring() or the timeout. `ready` is re-checked after announcing the sleep,
+    /// so a ring() that races with going to sleep is never lost.
+    template <typename Ready>
+    void wait_for(const Ready &ready, std::chrono::microseconds timeout) {
+        bool woken = false;
+
+        sleeping_.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!ready()) {
+            woken = bell_.try_acquire_for(timeout);
+        }
+
+        // If ring() claimed this sleep, take its release here so it can't leak into the next wait.
+        if (!sleeping_.exchange(false) && !woken) {
+            bell_.acquire();
+        }
+    }
+
+private:
+    std::atomic<bool> sleeping_{false};
+    std::counting_semaphore<> bell_{0};
+};
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+/// Running sums of samples over a ring of fixed-length time buckets.
+/// Adding a sample is O(1) and lock-free; summing a window is O(buckets in the window).
+/// One writer thread, any number of readers. Readers skip a bucket that gets recycled while they read it.
+template <size_t Fields>
+class TimeBuckets {
+public:
+    struct Totals {
+        /// Number of samples
+        uint64_t count = 0;
+        std::array<int64_t, Fields> sums{};
+    };
+
+    TimeBuckets(uint32_t bucket_ms, size_t num_buckets)
+        : bucket_ms_(bucket_ms), num_buckets_(num_buckets), buckets_(std::make_unique<Bucket[]>(num_buckets)) {}
+
+    TimeBuckets(const TimeBuckets &) = delete;
+    TimeBuckets &operator=(const TimeBuckets &) = delete;
+
+    /// Writer: account one sample at `now_ms`.
+    void add(uint64_t now_ms, const std::array<int64_t, Fields> &values) {
+        const uint64_t index = now_ms / bucket_ms_;
+        Bucket &bucket = buckets_[index % num_buckets_];
+
+        if (bucket.index.load(std::memory_order_relaxed) != index) {
+            // Recycle the bucket. Readers see the index change and drop what they read meanwhile.
+            bucket.index.store(INVALID_INDEX, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            bucket.count.store(0, std::memory_order_relaxed);
+            for (auto &sum : bucket.sums) {
+                sum.store(0, std::memory_order_relaxed);
+            }
+            bucket.index.store(index, std::memory_order_release);
+        }
+
+        // Single writer, so no read-modify-write is needed.
+        for (size_t i = 0; i < Fields; i++) {
+            bucket.sums[i].store(bucket.sums[i].load(std::memory_order_relaxed) + values[i],
+                                 std::memory_order_relaxed);
+        }
+        bucket.count.store(bucket.count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    /// Reader: totals of the buckets covering the last `window_ms` up to `now_ms`, the current (partial) bucket
+    /// included. Windows longer than span_ms() are cut to it.
+    Totals sum(uint64_t now_ms, uint64_t window_ms) const {
+        Totals totals;
+
+        const uint64_t newest = now_ms / bucket_ms_;
+        uint64_t count = (window_ms + bucket_ms_ - 1) / bucket_ms_;
+        if (count > num_buckets_) {
+            count = num_buckets_;
+        }
+        if (count > newest + 1) {
+            count = newest + 1;
+        }
+
+        for (uint64_t index = newest + 1 - count; index <= newest; index++) {
+            const Bucket &bucket = buckets_[index % num_buckets_];
+
+            if (bucket.index.load(std::memory_order_acquire) != index) {
+                continue;
+            }
+
+            Totals bucket_totals;
+            bucket_totals.count = bucket.count.load(std::memory_order_relaxed);
+            for (size_t i = 0; i < Fields; i++) {
+                bucket_totals.sums[i] = bucket.sums[i].load(std::memory_order_relaxed);
+            }
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (bucket.index.load(std::memory_order_relaxed) != index) {
+                continue;
+            }
+
+            totals.count += bucket_totals.count;
+            for (size_t i = 0; i < Fields; i++) {
+                totals.sums[i] += bucket_totals.sums[i];
+            }
+        }
+
+        return totals;
+    }
+
+    /// Longest window sum() can answer.
+    uint64_t span_ms() const {
+        return static_cast<uint64_t>(bucket_ms_) * num_buckets_;
+    }
+
+private:
+    static constexpr uint64_t INVALID_INDEX = UINT64_MAX;
+
+    struct Bucket {
+        /// Absolute bucket number (time / bucket_ms) the sums belong to
+        std::atomic<uint64_t> index{INVALID_INDEX};
+        std::atomic<uint64_t> count{0};
+        std::array<std::atomic<int64_t>, Fields> sums{};
+    };
+
+    const uint32_t bucket_ms_;
+    const size_t num_buckets_;
+    std::unique_ptr<Bucket[]> buckets_;
+};
+
+/// TimeBuckets at two resolutions: 10 ms buckets for the last second, 100 ms buckets for the last 30 seconds.
+/// Short windows are answered from the fine ring, longer ones from the coarse ring.
+template <size_t Fields>
+class WindowedSums {
+public:
+    using Totals = typename TimeBuckets<Fields>::Totals;
+
+    static constexpr uint32_t FINE_BUCKET_MS = 10;
+    static constexpr size_t FINE_BUCKETS = 100;
+    static constexpr uint32_t COARSE_BUCKET_MS = 100;
+    static constexpr size_t COARSE_BUCKETS = 300;
+
+    WindowedSums() : fine_(FINE_BUCKET_MS, FINE_BUCKETS), coarse_(COARSE_BUCKET_MS, COARSE_BUCKETS) {}
+
+    /// Writer: account one sample at `now_ms`.
+    void add(uint64_t now_ms, const std::array<int64_t, Fields> &values) {
+        fine_.add(now_ms, values);
+        coarse_.add(now_ms, values);
+    }
+
+    /// Reader: totals over the last `window_ms`, up to 30 s.
+    Totals sum(uint64_t now_ms, uint64_t window_ms) const {
+        if (window_ms <= fine_.span_ms()) {
+            return fine_.sum(now_ms, window_ms);
+        }
+        return coarse_.sum(now_ms, window_ms);
+    }
+
+private:
+    TimeBuckets<Fields> fine_;
+    TimeBuckets<Fields> coarse_;
+};
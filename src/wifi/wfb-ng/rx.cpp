@@ -44,8 +44,10 @@ extern "C"
 #include "ieee80211_radiotap.h"
 }
 
+#include <algorithm>
 #include <string>
 #include <memory>
+#include <utility>
 
 #include "wifibroadcast.hpp"
 #include "rx.hpp"
@@ -268,13 +270,19 @@ void Receiver::loop_iter(void)
 
 
 Aggregator::Aggregator(const string &keypair, uint64_t epoch, uint32_t channel_id) : \
-    count_p_all(0), count_b_all(0), count_p_dec_err(0), count_p_session(0), count_p_data(0), count_p_fec_recovered(0),
-    count_p_lost(0), count_p_bad(0), count_p_override(0), count_p_outgoing(0), count_b_outgoing(0),
-    fec_p(NULL), fec_k(-1), fec_n(-1), seq(0), rx_ring{}, rx_ring_front(0), rx_ring_alloc(0),
-    last_known_block((uint64_t)-1), epoch(epoch), channel_id(channel_id)
+    count_p_all(0), count_b_all(0), count_p_dec_err(0), count_p_session(0), count_p_data(0), count_p_uniq(0), count_p_dup(0),
+    count_p_fec_recovered(0), count_p_lost(0), count_p_bad(0), count_p_override(0), count_p_outgoing(0), count_b_outgoing(0),
+    count_blk_completed(0), count_blk_deadline(0), lost_before_packet(0), fec_p(NULL), fec_k(-1), fec_n(-1), seq(0), rx_ring_size(RX_RING_SIZE), target_rx_ring_size(RX_RING_SIZE),
+    spare_fragment(NULL), rx_ring_front(0), rx_ring_alloc(0), latency_budget_ms(0), block_deadline_ms(0), rate_deadline_ms(0),
+    rate_start_block((uint64_t)-1), rate_start_ms(0), last_known_block((uint64_t)-1), epoch(epoch), channel_id(channel_id),
+    last_session_packet_size(0)
 {
     memset(session_key, '\0', sizeof(session_key));
 
+    // Decryption needs the spare fragment even before the first session
+    fragment_slab.reserve(1);
+    spare_fragment = fragment_slab.fragment(0);
+
     FILE *fp;
     if((fp = fopen(keypair.c_str(), "r")) == NULL)
     {
@@ -320,44 +328,137 @@ void Aggregator::init_fec(int k, int n)
     rx_ring_alloc = 0;
     last_known_block = (uint64_t)-1;
     seq = 0;
+    dedup_window.reset();
+
+    // Block indexes start over with the new session
+    rate_start_block = (uint64_t)-1;
+
+    alloc_rx_ring(target_rx_ring_size);
+}
+
+void Aggregator::deinit_fec(void)
+{
+    assert(fec_p != NULL);
+
+    // Fragments stay in fragment_slab for the next session
 
-    for(int ring_idx = 0; ring_idx < RX_RING_SIZE; ring_idx++)
+    zfex_status_code_t rc = fec_free(fec_p);
+    assert(rc == ZFEX_SC_OK);
+    fec_p = NULL;
+    fec_k = -1;
+    fec_n = -1;
+}
+
+void Aggregator::alloc_rx_ring(int ring_size)
+{
+    assert(fec_n >= 1);
+    assert(rx_ring_alloc == 0);
+
+    size_t ring_fragments = (size_t)ring_size * fec_n;
+
+    // One more for spare_fragment. Nothing is in flight, so all fragments can be handed out anew.
+    fragment_slab.reserve(ring_fragments + 1);
+    fragment_ptrs.resize(ring_fragments);
+    fragment_sizes.resize(ring_fragments);
+    rx_ring.resize(ring_size);
+
+    for(int ring_idx = 0; ring_idx < ring_size; ring_idx++)
     {
         rx_ring[ring_idx].block_idx = 0;
         rx_ring[ring_idx].fragment_to_send_idx = 0;
         rx_ring[ring_idx].has_fragments = 0;
-        rx_ring[ring_idx].fragments = new uint8_t*[fec_n];
+        rx_ring[ring_idx].fragments = &fragment_ptrs[(size_t)ring_idx * fec_n];
+        rx_ring[ring_idx].fragment_map = &fragment_sizes[(size_t)ring_idx * fec_n];
         for(int i=0; i < fec_n; i++)
         {
-            int _rc = posix_memalign((void**)&rx_ring[ring_idx].fragments[i], ZFEX_SIMD_ALIGNMENT, ZFEX_ROUND_UP_SIMD(MAX_FEC_PAYLOAD));
-            assert(_rc == 0);
+            rx_ring[ring_idx].fragments[i] = fragment_slab.fragment((size_t)ring_idx * fec_n + i);
         }
-        rx_ring[ring_idx].fragment_map = new size_t[fec_n];
         memset(rx_ring[ring_idx].fragment_map, '\0', fec_n * sizeof(size_t));
     }
+    spare_fragment = fragment_slab.fragment(ring_fragments);
+
+    rx_ring_size = ring_size;
+    rx_ring_front = 0;
 }
 
-void Aggregator::deinit_fec(void)
+void Aggregator::set_latency_budget(uint32_t budget_ms)
 {
-    assert(fec_p != NULL);
+    latency_budget_ms = budget_ms;
+    rate_start_block = (uint64_t)-1;
 
-    for(int ring_idx = 0; ring_idx < RX_RING_SIZE; ring_idx++)
+    if (budget_ms == 0)
     {
-        delete[] rx_ring[ring_idx].fragment_map;
-        rx_ring[ring_idx].fragment_map = NULL;
-        for(int i=0; i < fec_n; i++)
-        {
-            free(rx_ring[ring_idx].fragments[i]);
-        }
-        delete[] rx_ring[ring_idx].fragments;
-        rx_ring[ring_idx].fragments = NULL;
+        target_rx_ring_size = RX_RING_SIZE;
     }
+}
 
-    zfex_status_code_t rc = fec_free(fec_p);
-    assert(rc == ZFEX_SC_OK);
-    fec_p = NULL;
-    fec_k = -1;
-    fec_n = -1;
+void Aggregator::set_block_deadline(uint32_t deadline_ms)
+{
+    block_deadline_ms = deadline_ms;
+    rate_deadline_ms = 0;
+    rate_start_block = (uint64_t)-1;
+}
+
+void Aggregator::update_block_rate(void)
+{
+    if (latency_budget_ms == 0 && block_deadline_ms == 0) return;
+
+    uint64_t now = clock_ms();
+
+    if (rate_start_block == (uint64_t)-1)
+    {
+        rate_start_block = last_known_block;
+        rate_start_ms = now;
+        return;
+    }
+
+    // Measure over at least a second to smooth out bursts
+    if (now - rate_start_ms < 1000) return;
+
+    uint64_t blocks = last_known_block - rate_start_block;
+    uint64_t elapsed_ms = now - rate_start_ms;
+
+    if (latency_budget_ms > 0)
+    {
+        uint64_t blocks_per_sec = blocks * 1000 / elapsed_ms;
+        uint64_t ring_size = blocks_per_sec * latency_budget_ms / 1000;
+
+        target_rx_ring_size = (int)std::clamp(ring_size, (uint64_t)RX_RING_MIN_SIZE, (uint64_t)RX_RING_MAX_SIZE);
+    }
+
+    if (block_deadline_ms > 0)
+    {
+        // Slow links spread a block over a long time, a fixed deadline would cut it off while it's still arriving
+        uint64_t deadline_ms = blocks > 0 ? RX_BLOCK_DEADLINE_INTERVALS * elapsed_ms / blocks : RX_BLOCK_DEADLINE_MAX_MS;
+        deadline_ms = std::min(deadline_ms, (uint64_t)RX_BLOCK_DEADLINE_MAX_MS);
+
+        rate_deadline_ms = (uint32_t)std::max(deadline_ms, (uint64_t)block_deadline_ms);
+    }
+
+    rate_start_block = last_known_block;
+    rate_start_ms = now;
+}
+
+void rxFragmentSlab::reserve(size_t count)
+{
+    if (count <= capacity) return;
+
+    free(slab);
+    slab = NULL;
+    capacity = 0;
+
+    if (posix_memalign((void**)&slab, ZFEX_SIMD_ALIGNMENT, count * ZFEX_ROUND_UP_SIMD(MAX_FEC_PAYLOAD)) != 0)
+    {
+        slab = NULL;
+        throw runtime_error(string_format("Unable to allocate %zu RX fragments", count));
+    }
+    capacity = count;
+}
+
+uint8_t* rxFragmentSlab::fragment(size_t idx) const
+{
+    assert(idx < capacity);
+    return slab + idx * ZFEX_ROUND_UP_SIMD(MAX_FEC_PAYLOAD);
 }
 
 
@@ -419,9 +520,9 @@ Forwarder::~Forwarder()
 
 int Aggregator::rx_ring_push(void)
 {
-    if(rx_ring_alloc < RX_RING_SIZE)
+    if(rx_ring_alloc < rx_ring_size)
     {
-        int idx = modN(rx_ring_front + rx_ring_alloc, RX_RING_SIZE);
+        int idx = modN(rx_ring_front + rx_ring_alloc, rx_ring_size);
         rx_ring_alloc += 1;
         return idx;
     }
@@ -445,10 +546,11 @@ int Aggregator::rx_ring_push(void)
             send_packet(rx_ring_front, f_idx);
         }
     }
+    block_done(rx_ring_front, fec_n);
 
     // override last item in ring
     int ring_idx = rx_ring_front;
-    rx_ring_front = modN(rx_ring_front + 1, RX_RING_SIZE);
+    rx_ring_front = modN(rx_ring_front + 1, rx_ring_size);
     return ring_idx;
 }
 
@@ -456,7 +558,7 @@ int Aggregator::rx_ring_push(void)
 int Aggregator::get_block_ring_idx(uint64_t block_idx)
 {
     // check if block is already in the ring
-    for(int i = rx_ring_front, c = rx_ring_alloc; c > 0; i = modN(i + 1, RX_RING_SIZE), c--)
+    for(int i = rx_ring_front, c = rx_ring_alloc; c > 0; i = modN(i + 1, rx_ring_size), c--)
     {
         if (rx_ring[i].block_idx == block_idx) return i;
     }
@@ -467,16 +569,19 @@ int Aggregator::get_block_ring_idx(uint64_t block_idx)
         return -1;
     }
 
-    int new_blocks = (int)min(last_known_block != (uint64_t)-1 ? block_idx - last_known_block : 1, (uint64_t)RX_RING_SIZE);
+    int new_blocks = (int)min(last_known_block != (uint64_t)-1 ? block_idx - last_known_block : 1, (uint64_t)rx_ring_size);
     assert (new_blocks > 0);
 
     last_known_block = block_idx;
+    update_block_rate();
     int ring_idx = -1;
+    uint64_t arrival_ms = block_deadline_ms > 0 ? clock_ms() : 0;
 
     for(int i = 0; i < new_blocks; i++)
     {
         ring_idx = rx_ring_push();
         rx_ring[ring_idx].block_idx = block_idx + i + 1 - new_blocks;
+        rx_ring[ring_idx].arrival_ms = arrival_ms;
         rx_ring[ring_idx].fragment_to_send_idx = 0;
         rx_ring[ring_idx].has_fragments = 0;
         memset(rx_ring[ring_idx].fragment_map, '\0', fec_n * sizeof(size_t));
@@ -501,7 +606,7 @@ void Aggregator::dump_stats(void)
             count_p_all, count_b_all,                    // incoming
             count_p_dec_err,                             // decryption
             count_p_session, count_p_data,               // classification
-            (uint32_t)count_p_uniq.size(),               // unique check
+            count_p_uniq,                                // unique check
             count_p_fec_recovered, count_p_lost,         // fec recovering
             count_p_bad,                                 // internal errors
             count_p_outgoing, count_b_outgoing);         // outgoing
@@ -517,6 +622,11 @@ void Aggregator::dump_stats(void)
         WFB_ERR("%u packets lost\n", count_p_lost);
     }
 
+    if(count_blk_deadline)
+    {
+        WFB_ERR("%u blocks flushed by deadline, %u completed\n", count_blk_deadline, count_blk_completed);
+    }
+
     clear_stats();
 }
 
@@ -608,6 +718,14 @@ void Aggregator::process_packet(const uint8_t *buf, size_t size, uint8_t wlan_id
             return;
         }
 
+        // The TX re-announces the same session packet over and over. If it's byte for byte the one
+        // accepted last time, it would decrypt and validate the same way, so skip the public-key crypto.
+        if (size == last_session_packet_size && memcmp(buf, last_session_packet, size) == 0)
+        {
+            count_p_session += 1;
+            return;
+        }
+
         if(crypto_box_open_easy((uint8_t*)session_tmp,
                                 buf + sizeof(wsession_hdr_t),
                                 size - sizeof(wsession_hdr_t),
@@ -658,6 +776,9 @@ void Aggregator::process_packet(const uint8_t *buf, size_t size, uint8_t wlan_id
 
         count_p_session += 1;
 
+        memcpy(last_session_packet, buf, size);
+        last_session_packet_size = size;
+
         // Ignore RSSI (and per-card rx counters) for session packets to simplify calculation
         // of lost packets because session packets doesn't have any serial number and it is
         // too hard to calculate number of unique session packets
@@ -673,6 +794,7 @@ void Aggregator::process_packet(const uint8_t *buf, size_t size, uint8_t wlan_id
             }
 
             init_fec(new_session_data->k, new_session_data->n);
+            on_session();
 
             IPC_MSG("%" PRIu64 "\tSESSION\t%" PRIu64 ":%u:%d:%d\n", get_time_ms(), epoch, WFB_FEC_VDM_RS, fec_k, fec_n);
             IPC_MSG_SEND();
@@ -686,11 +808,19 @@ void Aggregator::process_packet(const uint8_t *buf, size_t size, uint8_t wlan_id
         return;
     }
 
-    uint8_t decrypted[MAX_FEC_PAYLOAD];
+    // Resize the ring only while there is nothing in it
+    if (rx_ring_alloc == 0 && rx_ring_size != target_rx_ring_size && fec_p != NULL)
+    {
+        WFB_DBG("AGG: RX ring size %d -> %d\n", rx_ring_size, target_rx_ring_size);
+        alloc_rx_ring(target_rx_ring_size);
+    }
+
+    // Decrypt into the spare fragment, which is swapped into the ring once the packet turns out to be new.
+    // Nothing in the ring may change before the packet is authenticated.
     unsigned long long decrypted_len;
     wblock_hdr_t *block_hdr = (wblock_hdr_t*)buf;
 
-    if (crypto_aead_chacha20poly1305_decrypt(decrypted, &decrypted_len,
+    if (crypto_aead_chacha20poly1305_decrypt(spare_fragment, &decrypted_len,
                                              NULL,
                                              buf + sizeof(wblock_hdr_t), size - sizeof(wblock_hdr_t),
                                              buf,
@@ -711,7 +841,15 @@ void Aggregator::process_packet(const uint8_t *buf, size_t size, uint8_t wlan_id
     uint64_t block_idx = be64toh(block_hdr->data_nonce) >> 8;
     uint8_t fragment_idx = (uint8_t)(be64toh(block_hdr->data_nonce) & 0xff);
 
-    count_p_uniq.insert(be64toh(block_hdr->data_nonce));
+    const bool duplicate = !dedup_window.insert(block_idx, fragment_idx);
+    if (!duplicate)
+    {
+        count_p_uniq += 1;
+    }
+    else
+    {
+        count_p_dup += 1;
+    }
 
     // Should never happend due to generating new session key on tx side
     if (block_idx > MAX_BLOCK_IDX)
@@ -728,6 +866,9 @@ void Aggregator::process_packet(const uint8_t *buf, size_t size, uint8_t wlan_id
         return;
     }
 
+    // Every adapter's copy counts here. All copies that pass authentication are the same, so the first one is kept.
+    on_packet(wlan_idx, antenna, rssi, noise, block_idx * fec_n + fragment_idx, duplicate);
+
     int ring_idx = get_block_ring_idx(block_idx);
 
     //ignore already processed blocks
@@ -738,8 +879,8 @@ void Aggregator::process_packet(const uint8_t *buf, size_t size, uint8_t wlan_id
     //ignore already processed fragments
     if (p->fragment_map[fragment_idx]) return;
 
-    memset(p->fragments[fragment_idx], '\0', MAX_FEC_PAYLOAD);
-    memcpy(p->fragments[fragment_idx], decrypted, decrypted_len);
+    // The tail beyond decrypted_len is garbage, apply_fec() zeroes what it needs of it.
+    std::swap(p->fragments[fragment_idx], spare_fragment);
 
     p->fragment_map[fragment_idx] = decrypted_len;
     p->has_fragments += 1;
@@ -760,7 +901,9 @@ void Aggregator::process_packet(const uint8_t *buf, size_t size, uint8_t wlan_id
         // remove block if all K elements (without gaps) were sent
         if(p->fragment_to_send_idx == fec_k)
         {
-            rx_ring_front = modN(rx_ring_front + 1, RX_RING_SIZE);
+            block_done(ring_idx, fec_k);
+            count_blk_completed += 1;
+            rx_ring_front = modN(rx_ring_front + 1, rx_ring_size);
             rx_ring_alloc -= 1;
             assert(rx_ring_alloc >= 0);
             return;
@@ -772,7 +915,7 @@ void Aggregator::process_packet(const uint8_t *buf, size_t size, uint8_t wlan_id
     {
         // send all queued packets in all unfinished blocks before current
         // and then remove that blocks
-        int nrm = modN(ring_idx - rx_ring_front, RX_RING_SIZE);
+        int nrm = modN(ring_idx - rx_ring_front, rx_ring_size);
 
         while(nrm > 0)
         {
@@ -783,7 +926,8 @@ void Aggregator::process_packet(const uint8_t *buf, size_t size, uint8_t wlan_id
                     send_packet(rx_ring_front, f_idx);
                 }
             }
-            rx_ring_front = modN(rx_ring_front + 1, RX_RING_SIZE);
+            block_done(rx_ring_front, fec_n);
+            rx_ring_front = modN(rx_ring_front + 1, rx_ring_size);
             rx_ring_alloc -= 1;
             nrm -= 1;
         }
@@ -791,6 +935,11 @@ void Aggregator::process_packet(const uint8_t *buf, size_t size, uint8_t wlan_id
         assert(rx_ring_alloc > 0);
         assert(ring_idx == rx_ring_front);
 
+        // The block completed with its last arrived fragment, whatever follows it wasn't waited for
+        int observed = fec_n;
+        while(observed > 0 && ! p->fragment_map[observed - 1]) observed--;
+        block_done(ring_idx, observed);
+
         // Search for missed data fragments and apply FEC only if needed
         for(int f_idx=p->fragment_to_send_idx; f_idx < fec_k; f_idx++)
         {
@@ -826,12 +975,48 @@ void Aggregator::process_packet(const uint8_t *buf, size_t size, uint8_t wlan_id
         }
 
         // remove block
-        rx_ring_front = modN(rx_ring_front + 1, RX_RING_SIZE);
+        count_blk_completed += 1;
+        rx_ring_front = modN(rx_ring_front + 1, rx_ring_size);
         rx_ring_alloc -= 1;
         assert(rx_ring_alloc >= 0);
     }
 }
 
+void Aggregator::flush_expired(void)
+{
+    if (rate_deadline_ms == 0 || rx_ring_alloc == 0) return;
+
+    uint64_t now = clock_ms();
+
+    // Blocks enter the ring in order, so their deadlines expire in order too.
+    // The newest block is left alone: the TX sends blocks one after another, so until the next one shows up,
+    // the rest of this one may still be on its way. Sending what's past its gaps now would lose that.
+    while(rx_ring_alloc > 1 && now - rx_ring[rx_ring_front].arrival_ms >= rate_deadline_ms)
+    {
+        rx_ring_item_t *p = &rx_ring[rx_ring_front];
+
+        WFB_DBG("AGG: Deadline for block 0x%" PRIx64 ", flush %d fragments\n", p->block_idx, p->has_fragments);
+
+        for(int f_idx=p->fragment_to_send_idx; f_idx < fec_k; f_idx++)
+        {
+            if(p->fragment_map[f_idx])
+            {
+                send_packet(rx_ring_front, f_idx);
+            }
+        }
+        block_done(rx_ring_front, fec_n);
+
+        count_blk_deadline += 1;
+        rx_ring_front = modN(rx_ring_front + 1, rx_ring_size);
+        rx_ring_alloc -= 1;
+    }
+}
+
+void Aggregator::block_done(int ring_idx, int observed)
+{
+    on_block_done(rx_ring[ring_idx].block_idx, rx_ring[ring_idx].fragment_map, observed, fec_k, fec_n);
+}
+
 void Aggregator::send_packet(int ring_idx, int fragment_idx)
 {
     wpacket_hdr_t* packet_hdr = (wpacket_hdr_t*)(rx_ring[ring_idx].fragments[fragment_idx]);
@@ -844,6 +1029,7 @@ void Aggregator::send_packet(int ring_idx, int fragment_idx)
     {
         ANDROID_IPC_MSG("PKT_LOST\t%d", (packet_seq - seq - 1));
         count_p_lost += (packet_seq - seq - 1);
+        lost_before_packet += (packet_seq - seq - 1);
     }
 
     seq = packet_seq;
@@ -852,10 +1038,13 @@ void Aggregator::send_packet(int ring_idx, int fragment_idx)
     {
         WFB_ERR("Corrupted packet %u\n", seq);
         count_p_bad += 1;
+        lost_before_packet += 1;
     }
     else if(!(flags & WFB_PACKET_FEC_ONLY))
     {
+        // Losses carry over FEC-only padding to the next real packet
         send_to_socket(payload, packet_size);
+        lost_before_packet = 0;
         count_p_outgoing += 1;
         count_b_outgoing += packet_size;
     }
@@ -901,7 +1090,19 @@ void Aggregator::apply_fec(int ring_idx)
     assert(max_packet_size > 0);
     assert(max_packet_size <= MAX_FEC_PAYLOAD);
 
-    zfex_status_code_t rc = fec_decode_simd(fec_p, (const uint8_t**)in_blocks, out_blocks, index, ZFEX_ROUND_UP_SIMD(max_packet_size));
+    size_t fec_size = ZFEX_ROUND_UP_SIMD(max_packet_size);
+
+    // Fragments are stored without zero padding, pad the inputs up to the FEC size here
+    for(int i=0; i < fec_k; i++)
+    {
+        size_t fragment_size = rx_ring[ring_idx].fragment_map[index[i]];
+        if (fragment_size < fec_size)
+        {
+            memset(in_blocks[i] + fragment_size, '\0', fec_size - fragment_size);
+        }
+    }
+
+    zfex_status_code_t rc = fec_decode_simd(fec_p, (const uint8_t**)in_blocks, out_blocks, index, fec_size);
     assert(rc == ZFEX_SC_OK);
 }
 
@@ -27,7 +27,7 @@
 #include <stdio.h>
 #include <errno.h>
 #include <string>
-#include <set>
+#include <vector>
 #include <string.h>
 #include <stdexcept>
 
@@ -69,6 +69,7 @@ private:
 
 typedef struct {
     uint64_t block_idx;
+    uint64_t arrival_ms; // when the first fragment of this block (or of a later one) arrived
     uint8_t** fragments;
     size_t *fragment_map;
     uint8_t fragment_to_send_idx;
@@ -76,7 +77,36 @@ typedef struct {
 } rx_ring_item_t;
 
 
-#define RX_RING_SIZE 40
+#define RX_RING_SIZE 40        // default ring depth in blocks, used without a latency budget
+#define RX_RING_MIN_SIZE 8
+#define RX_RING_MAX_SIZE 128
+
+#define RX_BLOCK_DEADLINE_INTERVALS 2  // block deadline in block intervals: one to arrive, one for stragglers
+#define RX_BLOCK_DEADLINE_MAX_MS 1000
+
+
+// Backing store for the RX ring fragments, one aligned allocation.
+// It only ever grows, so session rekeys and ring resizes reuse it instead of reallocating every fragment.
+class rxFragmentSlab
+{
+public:
+    rxFragmentSlab(void) : slab(NULL), capacity(0) {}
+    ~rxFragmentSlab(void) { free(slab); }
+
+    // Make room for `count` fragments. Growing invalidates all fragments handed out so far.
+    void reserve(size_t count);
+
+    uint8_t* fragment(size_t idx) const;
+
+    size_t size(void) const { return capacity; }
+
+private:
+    rxFragmentSlab(const rxFragmentSlab&);
+    rxFragmentSlab& operator=(const rxFragmentSlab&);
+
+    uint8_t *slab;
+    size_t capacity;
+};
 
 static inline int modN(int x, int base)
 {
@@ -158,6 +188,78 @@ struct std::hash<rxAntennaKey>
 
 typedef std::unordered_map<rxAntennaKey, rxAntennaItem> rx_antenna_stat_t;
 
+
+#define RX_DEDUP_WINDOW 256  // blocks, must be a power of two and larger than RX_RING_MAX_SIZE
+
+// Remembers which (block, fragment) pairs were seen in the last RX_DEDUP_WINDOW blocks.
+// Fixed size, so unlike a set of nonces it neither allocates nor grows on the RX path.
+class rxDedupWindow
+{
+public:
+    rxDedupWindow(void) { reset(); }
+
+    void reset(void)
+    {
+        last_block = (uint64_t)-1;
+        memset(fragments_seen, '\0', sizeof(fragments_seen));
+    }
+
+    // Returns true the first time a fragment is seen. Fragments of blocks older than the window
+    // are reported as duplicates: the aggregator has flushed those blocks long ago anyway.
+    bool insert(uint64_t block_idx, uint8_t fragment_idx)
+    {
+        if (last_block == (uint64_t)-1 || block_idx > last_block)
+        {
+            // Slide the window forward, forgetting the blocks that fall out of it
+            uint64_t new_blocks = last_block == (uint64_t)-1 ? RX_DEDUP_WINDOW : std::min(block_idx - last_block, (uint64_t)RX_DEDUP_WINDOW);
+            for(uint64_t i = 0; i < new_blocks; i++)
+            {
+                memset(fragments_seen[(block_idx - i) & (RX_DEDUP_WINDOW - 1)], '\0', sizeof(fragments_seen[0]));
+            }
+            last_block = block_idx;
+        }
+        else if (last_block - block_idx >= RX_DEDUP_WINDOW)
+        {
+            return false;
+        }
+
+        uint64_t &word = fragments_seen[block_idx & (RX_DEDUP_WINDOW - 1)][fragment_idx >> 6];
+        uint64_t mask = (uint64_t)1 << (fragment_idx & 63);
+
+        if (word & mask) return false;
+
+        word |= mask;
+        return true;
+    }
+
+private:
+    static_assert((RX_DEDUP_WINDOW & (RX_DEDUP_WINDOW - 1)) == 0, "RX_DEDUP_WINDOW must be a power of two");
+    static_assert(RX_DEDUP_WINDOW > RX_RING_MAX_SIZE, "RX_DEDUP_WINDOW must cover the RX ring");
+
+    uint64_t last_block;
+    uint64_t fragments_seen[RX_DEDUP_WINDOW][256 / 64];
+};
+
+
+// Packet counters of an aggregator, see Aggregator::roll_stats()
+typedef struct {
+    uint32_t count_p_all;
+    uint32_t count_b_all;
+    uint32_t count_p_dec_err;
+    uint32_t count_p_session;
+    uint32_t count_p_data;
+    uint32_t count_p_uniq;
+    uint32_t count_p_dup;
+    uint32_t count_p_fec_recovered;
+    uint32_t count_p_lost;
+    uint32_t count_p_bad;
+    uint32_t count_p_override;
+    uint32_t count_p_outgoing;
+    uint32_t count_b_outgoing;
+    uint32_t count_blk_completed;
+    uint32_t count_blk_deadline;
+} rx_stats_t;
+
 class Aggregator : public BaseAggregator
 {
 public:
@@ -172,18 +274,49 @@ public:
     void clear_stats(void)
     {
         antenna_stat.clear();
+        clear_counters();
+    }
+
+    // Copy the packet counters accumulated since the last call into `stats` and start over.
+    // Unlike dump_stats() this doesn't touch the antenna stats, so it never allocates
+    // and can be called as often as needed.
+    void roll_stats(rx_stats_t &stats)
+    {
+        stats.count_p_all = count_p_all;
+        stats.count_b_all = count_b_all;
+        stats.count_p_dec_err = count_p_dec_err;
+        stats.count_p_session = count_p_session;
+        stats.count_p_data = count_p_data;
+        stats.count_p_uniq = count_p_uniq;
+        stats.count_p_dup = count_p_dup;
+        stats.count_p_fec_recovered = count_p_fec_recovered;
+        stats.count_p_lost = count_p_lost;
+        stats.count_p_bad = count_p_bad;
+        stats.count_p_override = count_p_override;
+        stats.count_p_outgoing = count_p_outgoing;
+        stats.count_b_outgoing = count_b_outgoing;
+        stats.count_blk_completed = count_blk_completed;
+        stats.count_blk_deadline = count_blk_deadline;
+        clear_counters();
+    }
+
+    void clear_counters(void)
+    {
         count_p_all = 0;
         count_b_all = 0;
         count_p_dec_err = 0;
         count_p_session = 0;
         count_p_data = 0;
-        count_p_uniq.clear();
+        count_p_uniq = 0;
+        count_p_dup = 0;
         count_p_fec_recovered = 0;
         count_p_lost = 0;
         count_p_bad = 0;
         count_p_override = 0;
         count_p_outgoing = 0;
         count_b_outgoing = 0;
+        count_blk_completed = 0;
+        count_blk_deadline = 0;
     }
 
     rx_antenna_stat_t antenna_stat;
@@ -192,28 +325,75 @@ public:
     uint32_t count_p_dec_err;
     uint32_t count_p_session;
     uint32_t count_p_data;
-    std::set<uint64_t> count_p_uniq;
+    uint32_t count_p_uniq;
+    uint32_t count_p_dup;
     uint32_t count_p_fec_recovered;
     uint32_t count_p_lost;
     uint32_t count_p_bad;
     uint32_t count_p_override;
     uint32_t count_p_outgoing;
     uint32_t count_b_outgoing;
+    uint32_t count_blk_completed; // blocks sent in full, directly or after FEC
+    uint32_t count_blk_deadline;  // incomplete blocks flushed by flush_expired()
+
+    // Size the RX ring so that waiting for the oldest block to complete takes at most `budget_ms` at the
+    // measured block rate. 0 restores the fixed RX_RING_SIZE. A new size is applied once the ring is empty.
+    void set_latency_budget(uint32_t budget_ms);
+
+    int get_rx_ring_size(void) const { return rx_ring_size; }
+
+    // Give up on an incomplete block once a later block has started to arrive and the deadline has passed since
+    // the block's first fragment. The deadline is RX_BLOCK_DEADLINE_INTERVALS block intervals at the block rate,
+    // measured as for set_latency_budget(), and at least `deadline_ms`. Until the rate is known, blocks wait.
+    // 0 disables the deadline, then incomplete blocks only leave the ring when a later block completes or the ring
+    // overflows.
+    void set_block_deadline(uint32_t deadline_ms);
+
+    // Deadline in use, 0 while the block rate isn't known yet
+    uint32_t get_block_deadline(void) const { return rate_deadline_ms; }
+
+    // Send what has arrived of blocks past their deadline and drop them from the ring.
+    // Call this periodically, packets alone don't drive it during a fade.
+    void flush_expired(void);
 
 protected:
     virtual void send_to_socket(const uint8_t *payload, uint16_t packet_size) = 0;
 
+    // Packets given up on (lost or corrupted) right before the one passed to send_to_socket().
+    // Only meaningful inside send_to_socket(); lets a subclass mark its output as damaged.
+    uint32_t lost_before_packet;
+
+    // Monotonic clock for deadlines and rate measurement, can be replaced for simulation
+    virtual uint64_t clock_ms(void) { return get_time_ms(); }
+
+    // A block left the RX ring, complete or not. Of its first `observed` fragments, fragment_map[i] != 0
+    // for those that arrived; the rest weren't waited for. Lets a subclass model the loss process.
+    virtual void on_block_done(uint64_t /*block_idx*/, const size_t* /*fragment_map*/, int /*observed*/,
+                               int /*fec_k*/, int /*fec_n*/) {}
+
+    // An authenticated data fragment arrived through `wlan_idx`, with the per-antenna signal levels passed to
+    // process_packet(). `fragment_seq` is block_idx * fec_n + fragment_idx, consecutive over a session.
+    // `duplicate` if another copy (e.g. from another adapter) arrived first.
+    virtual void on_packet(uint8_t /*wlan_idx*/, const uint8_t* /*antenna*/, const int8_t* /*rssi*/,
+                           const int8_t* /*noise*/, uint64_t /*fragment_seq*/, bool /*duplicate*/) {}
+
+    // A new session key was accepted, e.g. the TX restarted. What follows may not continue the previous stream.
+    virtual void on_session(void) {}
+
 private:
     Aggregator(const Aggregator&);
     Aggregator& operator=(const Aggregator&);
 
     void init_fec(int k, int n);
     void deinit_fec(void);
+    void alloc_rx_ring(int ring_size);
+    void update_block_rate(void);
     void send_packet(int ring_idx, int fragment_idx);
     void apply_fec(int ring_idx);
     void log_rssi(const sockaddr_in *sockaddr, uint8_t wlan_idx, const uint8_t *ant, const int8_t *rssi,
                   const int8_t *noise, uint16_t freq, uint8_t mcs_index, uint8_t bandwidth);
     int get_block_ring_idx(uint64_t block_idx);
+    void block_done(int ring_idx, int observed);
     int rx_ring_push(void);
     // cppcheck-suppress unusedPrivateFunction
     static int get_tag(const void *buf, size_t size, uint8_t tag_id, void *value, size_t value_size);
@@ -223,9 +403,21 @@ private:
     int fec_n;  // RS total number of fragments in block
 
     uint32_t seq;
-    rx_ring_item_t rx_ring[RX_RING_SIZE];
+    std::vector<rx_ring_item_t> rx_ring;
+    int rx_ring_size;        // ring depth in use
+    int target_rx_ring_size; // ring depth to switch to once the ring is empty
+    rxDedupWindow dedup_window;
+    rxFragmentSlab fragment_slab;
+    std::vector<uint8_t*> fragment_ptrs; // rx_ring[].fragments point here
+    std::vector<size_t> fragment_sizes;  // rx_ring[].fragment_map point here
+    uint8_t *spare_fragment; // packets are decrypted here and then swapped into rx_ring, see process_packet()
     int rx_ring_front; // current packet
     int rx_ring_alloc; // number of allocated entries
+    uint32_t latency_budget_ms;
+    uint32_t block_deadline_ms; // lower bound of rate_deadline_ms
+    uint32_t rate_deadline_ms;  // from the measured block rate, see update_block_rate()
+    uint64_t rate_start_block; // block rate measurement, see update_block_rate()
+    uint64_t rate_start_ms;
     uint64_t last_known_block;  //id of last known block
     uint64_t epoch; // current epoch
     const uint32_t channel_id; // (link_id << 8) + port_number
@@ -234,6 +426,10 @@ private:
     uint8_t rx_secretkey[crypto_box_SECRETKEYBYTES];
     uint8_t tx_publickey[crypto_box_PUBLICKEYBYTES];
     uint8_t session_key[crypto_aead_chacha20poly1305_KEYBYTES];
+
+    // Last session packet that passed validation, as received
+    uint8_t last_session_packet[MAX_SESSION_PACKET_SIZE];
+    size_t last_session_packet_size;
 };
 
 
@@ -1,5 +1,7 @@
 ﻿#include "wfbng_link.h"
 
+#include <algorithm>
+#include <cmath>
 #include <iomanip>
 #include <mutex>
 #include <set>
@@ -7,12 +9,15 @@
 
 #include "../gui_interface.h"
 #include "WiFiDriver.h"
+#include "antenna_stats.h"
+#include "keyframe_requester.h"
 #include "logger.h"
 #include "rtp.h"
 #include "rx_frame.h"
 #include "signal_quality.h"
 
 #ifdef __linux__
+    #include "linux/pcap_replay.h"
     #include "linux/tun.h"
     #include "linux/tx_frame.h"
     #include "wfb-ng/rx.hpp"
@@ -31,6 +36,31 @@ static std::atomic playing = false;
 
 constexpr u8 WFB_TX_PORT = 160;
 constexpr u8 WFB_RX_PORT = 32;
+constexpr u8 VIDEO_RADIO_PORT = 0;
+
+/// The HUD's packet loss is averaged over longer than the alink's second, so it doesn't flicker.
+constexpr std::chrono::milliseconds HUD_PACKET_LOSS_WINDOW{std::chrono::seconds(5)};
+
+#ifdef __linux__
+/// Longest the video aggregator waits for an incomplete FEC block; sizes its RX ring from the block rate.
+constexpr uint32_t VIDEO_RX_LATENCY_BUDGET_MS = 200;
+
+/// An incomplete video block, with a later one already arriving, is given up at least this long after its first
+/// fragment, so a fade doesn't hold back what has been received. Slower block rates stretch it, see
+/// Aggregator::set_block_deadline().
+constexpr uint32_t VIDEO_RX_BLOCK_DEADLINE_MS = 50;
+#endif
+
+/// Center frequency in MHz of a 2.4 or 5 GHz channel number.
+inline uint16_t channel_to_freq(uint8_t channel) {
+    if (channel == 14) {
+        return 2484;
+    }
+    if (channel < 14) {
+        return 2407 + 5 * channel;
+    }
+    return 5000 + 5 * channel;
+}
 
 inline bool isH264(const uint8_t *data) {
     auto h264NalType = GET_H264_NAL_UNIT_TYPE(data);
@@ -48,10 +78,52 @@ public:
                 int snd_buf_size)
         : AggregatorUDPv4(client_addr, client_port, keypair, epoch, channel_id, snd_buf_size) {}
 
+    /// Feed the FEC block loss patterns to `policy`.
+    void set_fec_policy(FecPolicy *policy) {
+        fec_policy = policy;
+    }
+
+    /// Feed the per-antenna signal levels and per-adapter loss to `stats`. It takes a single writer, so only the
+    /// video aggregator does.
+    void set_antenna_stats(AntennaStats *stats) {
+        antenna_stats = stats;
+    }
+
+    /// Treat the payload as the RTP video stream and hand it to the player. Only the video channel's aggregator may:
+    /// the RTP ring takes a single producer, and other channels' payloads aren't RTP. The others just forward.
+    void set_video(bool video) {
+        is_video = video;
+    }
+
 protected:
+    void on_packet(uint8_t wlan_idx,
+                   const uint8_t *antenna,
+                   const int8_t *rssi,
+                   const int8_t *noise,
+                   uint64_t fragment_seq,
+                   bool duplicate) override {
+        if (antenna_stats) {
+            antenna_stats->add(wlan_idx, antenna, rssi, noise, fragment_seq, duplicate, clock_ms());
+        }
+    }
+
+    void on_session() override {
+        has_prev_seq_num = false;
+    }
+
+    void on_block_done(uint64_t, const size_t *fragment_map, int observed, int fec_k, int fec_n) override {
+        if (fec_policy) {
+            fec_policy->on_block(fragment_map, observed, fec_k, fec_n);
+        }
+    }
+
     void send_to_socket(const uint8_t *payload, const uint16_t packet_size) override {
-        GuiInterface::Instance().rtpPktCount_++;
-        GuiInterface::Instance().UpdateCount();
+        if (!is_video) {
+            sendto(sockfd, payload, packet_size, 0, (sockaddr *)&saddr, sizeof(saddr));
+            return;
+        }
+
+        GuiInterface::Instance().rtpPktCount_.fetch_add(1, std::memory_order_relaxed);
 
         if (packet_size < 12) {
             return;
@@ -60,14 +132,14 @@ protected:
         auto *header = (RtpHeader *)payload;
         const uint16_t seq_num = htons(header->seq);
 
-        GuiInterface::Instance().PutLog(LogLevel::Debug, "RTP sequence number: {}", seq_num);
-        GuiInterface::Instance().PutLog(LogLevel::Debug, "RTP timestamp: {}", htonl(header->stamp));
-
-        static uint16_t prev_seq_num = seq_num;
-        if (seq_num - prev_seq_num > 1) {
-            GuiInterface::Instance().PutLog(LogLevel::Info, "RTP packets lost: {}", seq_num - prev_seq_num - 1);
+        // Modulo 2^16, a jump backwards (sender restart) isn't a gap
+        const uint16_t seq_step = seq_num - prev_seq_num;
+        if (has_prev_seq_num && seq_step > 1 && seq_step < 0x8000) {
+            GuiInterface::Instance().PutLog(LogLevel::Info, "RTP packets lost: {}", seq_step - 1);
+            KeyframeRequester::get_instance().report(KeyframeReason::RtpGap);
         }
         prev_seq_num = seq_num;
+        has_prev_seq_num = true;
 
         if (!playing) {
             playing = true;
@@ -79,10 +151,20 @@ protected:
                 GuiInterface::Instance().playerCodec = "H265";
             }
 
-            GuiInterface::Instance().NotifyRtpStream(header->pt,
-                                                     ntohl(header->ssrc),
-                                                     GuiInterface::Instance().playerPort,
-                                                     GuiInterface::Instance().playerCodec);
+            if (GuiInterface::Instance().use_gstreamer_) {
+                GuiInterface::Instance().NotifyRtpStream(header->pt,
+                                                         ntohl(header->ssrc),
+                                                         GuiInterface::Instance().playerPort,
+                                                         GuiInterface::Instance().playerCodec);
+            } else {
+                GuiInterface::Instance().NotifyRtpRingStream(GuiInterface::Instance().playerCodec);
+            }
+        }
+
+        // The FFmpeg player takes packets straight from memory.
+        if (!GuiInterface::Instance().use_gstreamer_) {
+            GuiInterface::Instance().rtpRing_.push(payload, packet_size, lost_before_packet);
+            return;
         }
 
         // Send payload via socket.
@@ -92,6 +174,32 @@ protected:
 private:
     AggregatorX(const AggregatorX &);
     AggregatorX &operator=(const AggregatorX &);
+
+    FecPolicy *fec_policy = nullptr;
+    AntennaStats *antenna_stats = nullptr;
+    bool is_video = false;
+
+    /// Last RTP sequence number of the session, to spot gaps
+    uint16_t prev_seq_num = 0;
+    bool has_prev_seq_num = false;
+};
+
+/// Hands the tunnel's packets, length headers and all, to the TUN proxy.
+class AggregatorTun : public Aggregator {
+public:
+    AggregatorTun(const std::string &keypair, uint64_t epoch, uint32_t channel_id, TunQueue &to_tun)
+        : Aggregator(keypair, epoch, channel_id), to_tun(to_tun) {}
+
+protected:
+    void send_to_socket(const uint8_t *payload, const uint16_t packet_size) override {
+        to_tun.push(payload, packet_size);
+    }
+
+private:
+    AggregatorTun(const AggregatorTun &);
+    AggregatorTun &operator=(const AggregatorTun &);
+
+    TunQueue &to_tun;
 };
 #endif
 
@@ -160,33 +268,12 @@ std::vector<DeviceId> WfbngLink::get_device_list() {
     return list;
 }
 
-bool WfbngLink::start(const DeviceId &deviceId, uint8_t channel, int channelWidthMode, const std::string &kPath) {
-    GuiInterface::Instance().wifiFrameCount_ = 0;
-    GuiInterface::Instance().wfbngFrameCount_ = 0;
-    GuiInterface::Instance().rtpPktCount_ = 0;
-    GuiInterface::Instance().UpdateCount();
-
-    keyPath = kPath;
-
-    if (usbThread) {
-        return false;
-    }
-
-    auto logger = std::make_shared<Logger>();
-
-    int rc = libusb_init(&ctx);
-    if (rc < 0) {
-        GuiInterface::Instance().PutLog(LogLevel::Error, "Failed to initialize libusb");
-        return false;
-    }
-
-    libusb_set_option(ctx, LIBUSB_OPTION_LOG_LEVEL, LIBUSB_LOG_LEVEL_ERROR);
-
+libusb_device_handle *WfbngLink::open_device(const DeviceId &deviceId) {
     // Get a list of USB devices
     libusb_device **devs;
     ssize_t count = libusb_get_device_list(ctx, &devs);
     if (count < 0) {
-        return false;
+        return nullptr;
     }
 
     libusb_device *target_dev{};
@@ -213,22 +300,18 @@ bool WfbngLink::start(const DeviceId &deviceId, uint8_t channel, int channelWidt
         GuiInterface::Instance().PutLog(LogLevel::Error, "Invalid device ID!");
         // Free the list of devices
         libusb_free_device_list(devs, 1);
-        libusb_exit(ctx);
-        ctx = nullptr;
-        return false;
+        return nullptr;
     }
 
     // This cannot handle multiple devices with the same vendor_id and product_id.
     // devHandle = libusb_open_device_with_vid_pid(ctx, wifiDeviceVid, wifiDevicePid);
-    libusb_open(target_dev, &devHandle);
+    libusb_device_handle *handle{};
+    libusb_open(target_dev, &handle);
 
     // Free the list of devices
     libusb_free_device_list(devs, 1);
 
-    if (devHandle == nullptr) {
-        libusb_exit(ctx);
-        ctx = nullptr;
-
+    if (handle == nullptr) {
         GuiInterface::Instance().PutLog(LogLevel::Error,
                                         "Cannot open device {:04x}:{:04x} at [{:}:{:}]",
                                         deviceId.vendor_id,
@@ -236,29 +319,267 @@ bool WfbngLink::start(const DeviceId &deviceId, uint8_t channel, int channelWidt
                                         deviceId.bus_num,
                                         deviceId.port_num);
         GuiInterface::Instance().ShowTip(FTR("invalid usb msg"));
-        return false;
+        return nullptr;
     }
 
     // Check if the kernel driver attached
-    if (libusb_kernel_driver_active(devHandle, 0)) {
+    if (libusb_kernel_driver_active(handle, 0)) {
         // Detach driver
-        rc = libusb_detach_kernel_driver(devHandle, 0);
+        libusb_detach_kernel_driver(handle, 0);
     }
 
-    rc = libusb_claim_interface(devHandle, 0);
+    int rc = libusb_claim_interface(handle, 0);
     if (rc < 0) {
-        libusb_close(devHandle);
-        devHandle = nullptr;
+        libusb_close(handle);
+
+        GuiInterface::Instance().PutLog(LogLevel::Error, "Failed to claim interface");
+        return nullptr;
+    }
 
+    return handle;
+}
+
+void WfbngLink::close_device(libusb_device_handle *handle) {
+    auto rc = libusb_release_interface(handle, 0);
+    if (rc < 0) {
+        GuiInterface::Instance().PutLog(LogLevel::Error, "Failed to release interface");
+    }
+    libusb_close(handle);
+}
+
+void WfbngLink::start_rx_pipeline(size_t num_producers) {
+    antenna_stats.reset();
+
+    size_t rx_workers = 0;
+    for (const auto &rx_channel : rx_channels) {
+        if (rx_channel) {
+            rx_workers = std::max(rx_workers, rx_channel->worker + 1);
+        }
+    }
+    rx_pipeline = std::make_unique<RxPipeline>(
+        num_producers,
+        rx_workers,
+        [this](const Packet &p, const RxSource &source) {
+            try {
+                handle_80211_frame(p, source);
+            } catch (const std::runtime_error &e) {
+                GuiInterface::Instance().PutLog(LogLevel::Error, e.what());
+            }
+        },
+        [this](size_t worker) { tick_rx_channels(worker); });
+}
+
+void WfbngLink::stop_rx_pipeline() {
+    rx_pipeline->stop();
+
+    const auto rx_stats = rx_pipeline->stats();
+    for (size_t i = 0; i < rx_stats.size(); i++) {
+        GuiInterface::Instance().PutLog(LogLevel::Info,
+                                        "RX worker {}: {} frames, {} dropped, queue latency avg {} us max {} us, "
+                                        "processing avg {} us",
+                                        i,
+                                        rx_stats[i].processed,
+                                        rx_stats[i].dropped,
+                                        rx_stats[i].avg_queue_latency.count() / 1000,
+                                        rx_stats[i].max_queue_latency.count() / 1000,
+                                        rx_stats[i].avg_process_time.count() / 1000);
+    }
+
+    const auto antenna_snapshot = get_antenna_stats();
+    for (const auto &antenna : antenna_snapshot.antennas) {
+        GuiInterface::Instance().PutLog(LogLevel::Info,
+                                        "RX adapter {} antenna {}: {} packets, RSSI {}/{:.1f}/{} dBm, "
+                                        "SNR {}/{:.1f}/{} dB (min/avg/max)",
+                                        antenna.adapter,
+                                        antenna.antenna,
+                                        antenna.packets,
+                                        antenna.rssi_min,
+                                        antenna.rssi_avg,
+                                        antenna.rssi_max,
+                                        antenna.snr_min,
+                                        antenna.snr_avg,
+                                        antenna.snr_max);
+    }
+    for (const auto &adapter : antenna_snapshot.adapters) {
+        GuiInterface::Instance().PutLog(LogLevel::Info,
+                                        "RX adapter {}: {} fragments received ({} unique, {} duplicate), {} lost "
+                                        "({:.2f}%)",
+                                        adapter.adapter,
+                                        adapter.received,
+                                        adapter.received - adapter.duplicate,
+                                        adapter.duplicate,
+                                        adapter.lost,
+                                        adapter.loss_ratio() * 100.f);
+    }
+
+    for (size_t port = 0; port < rx_channels.size(); port++) {
+        if (const RxChannel *rx_channel = rx_channels[port].get()) {
+            GuiInterface::Instance().PutLog(LogLevel::Info,
+                                            "RX port {}: {} FEC blocks completed, {} flushed by deadline",
+                                            port,
+                                            rx_channel->blocks_completed,
+                                            rx_channel->blocks_flushed);
+        }
+    }
+}
+
+void WfbngLink::start_rx_adapters(uint8_t channel, int channelWidthMode) {
+    auto logger = std::make_shared<Logger>();
+
+    for (size_t i = 0; i < rx_adapters.size(); i++) {
+        RxAdapter &adapter = *rx_adapters[i];
+        // The primary adapter is 0
+        const auto index = static_cast<uint8_t>(i + 1);
+
+        WiFiDriver wifi_driver{logger};
+        try {
+            adapter.device = wifi_driver.CreateRtlDevice(adapter.handle);
+        } catch (const std::runtime_error &e) {
+            GuiInterface::Instance().PutLog(LogLevel::Error, "RX adapter {}: {}", index, e.what());
+            continue;
+        }
+
+        adapter.thread = std::thread([this, &adapter, index, channel, channelWidthMode] {
+            const RxSource source{.adapter = index};
+            try {
+                adapter.device->Init([this, index, source](const Packet &p) { enqueue_80211_frame(p, index, source); },
+                                     SelectedChannel{
+                                         .Channel = channel,
+                                         .ChannelOffset = 0,
+                                         .ChannelWidth = static_cast<ChannelWidth_t>(channelWidthMode),
+                                     });
+            } catch (const std::runtime_error &e) {
+                GuiInterface::Instance().PutLog(LogLevel::Error, "RX adapter {}: {}", index, e.what());
+            } catch (...) {
+            }
+
+            GuiInterface::Instance().PutLog(LogLevel::Info, "RX adapter {} stopped", index);
+        });
+    }
+}
+
+void WfbngLink::stop_rx_adapters() {
+    for (auto &adapter : rx_adapters) {
+        if (adapter->device) {
+            adapter->device->should_stop = true;
+        }
+    }
+    for (auto &adapter : rx_adapters) {
+        if (adapter->thread.joinable()) {
+            adapter->thread.join();
+        }
+        adapter->device.reset();
+        close_device(adapter->handle);
+    }
+    rx_adapters.clear();
+}
+
+bool WfbngLink::start(const std::vector<DeviceId> &deviceIds,
+                      uint8_t channel,
+                      int channelWidthMode,
+                      const std::string &kPath) {
+    GuiInterface::Instance().ResetCount();
+
+    keyPath = kPath;
+
+    if (usbThread || deviceIds.empty()) {
+        return false;
+    }
+
+#ifdef __linux__
+    // Before the channels and the TX thread, both plug into its queues. The tunnel is a bonus too.
+    tun_.reset();
+    if (tun_enabled) {
+        try {
+            tun_ = std::make_unique<Tun>();
+            if (tun_->init("10.5.0.3", 24)) {
+                tun_->start();
+            } else {
+                tun_.reset();
+            }
+        } catch (const std::runtime_error &e) {
+            GuiInterface::Instance().PutLog(LogLevel::Error, "Failed to set up the TUN: {}", e.what());
+            tun_.reset();
+        }
+    }
+
+    // Every failure return from here on takes the TUN down again, with the tunnel channel reading its queue.
+    struct TunGuard {
+        WfbngLink &link;
+        bool dismissed = false;
+
+        ~TunGuard() {
+            if (dismissed || !link.tun_) {
+                return;
+            }
+            link.rx_channels[WFB_RX_PORT].reset();
+            link.tun_->stop();
+            link.tun_.reset();
+        }
+    } tun_guard{*this};
+#endif
+
+    if (!build_rx_channels()) {
+        return false;
+    }
+
+    rx_freq = channel_to_freq(channel);
+    // CHANNEL_WIDTH_20, _40, _80...
+    rx_bandwidth = 20 << channelWidthMode;
+
+    auto logger = std::make_shared<Logger>();
+
+    int rc = libusb_init(&ctx);
+    if (rc < 0) {
+        GuiInterface::Instance().PutLog(LogLevel::Error, "Failed to initialize libusb");
+        return false;
+    }
+
+    libusb_set_option(ctx, LIBUSB_OPTION_LOG_LEVEL, LIBUSB_LOG_LEVEL_ERROR);
+
+    // The first adapter receives and transmits, the others only add their copies of the frames.
+    devHandle = open_device(deviceIds[0]);
+    if (devHandle == nullptr) {
         libusb_exit(ctx);
         ctx = nullptr;
-
-        GuiInterface::Instance().PutLog(LogLevel::Error, "Failed to claim interface");
         return false;
     }
 
+    for (size_t i = 1; i < deviceIds.size(); i++) {
+        if (i >= AntennaStats::kMaxAdapters) {
+            GuiInterface::Instance().PutLog(LogLevel::Warn,
+                                            "Using the first {} adapters only",
+                                            AntennaStats::kMaxAdapters);
+            break;
+        }
+
+        libusb_device_handle *handle = open_device(deviceIds[i]);
+        if (handle == nullptr) {
+            // Diversity is a bonus, carry on with the adapters we have.
+            continue;
+        }
+
+        auto adapter = std::make_unique<RxAdapter>();
+        adapter->handle = handle;
+        rx_adapters.push_back(std::move(adapter));
+        GuiInterface::Instance().PutLog(LogLevel::Info,
+                                        "RX adapter {}: {}",
+                                        rx_adapters.size(),
+                                        deviceIds[i].display_name);
+    }
+
 #ifdef __linux__
-    tx_frame = std::make_shared<TxFrame>(tun_enabled);
+    // Remote RX nodes count after the local adapters. Like those, they're a bonus: on failure, carry on without.
+    const size_t local_adapters = rx_adapters.size() + 1;
+    open_forwarder(static_cast<uint8_t>(local_adapters));
+    start_rx_pipeline(local_adapters + (forwarder ? 1 : 0));
+    if (forwarder) {
+        forwarder_thread = std::make_unique<std::thread>([this, local_adapters] { run_forwarder(local_adapters); });
+    }
+
+    tx_frame = std::make_shared<TxFrame>(tun_enabled, tun_ ? &tun_->to_radio() : nullptr);
+#else
+    start_rx_pipeline(rx_adapters.size() + 1);
 #endif
 
     usbThread = std::make_shared<std::thread>([=, this]() {
@@ -317,25 +638,26 @@ bool WfbngLink::start(const DeviceId &deviceId, uint8_t channel, int channelWidt
 
 #endif
 
-            rtlDevice->Init(
-                [](const Packet &p) {
-                    Instance().handle_80211_frame(p);
-                    GuiInterface::Instance().UpdateCount();
-                },
-                SelectedChannel{
-                    .Channel = channel,
-                    .ChannelOffset = 0,
-                    .ChannelWidth = static_cast<ChannelWidth_t>(channelWidthMode),
-                });
+            start_rx_adapters(channel, channelWidthMode);
+
+            rtlDevice->Init([this](const Packet &p) { enqueue_80211_frame(p, 0, RxSource{}); },
+                            SelectedChannel{
+                                .Channel = channel,
+                                .ChannelOffset = 0,
+                                .ChannelWidth = static_cast<ChannelWidth_t>(channelWidthMode),
+                            });
         } catch (const std::runtime_error &e) {
             GuiInterface::Instance().PutLog(LogLevel::Error, e.what());
         } catch (...) {
         }
 
-        auto rc1 = libusb_release_interface(devHandle, 0);
-        if (rc1 < 0) {
-            GuiInterface::Instance().PutLog(LogLevel::Error, "Failed to release interface");
-        }
+        // The link goes down with the primary adapter.
+        stop_rx_adapters();
+#ifdef __linux__
+        stop_forwarder();
+#endif
+
+        stop_rx_pipeline();
 
 #ifdef __linux__
         stop_adaptive_link();
@@ -345,7 +667,7 @@ bool WfbngLink::start(const DeviceId &deviceId, uint8_t channel, int channelWidt
 // destroy_thread(usb_event_thread);
 #endif
 
-        libusb_close(devHandle);
+        close_device(devHandle);
         libusb_exit(ctx);
 
         devHandle = nullptr;
@@ -361,16 +683,181 @@ bool WfbngLink::start(const DeviceId &deviceId, uint8_t channel, int channelWidt
     usbThread->detach();
 
 #ifdef __linux__
-    if (tun_enabled) {
-        tun_ = std::make_unique<Tun>();
-        tun_->init("10.5.0.3", 24, 8001, 8000);
-        tun_->start();
-    }
+    tun_guard.dismissed = true;
 #endif
 
     return true;
 }
 
+#ifdef __linux__
+bool WfbngLink::start_replay(const std::vector<std::string> &captures, const std::string &kPath) {
+    GuiInterface::Instance().ResetCount();
+
+    keyPath = kPath;
+
+    if (usbThread || captures.empty()) {
+        return false;
+    }
+
+    if (captures.size() > AntennaStats::kMaxAdapters) {
+        GuiInterface::Instance().PutLog(LogLevel::Error,
+                                        "Can't replay more than {} captures",
+                                        AntennaStats::kMaxAdapters);
+        return false;
+    }
+
+    try {
+        replay = std::make_shared<PcapReplay>(captures);
+    } catch (const std::runtime_error &e) {
+        GuiInterface::Instance().PutLog(LogLevel::Error, "Cannot replay: {}", e.what());
+        return false;
+    }
+
+    if (!build_rx_channels()) {
+        return false;
+    }
+
+    // Not known, the captures may even be from different channels.
+    rx_freq = 0;
+    rx_bandwidth = 20;
+
+    start_rx_pipeline(replay->size());
+
+    rx_only = true;
+    usbThread = std::make_shared<std::thread>([this] {
+        GuiInterface::Instance().PutLog(LogLevel::Info, "Replaying {} captures", replay->size());
+
+        replay->run(
+            [this](const Packet &p, uint8_t adapter) { enqueue_80211_frame(p, adapter, {.adapter = adapter}); });
+
+        const auto replay_stats = replay->stats();
+        for (size_t i = 0; i < replay_stats.size(); i++) {
+            GuiInterface::Instance().PutLog(LogLevel::Info,
+                                            "Replay adapter {}: {} frames, {} skipped",
+                                            i,
+                                            replay_stats[i].frames,
+                                            replay_stats[i].skipped);
+        }
+
+        stop_rx_pipeline();
+
+        rx_only = false;
+        usbThread.reset();
+
+        GuiInterface::Instance().EmitWifiStopped();
+        playing = false;
+
+        GuiInterface::Instance().PutLog(LogLevel::Info, "Replay stopped");
+    });
+    usbThread->detach();
+
+    return true;
+}
+
+void WfbngLink::set_forwarder_ports(const std::vector<ForwarderIngest::Port> &ports) {
+    forwarder_ports = ports;
+}
+
+bool WfbngLink::open_forwarder(uint8_t first_adapter) {
+    if (forwarder_ports.empty()) {
+        return false;
+    }
+
+    try {
+        forwarder = std::make_unique<ForwarderIngest>(forwarder_ports, link_id, first_adapter);
+    } catch (const std::runtime_error &e) {
+        GuiInterface::Instance().PutLog(LogLevel::Error, "Cannot take forwarded frames: {}", e.what());
+        return false;
+    }
+
+    for (const auto &port : forwarder_ports) {
+        GuiInterface::Instance().PutLog(LogLevel::Info,
+                                        "Taking forwarded frames of radio port {} on UDP port {}",
+                                        port.radio_port,
+                                        port.udp_port);
+    }
+    return true;
+}
+
+void WfbngLink::run_forwarder(size_t producer) {
+    try {
+        // Adapters past AntennaStats::kMaxAdapters still count for aggregation, just not in the stats.
+        forwarder->run([this, producer](const Packet &p, const RxSource &source) {
+            enqueue_80211_frame(p, producer, source);
+        });
+    } catch (const std::runtime_error &e) {
+        GuiInterface::Instance().PutLog(LogLevel::Error, "Forwarded frames: {}", e.what());
+    }
+}
+
+void WfbngLink::stop_forwarder() {
+    if (!forwarder) {
+        return;
+    }
+
+    forwarder->stop();
+    if (forwarder_thread && forwarder_thread->joinable()) {
+        forwarder_thread->join();
+    }
+    forwarder_thread.reset();
+
+    const auto stats = forwarder->stats();
+    GuiInterface::Instance().PutLog(LogLevel::Info,
+                                    "Forwarded frames: {} datagrams in {} batches, {} malformed, {} remote adapters",
+                                    stats.datagrams,
+                                    stats.batches,
+                                    stats.malformed,
+                                    stats.sources);
+
+    forwarder.reset();
+}
+
+bool WfbngLink::start_forwarded(const std::string &kPath) {
+    GuiInterface::Instance().ResetCount();
+
+    keyPath = kPath;
+
+    if (usbThread) {
+        return false;
+    }
+
+    if (!build_rx_channels()) {
+        return false;
+    }
+
+    if (!open_forwarder(0)) {
+        return false;
+    }
+
+    // Each node reports its own, see handle_80211_frame().
+    rx_freq = 0;
+    rx_bandwidth = 20;
+
+    start_rx_pipeline(1);
+
+    rx_only = true;
+    usbThread = std::make_shared<std::thread>([this] {
+        GuiInterface::Instance().PutLog(LogLevel::Info, "Receiving through remote RX nodes only");
+
+        run_forwarder(0);
+
+        stop_forwarder();
+        stop_rx_pipeline();
+
+        rx_only = false;
+        usbThread.reset();
+
+        GuiInterface::Instance().EmitWifiStopped();
+        playing = false;
+
+        GuiInterface::Instance().PutLog(LogLevel::Info, "Forwarded reception stopped");
+    });
+    usbThread->detach();
+
+    return true;
+}
+#endif
+
 #ifdef __linux__
 
 void WfbngLink::start_link_quality_thread() {
@@ -417,15 +904,21 @@ void WfbngLink::start_link_quality_thread() {
             return outputMin + ((value - inputMin) * (outputMax - outputMin) / (inputMax - inputMin));
         };
 
-        while (!this->alink_should_stop) {
-            auto quality = SignalQualityCalculator::get_instance().calculate_signal_quality();
+        alink_trigger.reset();
 
-            if (quality.total_last_second != 0) {
-                GuiInterface::Instance().packet_loss_ =
-                    std::round((float)quality.lost_last_second / quality.total_last_second * 1000.0f) / 10.0f;
-            } else {
-                GuiInterface::Instance().packet_loss_ = 100;
-            }
+        // A new keyframe request goes out with the next message instead of waiting for the heartbeat.
+        KeyframeRequester::get_instance().reset();
+        KeyframeRequester::get_instance().set_on_request([this] { alink_trigger.request(); });
+
+        uint64_t fec_policy_samples = 0;
+        uint64_t threshold_lvl_sum = 0;
+        uint64_t burst_lvl_sum = 0;
+
+        // Sent every 100 ms, or earlier when alink_trigger fires.
+        bool triggered = false;
+
+        while (!this->alink_should_stop) {
+            auto quality = SignalQualityCalculator::get_instance().get_snapshot();
 
             time_t currentEpoch = time(nullptr);
 
@@ -456,43 +949,44 @@ void WfbngLink::start_link_quality_thread() {
                    packets)
                  */
 
-                // Change FEC
-                if (quality.lost_last_second > 2)
-                    fec_controller.bump(5);
-                else {
-                    if (quality.recovered_last_second > 30) {
-                        fec_controller.bump(5);
-                    }
-                    if (quality.recovered_last_second > 24) {
-                        fec_controller.bump(3);
-                    }
-                    if (quality.recovered_last_second > 22) {
-                        fec_controller.bump(2);
-                    }
-                    if (quality.recovered_last_second > 18) {
-                        fec_controller.bump(1);
-                    }
-                    if (quality.recovered_last_second < 18) {
-                        fec_controller.bump(0);
-                    }
-                }
+                // Change FEC. Both policies are evaluated so they can be compared, only the selected one is used.
+                const int current_fec_lvl = fec_controller.value();
+                const int threshold_lvl = threshold_fec_policy.required_level(quality, current_fec_lvl);
+                const int burst_lvl = burst_fec_policy.required_level(quality, current_fec_lvl);
+                fec_controller.bump(use_burst_fec_policy ? burst_lvl : threshold_lvl);
+
+                fec_policy_samples++;
+                threshold_lvl_sum += threshold_lvl;
+                burst_lvl_sum += burst_lvl;
 
                 const int fec_lvl = fec_controller.value();
                 GuiInterface::Instance().drone_fec_level_ = fec_lvl;
 
+                const auto idr_code = KeyframeRequester::get_instance().code();
+
+                // The OSD fields come from the best antenna
+                int best_rssi = 0;
+                float best_snr = quality.snr;
+                const auto antennas = get_antenna_stats();
+                if (antennas.best >= 0) {
+                    best_rssi = static_cast<int>(std::lround(antennas.antennas[antennas.best].rssi_recent));
+                    best_snr = antennas.antennas[antennas.best].snr_recent;
+                }
+
                 // Prepare the TX message
                 snprintf(message + sizeof(len),
                          sizeof(message) - sizeof(len),
-                         "%ld:%d:%d:%d:%d:%d:%f:0:-1:%d:%s\n",
+                         "%ld:%d:%d:%d:%d:%d:%f:%d:-1:%d:%s\n",
                          static_cast<long>(currentEpoch),
                          quality.quality,
                          quality.quality,
                          quality.recovered_last_second,
                          quality.lost_last_second,
-                         quality.quality,
-                         quality.snr,
+                         best_rssi,
+                         best_snr,
+                         antennas.active_antennas,
                          fec_lvl,
-                         quality.idr_code.c_str());
+                         idr_code.data());
 
                 len = strlen(message + sizeof(len));
 
@@ -513,11 +1007,55 @@ void WfbngLink::start_link_quality_thread() {
                     break;
                 }
             }
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+            alink_trigger.on_sent(triggered);
+
+            triggered = alink_trigger.wait_for(std::chrono::milliseconds(100));
         }
 
         close(sock_fd);
         this->alink_should_stop = false;
+
+        KeyframeRequester::get_instance().set_on_request({});
+
+        const auto stats = alink_trigger.stats();
+        GuiInterface::Instance().PutLog(LogLevel::Info,
+                                        "Alink sent {} periodic, {} triggered, loss to feedback avg {:.1f} ms, "
+                                        "max {:.1f} ms",
+                                        stats.periodic_sends,
+                                        stats.triggered_sends,
+                                        stats.avg_loss_to_send_ms,
+                                        stats.max_loss_to_send_ms);
+
+        const auto kf_stats = KeyframeRequester::get_instance().stats();
+        GuiInterface::Instance().PutLog(LogLevel::Info,
+                                        "Keyframe requests {} (loss {}, RTP gap {}, incomplete AU {}, decode error {}, "
+                                        "corrupt frame {}), {} debounced, {} answered in avg {:.1f} ms, max {:.1f} ms",
+                                        kf_stats.requests,
+                                        kf_stats.requests_by_reason[(size_t)KeyframeReason::PacketLoss],
+                                        kf_stats.requests_by_reason[(size_t)KeyframeReason::RtpGap],
+                                        kf_stats.requests_by_reason[(size_t)KeyframeReason::IncompleteAccessUnit],
+                                        kf_stats.requests_by_reason[(size_t)KeyframeReason::DecodeError],
+                                        kf_stats.requests_by_reason[(size_t)KeyframeReason::CorruptFrame],
+                                        kf_stats.debounced,
+                                        kf_stats.answered,
+                                        kf_stats.avg_request_to_keyframe_ms,
+                                        kf_stats.max_request_to_keyframe_ms);
+
+        if (fec_policy_samples > 0) {
+            const auto model = burst_fec_policy.model();
+            GuiInterface::Instance().PutLog(LogLevel::Info,
+                                            "FEC policy {}: average level threshold {:.2f}, burst {:.2f} "
+                                            "(P(good->bad) {:.4f}, P(bad->good) {:.4f}, k {}, n {})",
+                                            use_burst_fec_policy ? burst_fec_policy.name()
+                                                                 : threshold_fec_policy.name(),
+                                            (double)threshold_lvl_sum / fec_policy_samples,
+                                            (double)burst_lvl_sum / fec_policy_samples,
+                                            model.p_gb,
+                                            model.p_bg,
+                                            model.k,
+                                            model.n);
+        }
     };
 
     init_thread(link_quality_thread, [=]() { return std::make_unique<std::thread>(thread_func); });
@@ -535,6 +1073,7 @@ void WfbngLink::stop_adaptive_link() {
     }
 
     alink_should_stop = true;
+    alink_trigger.wake();
     destroy_thread(link_quality_thread);
 
     GuiInterface::Instance().PutLog(LogLevel::Info, "Alink thread stopped");
@@ -542,131 +1081,227 @@ void WfbngLink::stop_adaptive_link() {
 
 #endif
 
-void WfbngLink::handle_80211_frame(const Packet &packet) {
-    GuiInterface::Instance().wifiFrameCount_++;
-    GuiInterface::Instance().UpdateCount();
-
-    const RxFrame frame(packet.Data);
-    if (!frame.IsValidWfbFrame()) {
-        return;
+void WfbngLink::enqueue_80211_frame(const Packet &packet, size_t producer, const RxSource &source) {
+    // Just enough parsing to pick the worker, see RxFrame::MacSrcRadioPort().
+    size_t worker = 0;
+    if (packet.Data.size() > 15) {
+        if (const RxChannel *channel = rx_channels[packet.Data[15]].get()) {
+            worker = channel->worker;
+        }
     }
 
-    GuiInterface::Instance().wfbngFrameCount_++;
-    GuiInterface::Instance().UpdateCount();
-
-    static uint32_t link_id = 7669206; // sha1 hash of link_domain="default"
-    static uint8_t video_radio_port = 0;
-    static uint64_t epoch = 0;
-
-    static uint32_t video_channel_id_f = (link_id << 8) + video_radio_port;
-    static uint32_t video_channel_id_be = htobe32(video_channel_id_f);
+    rx_pipeline->push(packet, producer, worker, source);
+}
 
-    static auto *video_channel_id_be8 = reinterpret_cast<uint8_t *>(&video_channel_id_be);
+void WfbngLink::tick_rx_channels(size_t worker) {
+    // The signal quality samples are added on the video channel's worker, so the snapshot is refreshed there too.
+    const RxChannel *video_channel = rx_channels[VIDEO_RADIO_PORT].get();
+    if (video_channel && video_channel->worker == worker &&
+        SignalQualityCalculator::get_instance().update_snapshot()) {
+        const auto quality = SignalQualityCalculator::get_instance().get_snapshot();
+        GuiInterface::Instance().link_quality_ = map_range(quality.quality, -1024, 1024, 0, 100);
 
-    int mavlink_client_port = 14550;
-    uint8_t mavlink_radio_port = 0x10;
-    uint32_t mavlink_channel_id_f = (link_id << 8) + mavlink_radio_port;
-    static uint32_t mavlink_channel_id_be = htobe32(mavlink_channel_id_f);
-    auto *mavlink_channel_id_be8 = reinterpret_cast<uint8_t *>(&mavlink_channel_id_be);
+        const auto fec = SignalQualityCalculator::get_instance().get_fec_totals(HUD_PACKET_LOSS_WINDOW);
+        if (fec.all != 0) {
+            GuiInterface::Instance().packet_loss_ = std::round((float)fec.lost / fec.all * 1000.0f) / 10.0f;
+        } else {
+            GuiInterface::Instance().packet_loss_ = 100;
+        }
+    }
 
-    int udp_client_port = 8000;
-    uint8_t udp_radio_port = WFB_RX_PORT;
-    uint32_t udp_channel_id_f = (link_id << 8) + udp_radio_port;
-    static uint32_t udp_channel_id_be = htobe32(udp_channel_id_f);
-    auto *udp_channel_id_be8 = reinterpret_cast<uint8_t *>(&udp_channel_id_be);
+#ifdef __linux__
+    for (size_t port = 0; port < rx_channels.size(); port++) {
+        RxChannel *channel = rx_channels[port].get();
+        if (channel && channel->worker == worker) {
+            std::lock_guard lock(channel->mutex);
+            channel->aggregator->flush_expired();
+            // Once per tick, not per packet: the counters only feed windows of 10 ms buckets anyway.
+            roll_rx_channel_stats(*channel, port == VIDEO_RADIO_PORT);
+        }
+    }
+#endif
+}
 
-    std::string client_addr = "127.0.0.1";
+#ifdef __linux__
+void WfbngLink::roll_rx_channel_stats(RxChannel &channel, bool is_video) {
+    rx_stats_t stats;
+    channel.aggregator->roll_stats(stats);
+    channel.blocks_completed += stats.count_blk_completed;
+    channel.blocks_flushed += stats.count_blk_deadline;
+
+    const bool changed = stats.count_p_all || stats.count_p_fec_recovered || stats.count_p_lost;
+    if (is_video && changed) {
+        // The calculator sums up what it's given over its window, so pass on what changed since the last call
+        SignalQualityCalculator::get_instance().add_fec_data(stats.count_p_all,
+                                                             stats.count_p_fec_recovered,
+                                                             stats.count_p_lost);
+
+        // A triggered alink message must carry these, so refresh the snapshot before waking the sender. Otherwise
+        // the tick's regular refresh is soon enough.
+        alink_trigger.report(stats.count_p_lost, stats.count_p_fec_recovered, [] {
+            SignalQualityCalculator::get_instance().update_snapshot(std::chrono::milliseconds(0));
+        });
+
+        if (stats.count_p_lost) {
+            KeyframeRequester::get_instance().report(KeyframeReason::PacketLoss);
+        }
+    }
+}
+#endif
 
+AntennaStats::Snapshot WfbngLink::get_antenna_stats() const {
 #ifdef __linux__
-    static std::unique_ptr<AggregatorX> video_aggregator =
-        std::make_unique<AggregatorX>(client_addr,
-                                      GuiInterface::Instance().playerPort,
-                                      keyPath.c_str(),
-                                      epoch,
-                                      video_channel_id_f,
-                                      0);
-
-    static std::unique_ptr<AggregatorX> udp_aggregator =
-        std::make_unique<AggregatorX>(client_addr, udp_client_port, keyPath, epoch, udp_channel_id_f, 0);
+    return antenna_stats.snapshot(get_time_ms());
 #else
-    static std::unique_ptr<Aggregator> video_aggregator = std::make_unique<Aggregator>(
-        keyPath.c_str(),
-        epoch,
-        video_channel_id_f,
-        [](uint8_t *payload, uint16_t packet_size) { Instance().handle_rtp(payload, packet_size); });
+    // Only the Linux aggregator feeds them.
+    return {};
 #endif
+}
+
+std::vector<RxPipeline::WorkerStats> WfbngLink::get_rx_pipeline_stats() const {
+    if (!rx_pipeline) {
+        return {};
+    }
+    return rx_pipeline->stats();
+}
+
+void WfbngLink::handle_80211_frame(const Packet &packet, const RxSource &source) {
+    GuiInterface::Instance().wifiFrameCount_.fetch_add(1, std::memory_order_relaxed);
+
+    const RxFrame frame(packet.Data);
+    if (!frame.IsValidWfbFrame()) {
+        return;
+    }
 
-    static int8_t rssi[2] = {1, 1};
-    static uint8_t antenna[4] = {1, 1, 1, 1};
-    uint32_t freq = 0;
-    int8_t noise[4] = {1, 1, 1, 1};
+    GuiInterface::Instance().wfbngFrameCount_.fetch_add(1, std::memory_order_relaxed);
 
-    // The aggregator is static, so we need a mutex to modify it
-    // Considering to make it non-static
-    static std::mutex agg_mutex;
-    std::lock_guard lock(agg_mutex);
+    const auto channel_id = frame.GetChannelId();
+    if (!channel_id || (*channel_id >> 8) != link_id) {
+        return;
+    }
+    const uint8_t radio_port = *channel_id & 0xff;
+
+    // MAVLink isn't handled, and neither is the tunnel unless it's enabled.
+    RxChannel *channel = rx_channels[radio_port].get();
+    if (!channel) {
+        return;
+    }
 
-    // Video frame
-    if (frame.MatchesChannelID(video_channel_id_be8)) {
+    const bool is_video = radio_port == VIDEO_RADIO_PORT;
+
+    // Per RF path in the aggregator's layout: antenna index (0xff ends the list), RSSI in dBm and noise as RSSI - SNR.
+    // A path the adapter doesn't have reads RSSI 0.
+    uint8_t antenna[RX_ANT_MAX];
+    int8_t rssi[RX_ANT_MAX];
+    int8_t noise[RX_ANT_MAX];
+    size_t paths = 0;
+    for (uint8_t path = 0; path < std::size(packet.RxAtrib.rssi) && paths < RX_ANT_MAX; path++) {
+        if (packet.RxAtrib.rssi[path] == 0) {
+            continue;
+        }
+        antenna[paths] = path;
+        rssi[paths] = rssi_percent_to_dbm(packet.RxAtrib.rssi[path]);
+        noise[paths] = static_cast<int8_t>(rssi[paths] - packet.RxAtrib.snr[path]);
+        paths++;
+    }
+    std::fill(antenna + paths, antenna + RX_ANT_MAX, 0xff);
+
+    if (is_video) {
         // Update signal quality
         SignalQualityCalculator::get_instance().add_rssi(packet.RxAtrib.rssi[0], packet.RxAtrib.rssi[1]);
         SignalQualityCalculator::get_instance().add_snr(packet.RxAtrib.snr[0], packet.RxAtrib.snr[1]);
+    }
+
+    {
+        std::lock_guard lock(channel->mutex);
 
 #ifdef __linux__
-        video_aggregator->process_packet(packet.Data.data() + sizeof(ieee80211_header),
-                                         packet.Data.size() - sizeof(ieee80211_header) - 4,
-                                         0,
-                                         antenna,
-                                         rssi,
-                                         noise,
-                                         freq,
-                                         0,
-                                         0,
-                                         NULL);
-
-        SignalQualityCalculator::get_instance().add_fec_data(video_aggregator->count_p_all,
-                                                             video_aggregator->count_p_fec_recovered,
-                                                             video_aggregator->count_p_lost);
+        // A remote RX node's antennas are told apart by its address, see Aggregator::log_rssi().
+        sockaddr_in remote{};
+        remote.sin_family = AF_INET;
+        remote.sin_addr.s_addr = source.remote_addr;
+
+        channel->aggregator->process_packet(packet.Data.data() + sizeof(ieee80211_header),
+                                            packet.Data.size() - sizeof(ieee80211_header) - 4,
+                                            source.adapter,
+                                            antenna,
+                                            rssi,
+                                            noise,
+                                            source.freq ? source.freq : rx_freq,
+                                            0,
+                                            source.bandwidth ? source.bandwidth : rx_bandwidth,
+                                            source.remote_addr ? &remote : NULL);
 #else
-        video_aggregator->process_packet(packet.Data.data() + sizeof(ieee80211_header),
-                                         packet.Data.size() - sizeof(ieee80211_header) - 4,
-                                         0,
-                                         antenna,
-                                         rssi);
+        channel->aggregator->process_packet(packet.Data.data() + sizeof(ieee80211_header),
+                                            packet.Data.size() - sizeof(ieee80211_header) - 4,
+                                            source.adapter,
+                                            antenna,
+                                            rssi);
 #endif
-
-        const auto quality = SignalQualityCalculator::get_instance().calculate_signal_quality();
-        GuiInterface::Instance().link_quality_ = map_range(quality.quality, -1024, 1024, 0, 100);
     }
-    // MAVLink frame
-    else if (frame.MatchesChannelID(mavlink_channel_id_be8)) {
-        // GuiInterface::Instance().PutLog(LogLevel::Warn, "Received a MAVLink frame, but we're unable to handle it!");
+}
+
+bool WfbngLink::build_rx_channels() {
+    constexpr uint64_t epoch = 0;
+
+    for (auto &channel : rx_channels) {
+        channel.reset();
     }
-    // UDP frame
-    else if (frame.MatchesChannelID(udp_channel_id_be8)) {
-        // GuiInterface::Instance().PutLog(LogLevel::Warn, "Received a UDP frame, but we're unable to handle it!");
 
+    // Every channel gets its own RX worker.
+    size_t next_worker = 0;
+
+    const auto add_channel = [&](uint8_t radio_port, std::unique_ptr<Aggregator> aggregator) {
+        auto channel = std::make_unique<RxChannel>();
+        channel->aggregator = std::move(aggregator);
+        channel->worker = next_worker++;
+        rx_channels[radio_port] = std::move(channel);
+    };
+
+    try {
 #ifdef __linux__
-        if (tun_enabled) {
-            udp_aggregator->process_packet(packet.Data.data() + sizeof(ieee80211_header),
-                                           packet.Data.size() - sizeof(ieee80211_header) - 4,
-                                           0,
-                                           antenna,
-                                           rssi,
-                                           noise,
-                                           freq,
-                                           0,
-                                           0,
-                                           NULL);
+        const std::string client_addr = "127.0.0.1";
+
+        auto video_aggregator = std::make_unique<AggregatorX>(client_addr,
+                                                              GuiInterface::Instance().playerPort,
+                                                              keyPath,
+                                                              epoch,
+                                                              (link_id << 8) + VIDEO_RADIO_PORT,
+                                                              0);
+        video_aggregator->set_video(true);
+        video_aggregator->set_latency_budget(VIDEO_RX_LATENCY_BUDGET_MS);
+        video_aggregator->set_block_deadline(VIDEO_RX_BLOCK_DEADLINE_MS);
+        video_aggregator->set_fec_policy(&burst_fec_policy);
+        video_aggregator->set_antenna_stats(&antenna_stats);
+        SignalQualityCalculator::get_instance().set_antenna_stats(&antenna_stats);
+        add_channel(VIDEO_RADIO_PORT, std::move(video_aggregator));
+
+        if (tun_enabled && tun_) {
+            add_channel(WFB_RX_PORT,
+                        std::make_unique<AggregatorTun>(keyPath,
+                                                        epoch,
+                                                        (link_id << 8) + WFB_RX_PORT,
+                                                        tun_->from_radio()));
         }
+#else
+        add_channel(VIDEO_RADIO_PORT,
+                    std::make_unique<Aggregator>(
+                        keyPath,
+                        epoch,
+                        (link_id << 8) + VIDEO_RADIO_PORT,
+                        [](uint8_t *payload, uint16_t packet_size) { Instance().handle_rtp(payload, packet_size); }));
 #endif
+    } catch (const std::runtime_error &e) {
+        GuiInterface::Instance().PutLog(LogLevel::Error, "Failed to create aggregators: {}", e.what());
+        return false;
     }
+
+    return true;
 }
 
 #ifdef _WIN32
 void WfbngLink::handle_rtp(uint8_t *payload, uint16_t packet_size) {
-    GuiInterface::Instance().rtpPktCount_++;
-    GuiInterface::Instance().UpdateCount();
+    GuiInterface::Instance().rtpPktCount_.fetch_add(1, std::memory_order_relaxed);
 
     if (rtlDevice->should_stop) {
         return;
@@ -690,10 +1325,20 @@ void WfbngLink::handle_rtp(uint8_t *payload, uint16_t packet_size) {
         } else {
             GuiInterface::Instance().playerCodec = "H265";
         }
-        GuiInterface::Instance().NotifyRtpStream(header->pt,
-                                                 ntohl(header->ssrc),
-                                                 GuiInterface::Instance().playerPort,
-                                                 GuiInterface::Instance().playerCodec);
+        if (GuiInterface::Instance().use_gstreamer_) {
+            GuiInterface::Instance().NotifyRtpStream(header->pt,
+                                                     ntohl(header->ssrc),
+                                                     GuiInterface::Instance().playerPort,
+                                                     GuiInterface::Instance().playerCodec);
+        } else {
+            GuiInterface::Instance().NotifyRtpRingStream(GuiInterface::Instance().playerCodec);
+        }
+    }
+
+    // The FFmpeg player takes packets straight from memory.
+    if (!GuiInterface::Instance().use_gstreamer_) {
+        GuiInterface::Instance().rtpRing_.push(payload, packet_size);
+        return;
     }
 
     // Send payload via socket.
@@ -711,6 +1356,12 @@ void WfbngLink::stop() const {
         rtlDevice->should_stop = true;
     }
 #ifdef __linux__
+    if (replay) {
+        replay->stop();
+    }
+    if (forwarder) {
+        forwarder->stop();
+    }
     if (tun_) {
         tun_->stop();
     }
@@ -725,6 +1376,21 @@ bool WfbngLink::get_alink_enabled() const {
 #endif
 }
 
+std::string WfbngLink::get_fec_policy() const {
+#ifdef __linux__
+    return use_burst_fec_policy ? burst_fec_policy.name() : threshold_fec_policy.name();
+#else
+    return "";
+#endif
+}
+
+void WfbngLink::set_fec_policy(const std::string &name) {
+#ifdef __linux__
+    use_burst_fec_policy = name == burst_fec_policy.name();
+    GuiInterface::Instance().PutLog(LogLevel::Info, "Alink FEC policy: {}", get_fec_policy());
+#endif
+}
+
 int WfbngLink::get_alink_tx_power() const {
 #ifdef __linux__
     return alink_tx_power;
@@ -741,9 +1407,12 @@ void WfbngLink::enable_alink(bool enable) {
 
     alink_enabled = enable;
     alink_should_stop = !enable;
+    if (alink_should_stop) {
+        alink_trigger.wake();
+    }
 
-    // Enable alink during playing.
-    if (alink_enabled && usbThread) {
+    // Enable alink during playing, if there is an adapter to send with.
+    if (alink_enabled && usbThread && !rx_only) {
         if (link_quality_thread && link_quality_thread->joinable()) {
             link_quality_thread->join();
             link_quality_thread = nullptr;
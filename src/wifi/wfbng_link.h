@@ -1,23 +1,35 @@
-#pragma once
+﻿#pragma once
 
 #ifdef _WIN32
     #include <libusb.h>
 #else
     #include <libusb-1.0/libusb.h>
 #endif
+#include <array>
+#include <atomic>
 #include <mutex>
 #include <string>
 #include <thread>
 #include <vector>
 
 #include "Rtl8812aDevice.h"
+#include "alink_trigger.h"
+#include "antenna_stats.h"
 #include "fec_controller.h"
+#include "fec_policy.h"
+#include "rx_pipeline.h"
 
 #ifdef __linux__
+    #include "linux/forwarder_ingest.h"
     #include "linux/tun.h"
     #include "linux/tx_frame.h"
 #endif
 
+class Aggregator;
+#ifdef __linux__
+class PcapReplay;
+#endif
+
 struct DeviceId {
     uint16_t vendor_id;
     uint16_t product_id;
@@ -39,7 +51,22 @@ public:
 
     static std::vector<DeviceId> get_device_list();
 
-    bool start(const DeviceId &deviceId, uint8_t channel, int channelWidth, const std::string &keyPath);
+    /// Receive with all `deviceIds` at once for diversity. The first one also transmits (alink, tunnel).
+    bool start(const std::vector<DeviceId> &deviceIds,
+               uint8_t channel,
+               int channelWidth,
+               const std::string &keyPath);
+
+#ifdef __linux__
+    /// Play back radiotap captures instead of receiving, each one standing in for an adapter. See PcapReplay.
+    bool start_replay(const std::vector<std::string> &captures, const std::string &keyPath);
+
+    /// Take frames from remote RX nodes on these ports in the next session, next to the local adapters.
+    void set_forwarder_ports(const std::vector<ForwarderIngest::Port> &ports);
+
+    /// Receive through remote RX nodes only, on the ports given to set_forwarder_ports().
+    bool start_forwarded(const std::string &keyPath);
+#endif
 
     void stop() const;
 
@@ -47,12 +74,24 @@ public:
 
     void enable_alink(bool enable);
 
+    /// "threshold" or "burst", see FecPolicy.
+    std::string get_fec_policy() const;
+
+    void set_fec_policy(const std::string &name);
+
     int get_alink_tx_power() const;
 
     void set_alink_tx_power(int tx_power);
 
-    /// Process a 802.11 frame.
-    void handle_80211_frame(const Packet &packet);
+    /// Process a 802.11 frame received by a local adapter (0 is the primary one) or a remote RX node. Runs on the RX
+    /// pipeline workers.
+    void handle_80211_frame(const Packet &packet, const RxSource &source);
+
+    /// Signal levels per adapter and antenna and per-adapter loss of the video channel, since the link started.
+    AntennaStats::Snapshot get_antenna_stats() const;
+
+    /// Queue depth and latency of the RX pipeline stages, one entry per worker.
+    std::vector<RxPipeline::WorkerStats> get_rx_pipeline_stats() const;
 
 #ifdef _WIN32
     /// Send a RTP payload via socket.
@@ -63,16 +102,106 @@ protected:
     libusb_context *ctx{};
     libusb_device_handle *devHandle{};
 
+    /// Session thread, running the primary adapter or a replay
     std::shared_ptr<std::thread> usbThread;
     std::unique_ptr<Rtl8812aDevice> rtlDevice;
 
+    /// Additional receive-only adapter, started and stopped by the primary adapter's thread
+    struct RxAdapter {
+        libusb_device_handle *handle = nullptr;
+        std::unique_ptr<Rtl8812aDevice> device;
+        std::thread thread;
+    };
+
+    /// Adapters 1.. in the order given to start()
+    std::vector<std::unique_ptr<RxAdapter>> rx_adapters;
+
+    /// Find, open and claim a device. Logs and returns nullptr on failure.
+    libusb_device_handle *open_device(const DeviceId &deviceId);
+
+    static void close_device(libusb_device_handle *handle);
+
+    /// Primary adapter's thread: bring up the rx_adapters, each on its own thread.
+    void start_rx_adapters(uint8_t channel, int channelWidthMode);
+
+    /// Primary adapter's thread: stop, join and close the rx_adapters.
+    void stop_rx_adapters();
+
+#ifdef __linux__
+    std::shared_ptr<PcapReplay> replay;
+
+    std::vector<ForwarderIngest::Port> forwarder_ports;
+    std::unique_ptr<ForwarderIngest> forwarder;
+    /// Runs the forwarder next to local adapters. Without them, the session thread does.
+    std::unique_ptr<std::thread> forwarder_thread;
+
+    /// Bind the forwarder ports, if any. Logs and returns false on failure.
+    bool open_forwarder(uint8_t first_adapter);
+
+    /// Feed forwarded frames to the RX pipeline as `producer` until stop().
+    void run_forwarder(size_t producer);
+
+    /// Stop and join the forwarder, log its stats.
+    void stop_forwarder();
+
+    /// No local adapter in this session (replay or remote RX nodes only), so nothing to transmit with
+    std::atomic<bool> rx_only{false};
+#endif
+
     std::string keyPath;
 
+    uint32_t link_id{7669206}; // sha1 hash of link_domain="default"
+
+    /// A wfb-ng channel we receive, with its own aggregator.
+    struct RxChannel {
+        /// Only packets of the same channel wait for each other.
+        std::mutex mutex;
+        std::unique_ptr<Aggregator> aggregator;
+        /// RX pipeline worker that handles this channel. Keeping a channel on one worker keeps its
+        /// packets in order and its RTP output single-producer.
+        size_t worker = 0;
+
+        // Block totals of the session, guarded by `mutex`
+        uint64_t blocks_completed = 0;
+        uint64_t blocks_flushed = 0;
+    };
+
+    /// Indexed by radio port. Built by start() for the current key, link ID and player port.
+    std::array<std::unique_ptr<RxChannel>, 256> rx_channels;
+
+    bool build_rx_channels();
+
+    /// Created by start(), kept after the session ends so its stats can still be read.
+    std::unique_ptr<RxPipeline> rx_pipeline;
+
+    /// Create the RX pipeline with `num_producers` threads feeding it, one per adapter and one for forwarded frames.
+    void start_rx_pipeline(size_t num_producers);
+
+    /// Stop the RX pipeline and log the session's RX stats.
+    void stop_rx_pipeline();
+
+    /// Fed by the video aggregator, reset by start()
+    AntennaStats antenna_stats;
+
+    // Radio settings of the session, passed on with every frame
+    uint16_t rx_freq = 0;
+    uint8_t rx_bandwidth = 20;
+
+    /// USB, replay or forwarder thread `producer`: hand a received frame over to the RX pipeline.
+    void enqueue_80211_frame(const Packet &packet, size_t producer, const RxSource &source);
+
+    /// RX worker timer: flush FEC blocks past their deadline and collect the channels' counters.
+    void tick_rx_channels(size_t worker);
+
+#ifdef __linux__
+    /// Collect a channel's aggregator counters. The channel's mutex must be held.
+    void roll_rx_channel_stats(RxChannel &channel, bool is_video);
+#endif
+
 #ifdef __linux__
     // Adaptive link
     std::unique_ptr<std::thread> usb_event_thread;
     std::unique_ptr<std::thread> usb_tx_thread;
-    uint32_t link_id{7669206};
     std::recursive_mutex thread_mutex;
     std::shared_ptr<TxFrame> tx_frame;
     bool alink_enabled = true;
@@ -80,6 +209,12 @@ protected:
     int alink_tx_power = 30;
     std::unique_ptr<std::thread> link_quality_thread;
     FecController fec_controller;
+    /// Both FEC policies run so they can be compared, the flag picks the one that is sent.
+    ThresholdFecPolicy threshold_fec_policy;
+    BurstFecPolicy burst_fec_policy;
+    std::atomic<bool> use_burst_fec_policy{false};
+    /// Sends the alink message early on a loss burst
+    AlinkTrigger alink_trigger;
 
     // TUN
     bool tun_enabled = false;
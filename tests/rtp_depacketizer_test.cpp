@@ -0,0 +1,144 @@
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <vector>
+
+#include "rtp_depacketizer.h"
+
+#define CHECK(cond)                                                                                                    \
+    do {                                                                                                               \
+        if (!(cond)) {                                                                                                 \
+            fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond);                                   \
+            exit(1);                                                                                                   \
+        }                                                                                                              \
+    } while (0)
+
+namespace {
+
+std::vector<uint8_t> MakeRtp(uint16_t seq, uint32_t timestamp, bool marker, const std::vector<uint8_t> &payload) {
+    std::vector<uint8_t> packet = {
+        0x80,
+        static_cast<uint8_t>(96 | (marker ? 0x80 : 0)),
+        static_cast<uint8_t>(seq >> 8),
+        static_cast<uint8_t>(seq),
+        static_cast<uint8_t>(timestamp >> 24),
+        static_cast<uint8_t>(timestamp >> 16),
+        static_cast<uint8_t>(timestamp >> 8),
+        static_cast<uint8_t>(timestamp),
+        0,
+        0,
+        0,
+        1,
+    };
+    packet.insert(packet.end(), payload.begin(), payload.end());
+    return packet;
+}
+
+struct Unit {
+    RtpDepacketizer::AccessUnitInfo info;
+    std::vector<uint8_t> data;
+};
+
+/// Feeds packets and records what reaches the callback. The callback throws for the units listed in throwAt.
+struct Harness {
+    RtpDepacketizer depacketizer{RtpDepacketizer::Codec::H264};
+    std::vector<Unit> units;
+    std::vector<int64_t> throwAt;
+    int thrown = 0;
+
+    Harness() {
+        depacketizer.onAccessUnit = [this](AVPacket *packet, const RtpDepacketizer::AccessUnitInfo &info) {
+            units.push_back({info, std::vector<uint8_t>(packet->data, packet->data + packet->size)});
+            for (auto timestamp : throwAt) {
+                if (timestamp == info.timestamp) {
+                    throw std::runtime_error("decoder rejected the access unit");
+                }
+            }
+        };
+    }
+
+    /// True if Push() threw.
+    bool Push(uint16_t seq, uint32_t timestamp, bool marker, const std::vector<uint8_t> &payload) {
+        const auto packet = MakeRtp(seq, timestamp, marker, payload);
+        try {
+            depacketizer.Push(packet.data(), packet.size());
+        } catch (const std::runtime_error &) {
+            thrown++;
+            return true;
+        }
+        return false;
+    }
+};
+
+/// The unit closed by a timestamp change throws. The packet that closed it still starts the next unit.
+void TestThrowOnTimestampChange() {
+    Harness h;
+    h.throwAt = {1000};
+
+    // Unit 1000 without its marker, so the next timestamp closes it.
+    CHECK(!h.Push(1, 1000, false, {0x65, 1, 2}));
+    CHECK(h.Push(2, 4000, false, {0x1C, 0x81, 3}));
+    CHECK(!h.Push(3, 4000, true, {0x1C, 0x41, 4}));
+    CHECK(!h.Push(4, 7000, true, {0x41, 5}));
+
+    CHECK(h.thrown == 1);
+    CHECK(h.units.size() == 3);
+
+    CHECK(h.units[0].info.timestamp == 1000);
+    CHECK(h.units[0].info.missingMarker);
+
+    // Both fragments of the NAL unit, nothing reported missing.
+    const Unit &unit = h.units[1];
+    CHECK(unit.info.timestamp == 4000);
+    CHECK(unit.info.firstSeq == 2);
+    CHECK(unit.info.lastSeq == 3);
+    CHECK(unit.info.complete());
+    CHECK((unit.data == std::vector<uint8_t>{0, 0, 0, 1, 0x01, 3, 4}));
+
+    CHECK(h.units[2].info.timestamp == 7000);
+    CHECK(h.units[2].info.complete());
+}
+
+/// A packet closing one unit by its timestamp and its own by the marker. The first throws, the second still arrives.
+void TestThrowWithTwoUnitsReady() {
+    Harness h;
+    h.throwAt = {1000};
+
+    CHECK(!h.Push(1, 1000, false, {0x65, 1}));
+    CHECK(h.Push(2, 4000, true, {0x41, 2}));
+
+    CHECK(h.thrown == 1);
+    CHECK(h.units.size() == 2);
+    CHECK(h.units[1].info.timestamp == 4000);
+    CHECK(h.units[1].info.firstSeq == 2);
+    CHECK(h.units[1].info.complete());
+
+    // The sequence numbers went on from the throwing packet, no loss is reported.
+    CHECK(!h.Push(3, 7000, true, {0x41, 3}));
+    CHECK(h.units.size() == 3);
+    CHECK(h.units[2].info.complete());
+}
+
+/// The marker unit throws. The depacketizer carries on with the next packet.
+void TestThrowOnMarker() {
+    Harness h;
+    h.throwAt = {1000};
+
+    CHECK(h.Push(1, 1000, true, {0x65, 1}));
+    CHECK(!h.Push(2, 4000, true, {0x41, 2}));
+
+    CHECK(h.units.size() == 2);
+    CHECK(h.units[1].info.firstSeq == 2);
+    CHECK(h.units[1].info.complete());
+}
+
+} // namespace
+
+int main() {
+    TestThrowOnTimestampChange();
+    TestThrowWithTwoUnitsReady();
+    TestThrowOnMarker();
+
+    printf("rtp_depacketizer_test passed\n");
+    return 0;
+}
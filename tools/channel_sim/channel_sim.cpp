@@ -0,0 +1,694 @@
+// Offline wfb-ng link simulator.
+//
+// Packets go through the real Transmitter (FEC encoding, encryption, session keys), a loss/delay/reorder channel
+// model and the real Aggregator, on a simulated clock, so a fade profile is replayed thousands of times faster
+// than real time and without radios. The FEC policies are evaluated on the way, open loop: they report the
+// level they'd ask for, the link keeps the (k, n) it was given.
+
+#include <getopt.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <queue>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "fec_policy.h"
+#include "linux/transmitter.h"
+#include "temp_keys.h"
+#include "wfb-ng/rx.hpp"
+
+namespace {
+
+/// Simulated time in microseconds, drives the aggregator deadlines and the policy clock.
+uint64_t sim_time_us = 0;
+
+uint64_t sim_time_ms() {
+    return sim_time_us / 1000;
+}
+
+/// Marks every simulated payload so the receiving end can tell what arrived and when it was sent.
+struct __attribute__((packed)) SimPayloadHeader {
+    uint32_t seq;
+    uint64_t sent_us;
+};
+
+struct Config {
+    int k = 8;
+    int n = 12;
+    double packet_rate = 1000;   // packets per second
+    size_t payload_size = 1200;  // bytes
+    double duration_s = 60;
+    std::string model = "iid";
+    double loss = 0.05;          // iid
+    double p_gb = 0.01;          // Gilbert-Elliott
+    double p_bg = 0.3;
+    double loss_good = 0.0;
+    double loss_bad = 1.0;
+    std::string trace_path;
+    double delay_ms = 2;
+    double jitter_ms = 0;
+    uint32_t latency_budget_ms = 0;
+    uint32_t block_deadline_ms = 0;
+    uint32_t seed = 1;
+};
+
+// Loss models
+
+class LossModel {
+public:
+    virtual ~LossModel() = default;
+
+    /// Whether the fragment sent at `now_us` is lost.
+    virtual bool lose(uint64_t now_us, std::mt19937 &rng) = 0;
+
+    virtual std::string describe() const = 0;
+};
+
+/// Independent losses with a fixed probability.
+class BernoulliLoss : public LossModel {
+public:
+    explicit BernoulliLoss(double p) : p_(p) {}
+
+    bool lose(uint64_t, std::mt19937 &rng) override {
+        return std::uniform_real_distribution<>()(rng) < p_;
+    }
+
+    std::string describe() const override {
+        return string_format("iid, loss %.4f", p_);
+    }
+
+private:
+    double p_;
+};
+
+/// Two-state Markov channel, one transition per fragment, with a loss probability per state.
+class GilbertElliottLoss : public LossModel {
+public:
+    GilbertElliottLoss(double p_gb, double p_bg, double loss_good, double loss_bad)
+        : p_gb_(p_gb), p_bg_(p_bg), loss_good_(loss_good), loss_bad_(loss_bad) {}
+
+    bool lose(uint64_t, std::mt19937 &rng) override {
+        std::uniform_real_distribution<> uniform;
+        bad_ = bad_ ? uniform(rng) >= p_bg_ : uniform(rng) < p_gb_;
+        return uniform(rng) < (bad_ ? loss_bad_ : loss_good_);
+    }
+
+    std::string describe() const override {
+        return string_format("Gilbert-Elliott, P(good->bad) %.4f, P(bad->good) %.4f, loss good %.3f, bad %.3f",
+                             p_gb_,
+                             p_bg_,
+                             loss_good_,
+                             loss_bad_);
+    }
+
+private:
+    double p_gb_, p_bg_, loss_good_, loss_bad_;
+    bool bad_ = false;
+};
+
+/// Replays a loss rate profile, e.g. one second per line from recorded link stats.
+/// Lines are "<time_ms> <loss probability>", the rate holds until the next line and the trace loops.
+class TraceLoss : public LossModel {
+public:
+    explicit TraceLoss(const std::string &path) : path_(path) {
+        std::ifstream file(path);
+        if (!file) {
+            throw std::runtime_error(string_format("Unable to open trace %s", path.c_str()));
+        }
+
+        uint64_t time_ms;
+        double p;
+        while (file >> time_ms >> p) {
+            points_.emplace_back(time_ms, p);
+        }
+        if (points_.empty()) {
+            throw std::runtime_error(string_format("Trace %s is empty", path.c_str()));
+        }
+        std::sort(points_.begin(), points_.end());
+
+        // The last rate lasts as long as the step before it
+        const uint64_t last_step = points_.size() > 1 ? points_.back().first - points_[points_.size() - 2].first : 1000;
+        length_ms_ = points_.back().first + last_step;
+    }
+
+    bool lose(uint64_t now_us, std::mt19937 &rng) override {
+        const uint64_t t = (now_us / 1000) % length_ms_;
+        auto it = std::upper_bound(points_.begin(), points_.end(), std::make_pair(t, 2.0));
+        const double p = it == points_.begin() ? points_.front().second : std::prev(it)->second;
+        return std::uniform_real_distribution<>()(rng) < p;
+    }
+
+    std::string describe() const override {
+        return string_format("trace %s, %zu points over %" PRIu64 " ms", path_.c_str(), points_.size(), length_ms_);
+    }
+
+private:
+    std::string path_;
+    std::vector<std::pair<uint64_t, double>> points_;
+    uint64_t length_ms_;
+};
+
+// What was sent and what came out, indexed by payload sequence number
+
+struct Record {
+    uint64_t sent_us = 0;
+    bool lost_on_air = false;
+    bool delivered = false;
+};
+
+struct SimStats {
+    std::vector<Record> packets;
+    /// Send time of each block's first packet
+    std::vector<uint64_t> block_start_us;
+
+    uint64_t fragments_sent = 0;
+    uint64_t fragments_lost = 0;
+    uint64_t payload_bytes_delivered = 0;
+    /// Blocks that left the RX ring with data fragments missing, and whether FEC made up for them
+    uint64_t blocks_recovered = 0;
+    uint64_t blocks_lost = 0;
+
+    std::vector<double> delivery_latency_ms;
+    std::vector<double> recovery_latency_ms;
+    std::vector<double> block_completion_ms;
+};
+
+/// Loses, delays and reorders fragments on their way to the aggregator.
+class SimChannel {
+public:
+    SimChannel(std::unique_ptr<LossModel> loss, double delay_ms, double jitter_ms, uint32_t seed)
+        : loss_(std::move(loss)), delay_us_(delay_ms * 1000), jitter_us_(jitter_ms * 1000), rng_(seed) {}
+
+    /// Returns false if the fragment is lost.
+    bool send(const uint8_t *buf, size_t size) {
+        if (loss_->lose(sim_time_us, rng_)) {
+            return false;
+        }
+
+        uint64_t arrival = sim_time_us + static_cast<uint64_t>(delay_us_);
+        if (jitter_us_ > 0) {
+            arrival += static_cast<uint64_t>(std::uniform_real_distribution<>(0, jitter_us_)(rng_));
+        }
+        in_flight_.push({arrival, next_id_++, std::vector<uint8_t>(buf, buf + size)});
+        return true;
+    }
+
+    /// Arrival time of the next fragment, UINT64_MAX if none is in flight.
+    uint64_t next_arrival() const {
+        return in_flight_.empty() ? UINT64_MAX : in_flight_.top().arrival_us;
+    }
+
+    /// Hand everything that has arrived by now to `aggregator`.
+    void deliver(Aggregator &aggregator) {
+        static const uint8_t antenna[RX_ANT_MAX] = {0};
+        static const int8_t rssi[RX_ANT_MAX] = {-50};
+        static const int8_t noise[RX_ANT_MAX] = {-90};
+
+        while (!in_flight_.empty() && in_flight_.top().arrival_us <= sim_time_us) {
+            const auto &fragment = in_flight_.top();
+            aggregator.process_packet(
+                fragment.data.data(), fragment.data.size(), 0, antenna, rssi, noise, 0, 0, 0, nullptr);
+            in_flight_.pop();
+        }
+    }
+
+    const LossModel &loss_model() const {
+        return *loss_;
+    }
+
+private:
+    struct InFlight {
+        uint64_t arrival_us;
+        uint64_t id; // keeps equal arrival times in send order
+        std::vector<uint8_t> data;
+
+        bool operator>(const InFlight &other) const {
+            return arrival_us != other.arrival_us ? arrival_us > other.arrival_us : id > other.id;
+        }
+    };
+
+    std::unique_ptr<LossModel> loss_;
+    double delay_us_;
+    double jitter_us_;
+    std::mt19937 rng_;
+    uint64_t next_id_ = 0;
+    std::priority_queue<InFlight, std::vector<InFlight>, std::greater<>> in_flight_;
+};
+
+/// The real transmitter, injecting into the simulated channel.
+class SimTransmitter : public Transmitter {
+public:
+    SimTransmitter(const Config &config, const std::string &keypair, uint32_t channel_id, SimChannel &channel,
+                   SimStats &stats)
+        : Transmitter(config.k, config.n, keypair, 0, channel_id), channel_(channel), stats_(stats) {}
+
+    /// Send payload `seq`, the first fragment injected afterwards is its own.
+    void send_payload(uint32_t seq, const uint8_t *buf, size_t size) {
+        pending_seq_ = seq;
+        sendPacket(buf, size, 0);
+        pending_seq_ = NO_SEQ;
+    }
+
+    void selectOutput(int) override {}
+
+    void dumpStats(FILE *, uint64_t, uint32_t &, uint32_t &, uint32_t &) override {}
+
+protected:
+    void injectPacket(uint8_t *buf, size_t size) override {
+        const bool delivered = channel_.send(buf, size);
+
+        stats_.fragments_sent++;
+        if (!delivered) {
+            stats_.fragments_lost++;
+        }
+
+        if (pending_seq_ != NO_SEQ) {
+            stats_.packets[pending_seq_].lost_on_air = !delivered;
+            pending_seq_ = NO_SEQ;
+        }
+    }
+
+private:
+    static constexpr uint32_t NO_SEQ = UINT32_MAX;
+
+    SimChannel &channel_;
+    SimStats &stats_;
+    uint32_t pending_seq_ = NO_SEQ;
+};
+
+/// The real aggregator on the simulated clock, recording what it outputs.
+class SimAggregator : public Aggregator {
+public:
+    SimAggregator(const std::string &keypair, uint32_t channel_id, SimStats &stats, FecPolicy &policy)
+        : Aggregator(keypair, 0, channel_id), stats_(stats), policy_(policy) {}
+
+protected:
+    uint64_t clock_ms() override {
+        return sim_time_ms();
+    }
+
+    void send_to_socket(const uint8_t *payload, uint16_t packet_size) override {
+        if (packet_size < sizeof(SimPayloadHeader)) {
+            return;
+        }
+
+        SimPayloadHeader header;
+        memcpy(&header, payload, sizeof(header));
+        if (header.seq >= stats_.packets.size() || stats_.packets[header.seq].delivered) {
+            return;
+        }
+
+        Record &record = stats_.packets[header.seq];
+        record.delivered = true;
+        stats_.payload_bytes_delivered += packet_size;
+
+        const double latency_ms = (sim_time_us - record.sent_us) / 1000.0;
+        stats_.delivery_latency_ms.push_back(latency_ms);
+        if (record.lost_on_air) {
+            stats_.recovery_latency_ms.push_back(latency_ms);
+        }
+    }
+
+    void on_block_done(uint64_t block_idx, const size_t *fragment_map, int observed, int fec_k, int fec_n) override {
+        if (block_idx < stats_.block_start_us.size()) {
+            stats_.block_completion_ms.push_back((sim_time_us - stats_.block_start_us[block_idx]) / 1000.0);
+        }
+
+        int received = 0;
+        bool data_missing = false;
+        for (int i = 0; i < observed; i++) {
+            if (fragment_map[i]) {
+                received++;
+            } else if (i < fec_k) {
+                data_missing = true;
+            }
+        }
+        if (received < fec_k) {
+            stats_.blocks_lost++;
+        } else if (data_missing) {
+            stats_.blocks_recovered++;
+        }
+
+        policy_.on_block(fragment_map, observed, fec_k, fec_n);
+    }
+
+private:
+    SimStats &stats_;
+    FecPolicy &policy_;
+};
+
+/// BurstFecPolicy forgetting on the simulated clock.
+class SimBurstFecPolicy : public BurstFecPolicy {
+protected:
+    Clock::time_point now() const override {
+        return Clock::time_point(std::chrono::microseconds(sim_time_us));
+    }
+};
+
+double percentile(std::vector<double> &values, double p) {
+    if (values.empty()) {
+        return 0;
+    }
+    const size_t idx = std::min(values.size() - 1, static_cast<size_t>(p * values.size()));
+    std::nth_element(values.begin(), values.begin() + idx, values.end());
+    return values[idx];
+}
+
+double average(const std::vector<double> &values) {
+    double sum = 0;
+    for (double v : values) {
+        sum += v;
+    }
+    return values.empty() ? 0 : sum / values.size();
+}
+
+void print_distribution(const char *name, std::vector<double> &values) {
+    if (values.empty()) {
+        printf("%-22s none\n", name);
+        return;
+    }
+    const double max = *std::max_element(values.begin(), values.end());
+    printf("%-22s avg %.2f, p50 %.2f, p99 %.2f, max %.2f ms (%zu samples)\n",
+           name,
+           average(values),
+           percentile(values, 0.5),
+           percentile(values, 0.99),
+           max,
+           values.size());
+}
+
+/// Running policy evaluation, the quality over the last second in 100 ms slots like the alink thread sees it.
+struct PolicyTracker {
+    static constexpr size_t SLOTS = 10;
+
+    rx_stats_t slots[SLOTS] = {};
+    size_t slot = 0;
+    rx_stats_t total = {};
+
+    uint64_t samples = 0;
+    uint64_t level_sum[2] = {};
+    int level_max[2] = {};
+
+    void sample(Aggregator &aggregator, FecPolicy &threshold, FecPolicy &burst) {
+        roll(aggregator, slots[slot]);
+        slot = (slot + 1) % SLOTS;
+
+        SignalQualityCalculator::SignalQuality quality;
+        for (const auto &s : slots) {
+            quality.lost_last_second += s.count_p_lost;
+            quality.recovered_last_second += s.count_p_fec_recovered;
+            quality.total_last_second += s.count_p_all;
+        }
+
+        const int levels[2] = {threshold.required_level(quality, 0), burst.required_level(quality, 0)};
+        for (int i = 0; i < 2; i++) {
+            level_sum[i] += levels[i];
+            level_max[i] = std::max(level_max[i], levels[i]);
+        }
+        samples++;
+    }
+
+    /// Counters since the last call, also added to the run totals.
+    void roll(Aggregator &aggregator, rx_stats_t &stats) {
+        aggregator.roll_stats(stats);
+        total.count_p_fec_recovered += stats.count_p_fec_recovered;
+        total.count_p_lost += stats.count_p_lost;
+        total.count_p_dec_err += stats.count_p_dec_err;
+        total.count_blk_completed += stats.count_blk_completed;
+        total.count_blk_deadline += stats.count_blk_deadline;
+    }
+};
+
+void usage(const char *name) {
+    fprintf(stderr,
+            "Offline wfb-ng channel simulator\n\n"
+            "Usage: %s [options]\n"
+            "  -k <k>            primary fragments per FEC block (default 8)\n"
+            "  -n <n>            total fragments per FEC block (default 12)\n"
+            "  -r <rate>         payload packets per second (default 1000)\n"
+            "  -s <size>         payload size in bytes (default 1200)\n"
+            "  -t <seconds>      simulated duration (default 60)\n"
+            "  -m <model>        loss model: iid, ge or trace (default iid)\n"
+            "  -p <loss>         iid loss probability (default 0.05)\n"
+            "  -g <p>            GE P(good->bad) per fragment (default 0.01)\n"
+            "  -b <p>            GE P(bad->good) per fragment (default 0.3)\n"
+            "  -G <loss>         GE loss probability in the good state (default 0)\n"
+            "  -B <loss>         GE loss probability in the bad state (default 1)\n"
+            "  -f <file>         trace: lines of \"<time_ms> <loss probability>\", looped\n"
+            "  -d <ms>           channel delay (default 2)\n"
+            "  -j <ms>           uniform delay jitter, reorders fragments (default 0)\n"
+            "  -L <ms>           RX ring latency budget, 0 for the fixed ring (default 0)\n"
+            "  -D <ms>           FEC block deadline, 0 to disable (default 0)\n"
+            "  -S <seed>         random seed (default 1)\n",
+            name);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    Config config;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "k:n:r:s:t:m:p:g:b:G:B:f:d:j:L:D:S:h")) != -1) {
+        switch (opt) {
+            case 'k':
+                config.k = atoi(optarg);
+                break;
+            case 'n':
+                config.n = atoi(optarg);
+                break;
+            case 'r':
+                config.packet_rate = atof(optarg);
+                break;
+            case 's':
+                config.payload_size = atoi(optarg);
+                break;
+            case 't':
+                config.duration_s = atof(optarg);
+                break;
+            case 'm':
+                config.model = optarg;
+                break;
+            case 'p':
+                config.loss = atof(optarg);
+                break;
+            case 'g':
+                config.p_gb = atof(optarg);
+                break;
+            case 'b':
+                config.p_bg = atof(optarg);
+                break;
+            case 'G':
+                config.loss_good = atof(optarg);
+                break;
+            case 'B':
+                config.loss_bad = atof(optarg);
+                break;
+            case 'f':
+                config.trace_path = optarg;
+                break;
+            case 'd':
+                config.delay_ms = atof(optarg);
+                break;
+            case 'j':
+                config.jitter_ms = atof(optarg);
+                break;
+            case 'L':
+                config.latency_budget_ms = atoi(optarg);
+                break;
+            case 'D':
+                config.block_deadline_ms = atoi(optarg);
+                break;
+            case 'S':
+                config.seed = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (config.k < 1 || config.n < config.k || config.n > 255 || config.packet_rate <= 0 ||
+        config.payload_size < sizeof(SimPayloadHeader) || config.payload_size > MAX_PAYLOAD_SIZE) {
+        fprintf(stderr, "Invalid k/n, rate or payload size\n");
+        return 1;
+    }
+
+    if (sodium_init() < 0) {
+        fprintf(stderr, "Libsodium init failed\n");
+        return 1;
+    }
+
+    try {
+        std::unique_ptr<LossModel> loss;
+        if (config.model == "iid") {
+            loss = std::make_unique<BernoulliLoss>(config.loss);
+        } else if (config.model == "ge") {
+            loss = std::make_unique<GilbertElliottLoss>(config.p_gb, config.p_bg, config.loss_good, config.loss_bad);
+        } else if (config.model == "trace") {
+            loss = std::make_unique<TraceLoss>(config.trace_path);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+
+        constexpr uint32_t channel_id = (7669206 << 8) + 0;
+        constexpr uint64_t tick_us = 10000;           // RX pipeline tick
+        constexpr uint64_t policy_interval_us = 100000; // alink period
+        constexpr uint64_t session_interval_us = 1000000;
+
+        const TempKeys keys;
+        SimStats stats;
+        SimChannel channel(std::move(loss), config.delay_ms, config.jitter_ms, config.seed);
+        ThresholdFecPolicy threshold_policy;
+        SimBurstFecPolicy burst_policy;
+        SimTransmitter tx(config, keys.tx_path, channel_id, channel, stats);
+        SimAggregator rx(keys.rx_path, channel_id, stats, burst_policy);
+        rx.set_latency_budget(config.latency_budget_ms);
+        rx.set_block_deadline(config.block_deadline_ms);
+
+        const uint64_t end_us = static_cast<uint64_t>(config.duration_s * 1e6);
+        const double packet_interval_us = 1e6 / config.packet_rate;
+        const size_t total_packets = static_cast<size_t>(config.duration_s * config.packet_rate);
+        stats.packets.resize(total_packets);
+        stats.block_start_us.reserve(total_packets / config.k + 1);
+
+        std::vector<uint8_t> payload(config.payload_size, 0);
+        PolicyTracker policies;
+
+        const auto wall_start = std::chrono::steady_clock::now();
+
+        uint32_t next_seq = 0;
+        uint64_t next_tick_us = 0;
+        uint64_t next_policy_us = policy_interval_us;
+        uint64_t next_session_us = 0;
+
+        const auto next_packet_us = [&] {
+            return next_seq < total_packets ? static_cast<uint64_t>(next_seq * packet_interval_us) : UINT64_MAX;
+        };
+
+        while (true) {
+            const uint64_t next_event =
+                std::min({next_packet_us(), channel.next_arrival(), next_tick_us, next_session_us});
+            if (next_event >= end_us && next_packet_us() == UINT64_MAX && channel.next_arrival() == UINT64_MAX) {
+                break;
+            }
+            sim_time_us = next_event;
+
+            channel.deliver(rx);
+
+            if (sim_time_us == next_session_us) {
+                tx.sendSessionKey();
+                next_session_us = sim_time_us < end_us ? sim_time_us + session_interval_us : UINT64_MAX;
+            }
+
+            if (sim_time_us == next_packet_us()) {
+                const uint32_t seq = next_seq++;
+                if (seq % config.k == 0) {
+                    stats.block_start_us.push_back(sim_time_us);
+                }
+                stats.packets[seq].sent_us = sim_time_us;
+
+                const SimPayloadHeader header{seq, sim_time_us};
+                memcpy(payload.data(), &header, sizeof(header));
+                tx.send_payload(seq, payload.data(), payload.size());
+
+                if (next_seq == total_packets) {
+                    // Close the last block with FEC-only fragments, like the TX does on its FEC timeout
+                    while (tx.sendPacket(payload.data(), 0, WFB_PACKET_FEC_ONLY)) {
+                    }
+                }
+            }
+
+            if (sim_time_us == next_tick_us) {
+                rx.flush_expired();
+                if (sim_time_us >= next_policy_us) {
+                    policies.sample(rx, threshold_policy, burst_policy);
+                    next_policy_us += policy_interval_us;
+                }
+                next_tick_us += tick_us;
+            }
+        }
+
+        // Give the deadline a chance to flush what's left
+        sim_time_us += (rx.get_block_deadline() + 1) * 1000;
+        rx.flush_expired();
+
+        const double wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+
+        // Everything since the last policy sample
+        rx_stats_t rest;
+        policies.roll(rx, rest);
+        const rx_stats_t &totals = policies.total;
+
+        uint64_t delivered = 0;
+        for (const auto &record : stats.packets) {
+            delivered += record.delivered;
+        }
+
+        const double sim_s = sim_time_us / 1e6;
+
+        printf("Channel:               %s, delay %.1f ms, jitter %.1f ms\n",
+               channel.loss_model().describe().c_str(),
+               config.delay_ms,
+               config.jitter_ms);
+        printf("FEC:                   k %d, n %d, %.0f packets/s of %zu bytes\n",
+               config.k,
+               config.n,
+               config.packet_rate,
+               config.payload_size);
+        printf("RX ring:               %d blocks, latency budget %u ms, block deadline %u ms, now %u ms\n",
+               rx.get_rx_ring_size(),
+               config.latency_budget_ms,
+               config.block_deadline_ms,
+               rx.get_block_deadline());
+        printf("Fragments on air:      %" PRIu64 " sent, %" PRIu64 " lost (%.3f%%)\n",
+               stats.fragments_sent,
+               stats.fragments_lost,
+               stats.fragments_sent ? 100.0 * stats.fragments_lost / stats.fragments_sent : 0.0);
+        printf("Packets:               %zu sent, %" PRIu64 " delivered, residual loss %.4f%%\n",
+               stats.packets.size(),
+               delivered,
+               stats.packets.empty() ? 0.0 : 100.0 * (stats.packets.size() - delivered) / stats.packets.size());
+        printf("Goodput:               %.3f Mbit/s\n", stats.payload_bytes_delivered * 8 / sim_s / 1e6);
+        print_distribution("Delivery latency:", stats.delivery_latency_ms);
+        print_distribution("FEC recovery latency:", stats.recovery_latency_ms);
+        print_distribution("Block completion:", stats.block_completion_ms);
+        printf("Aggregator:            %u recovered by FEC, %u lost, %u decryption errors\n",
+               totals.count_p_fec_recovered,
+               totals.count_p_lost,
+               totals.count_p_dec_err);
+        printf("Blocks:                %u completed, %u flushed at the deadline\n",
+               totals.count_blk_completed,
+               totals.count_blk_deadline);
+        printf("Damaged blocks:        %" PRIu64 " recovered by FEC, %" PRIu64 " lost\n",
+               stats.blocks_recovered,
+               stats.blocks_lost);
+
+        if (policies.samples > 0) {
+            const auto model = burst_policy.model();
+            printf("FEC policy threshold:  average level %.2f, max %d\n",
+                   static_cast<double>(policies.level_sum[0]) / policies.samples,
+                   policies.level_max[0]);
+            printf("FEC policy burst:      average level %.2f, max %d, fit P(good->bad) %.4f, P(bad->good) %.4f\n",
+                   static_cast<double>(policies.level_sum[1]) / policies.samples,
+                   policies.level_max[1],
+                   model.p_gb,
+                   model.p_bg);
+        }
+
+        printf("Simulated %.1f s in %.2f s (%.0fx real time)\n", sim_s, wall_s, wall_s > 0 ? sim_s / wall_s : 0.0);
+    } catch (const std::exception &e) {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+
+    return 0;
+}
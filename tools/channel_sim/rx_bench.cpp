@@ -0,0 +1,273 @@
+// Micro-benchmark of the wfb-ng RX hot path.
+//
+// The real Transmitter encrypts and FEC-encodes a run of packets up front, then Aggregator::process_packet() is
+// timed on them: decryption, the RX ring and, with fragments dropped, FEC recovery. A fresh aggregator takes each
+// pass, after the session key, so every pass sees new blocks.
+//
+// Next to the timing, the bytes written per fragment are worked out from the fragments fed, for the current path
+// (decryption in place, zero padding only what FEC recovery reads) and for the one it replaced (decryption into a
+// stack buffer, then the whole ring slot memset and the plaintext memcpy'd in).
+
+#include <getopt.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "linux/transmitter.h"
+#include "temp_keys.h"
+#include "wfb-ng/rx.hpp"
+
+namespace {
+
+struct Config {
+    int k = 8;
+    int n = 12;
+    size_t payload_size = 1400; // bytes
+    size_t packets = 20000;
+    int drop_every = 0;         // drop every n-th data fragment, 0 for none
+    int passes = 10;
+};
+
+/// Keeps every injected packet.
+class CaptureTransmitter : public Transmitter {
+public:
+    CaptureTransmitter(const Config &config, const std::string &keypair, uint32_t channel_id)
+        : Transmitter(config.k, config.n, keypair, 0, channel_id) {}
+
+    void selectOutput(int) override {}
+
+    void dumpStats(FILE *, uint64_t, uint32_t &, uint32_t &, uint32_t &) override {}
+
+    std::vector<std::vector<uint8_t>> packets;
+
+protected:
+    void injectPacket(uint8_t *buf, size_t size) override {
+        packets.emplace_back(buf, buf + size);
+    }
+};
+
+/// Counts what comes out.
+class CountingAggregator : public Aggregator {
+public:
+    CountingAggregator(const std::string &keypair, uint32_t channel_id) : Aggregator(keypair, 0, channel_id) {}
+
+    uint64_t delivered = 0;
+
+protected:
+    void send_to_socket(const uint8_t *, uint16_t) override {
+        delivered++;
+    }
+};
+
+/// Bytes process_packet() writes for a run of fragments
+struct BytesWritten {
+    /// Decryption output, the same for both paths: every fragment is decrypted before the ring is looked at
+    uint64_t decrypted = 0;
+    /// Old path: the ring slot of each stored fragment cleared, then the plaintext copied in
+    uint64_t memset = 0;
+    uint64_t memcpy = 0;
+    /// Current path: the inputs of a FEC recovery zeroed up to the rounded FEC size, see Aggregator::apply_fec()
+    uint64_t fec_padding = 0;
+};
+
+/// Follows the aggregator through in-order fragments: a block stores what arrives until it has k fragments, then
+/// it's done and the rest is dropped. FEC recovery runs if a data fragment is missing by then.
+BytesWritten count_bytes_written(const std::vector<const std::vector<uint8_t> *> &fragments, int k) {
+    BytesWritten bytes;
+
+    struct Stored {
+        uint8_t index;
+        size_t size;
+    };
+    std::vector<Stored> stored;
+    uint64_t block = UINT64_MAX;
+
+    const auto finish_block = [&] {
+        const bool recover = static_cast<int>(stored.size()) == k &&
+                             std::any_of(stored.begin(), stored.end(), [k](const Stored &f) { return f.index >= k; });
+        if (recover) {
+            size_t max_size = 0;
+            for (const auto &fragment : stored) {
+                if (fragment.index >= k) {
+                    max_size = std::max(max_size, fragment.size);
+                }
+            }
+            const size_t fec_size = ZFEX_ROUND_UP_SIMD(max_size);
+            for (const auto &fragment : stored) {
+                bytes.fec_padding += fec_size > fragment.size ? fec_size - fragment.size : 0;
+            }
+        }
+        stored.clear();
+    };
+
+    for (const auto *fragment : fragments) {
+        const auto *header = reinterpret_cast<const wblock_hdr_t *>(fragment->data());
+        const uint64_t nonce = be64toh(header->data_nonce);
+        const size_t size = fragment->size() - sizeof(wblock_hdr_t) - crypto_aead_chacha20poly1305_ABYTES;
+
+        if (nonce >> 8 != block) {
+            finish_block();
+            block = nonce >> 8;
+        }
+
+        bytes.decrypted += size;
+        if (static_cast<int>(stored.size()) < k) {
+            stored.push_back({static_cast<uint8_t>(nonce & 0xff), size});
+            bytes.memset += MAX_FEC_PAYLOAD;
+            bytes.memcpy += size;
+        }
+    }
+    finish_block();
+
+    return bytes;
+}
+
+void usage(const char *name) {
+    fprintf(stderr,
+            "wfb-ng RX path micro-benchmark\n\n"
+            "Usage: %s [options]\n"
+            "  -k <k>            primary fragments per FEC block (default 8)\n"
+            "  -n <n>            total fragments per FEC block (default 12)\n"
+            "  -s <size>         payload size in bytes (default 1400)\n"
+            "  -c <count>        payload packets per pass (default 20000)\n"
+            "  -d <every>        drop every n-th data fragment so FEC recovers it, 0 for none (default 0)\n"
+            "  -p <passes>       timed passes (default 10)\n",
+            name);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    Config config;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "k:n:s:c:d:p:h")) != -1) {
+        switch (opt) {
+            case 'k':
+                config.k = atoi(optarg);
+                break;
+            case 'n':
+                config.n = atoi(optarg);
+                break;
+            case 's':
+                config.payload_size = atoi(optarg);
+                break;
+            case 'c':
+                config.packets = atoi(optarg);
+                break;
+            case 'd':
+                config.drop_every = atoi(optarg);
+                break;
+            case 'p':
+                config.passes = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (config.k < 1 || config.n < config.k || config.n > 255 || config.payload_size == 0 ||
+        config.payload_size > MAX_PAYLOAD_SIZE || config.packets == 0 || config.passes < 1) {
+        fprintf(stderr, "Invalid k/n, payload size, count or passes\n");
+        return 1;
+    }
+
+    if (sodium_init() < 0) {
+        fprintf(stderr, "Libsodium init failed\n");
+        return 1;
+    }
+
+    try {
+        constexpr uint32_t channel_id = (7669206 << 8) + 0;
+
+        const TempKeys keys;
+        CaptureTransmitter tx(config, keys.tx_path, channel_id);
+
+        tx.sendSessionKey();
+        const std::vector<uint8_t> session = tx.packets.front();
+        tx.packets.clear();
+
+        std::vector<uint8_t> payload(config.payload_size);
+        for (size_t i = 0; i < config.packets; i++) {
+            memcpy(payload.data(), &i, std::min(sizeof(i), payload.size()));
+            tx.sendPacket(payload.data(), payload.size(), 0);
+        }
+
+        // Data fragments are the first k of each block
+        std::vector<const std::vector<uint8_t> *> fragments;
+        size_t data_fragments = 0;
+        for (size_t i = 0; i < tx.packets.size(); i++) {
+            const bool data = static_cast<int>(i % config.n) < config.k;
+            if (data && config.drop_every > 0 && ++data_fragments % config.drop_every == 0) {
+                continue;
+            }
+            fragments.push_back(&tx.packets[i]);
+        }
+
+        static const uint8_t antenna[RX_ANT_MAX] = {0};
+        static const int8_t rssi[RX_ANT_MAX] = {-50};
+        static const int8_t noise[RX_ANT_MAX] = {-90};
+
+        std::vector<double> ns_per_fragment;
+        uint64_t delivered = 0;
+        rx_stats_t stats = {};
+
+        for (int pass = 0; pass < config.passes; pass++) {
+            CountingAggregator rx(keys.rx_path, channel_id);
+            rx.process_packet(session.data(), session.size(), 0, antenna, rssi, noise, 0, 0, 0, nullptr);
+
+            const auto start = std::chrono::steady_clock::now();
+            for (const auto *fragment : fragments) {
+                rx.process_packet(fragment->data(), fragment->size(), 0, antenna, rssi, noise, 0, 0, 0, nullptr);
+            }
+            const auto elapsed = std::chrono::steady_clock::now() - start;
+
+            ns_per_fragment.push_back(std::chrono::duration<double, std::nano>(elapsed).count() / fragments.size());
+            delivered = rx.delivered;
+            rx.roll_stats(stats);
+        }
+
+        const BytesWritten bytes = count_bytes_written(fragments, config.k);
+        const double per_fragment = 1.0 / fragments.size();
+
+        std::sort(ns_per_fragment.begin(), ns_per_fragment.end());
+        const double best = ns_per_fragment.front();
+        const double median = ns_per_fragment[ns_per_fragment.size() / 2];
+
+        printf("Fragments:             %zu per pass of %zu sent, k %d, n %d, %zu byte payloads\n",
+               fragments.size(),
+               tx.packets.size(),
+               config.k,
+               config.n,
+               config.payload_size);
+        printf("Delivered:             %" PRIu64 " of %zu packets, %u recovered by FEC in the last pass\n",
+               delivered,
+               config.packets,
+               stats.count_p_fec_recovered);
+        printf("process_packet:        best %.0f ns, median %.0f ns per fragment over %d passes\n",
+               best,
+               median,
+               config.passes);
+        printf("Throughput:            %.0f MB/s of payload at the median\n", config.payload_size * 1e3 / median);
+        printf("Bytes written, old:    %.0f per fragment: decrypt %.0f, memset %.0f, memcpy %.0f\n",
+               (bytes.decrypted + bytes.memset + bytes.memcpy) * per_fragment,
+               bytes.decrypted * per_fragment,
+               bytes.memset * per_fragment,
+               bytes.memcpy * per_fragment);
+        printf("Bytes written, now:    %.0f per fragment: decrypt %.0f, FEC padding %.0f\n",
+               (bytes.decrypted + bytes.fec_padding) * per_fragment,
+               bytes.decrypted * per_fragment,
+               bytes.fec_padding * per_fragment);
+    } catch (const std::exception &e) {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "wfb-ng/wifibroadcast.hpp"
+
+/// Writes a fresh TX/RX key pair to temporary files, removed again on destruction.
+class TempKeys {
+public:
+    TempKeys() {
+        uint8_t tx_secret[crypto_box_SECRETKEYBYTES], tx_public[crypto_box_PUBLICKEYBYTES];
+        uint8_t rx_secret[crypto_box_SECRETKEYBYTES], rx_public[crypto_box_PUBLICKEYBYTES];
+        crypto_box_keypair(tx_public, tx_secret);
+        crypto_box_keypair(rx_public, rx_secret);
+
+        tx_path = write_pair(tx_secret, rx_public);
+        rx_path = write_pair(rx_secret, tx_public);
+    }
+
+    ~TempKeys() {
+        unlink(tx_path.c_str());
+        unlink(rx_path.c_str());
+    }
+
+    std::string tx_path;
+    std::string rx_path;
+
+private:
+    static std::string write_pair(const uint8_t *secret_key, const uint8_t *public_key) {
+        char path[] = "/tmp/wfb_keys_XXXXXX";
+        const int fd = mkstemp(path);
+        if (fd < 0) {
+            throw std::runtime_error(string_format("Unable to create key file: %s", strerror(errno)));
+        }
+        const bool ok = write(fd, secret_key, crypto_box_SECRETKEYBYTES) == crypto_box_SECRETKEYBYTES &&
+                        write(fd, public_key, crypto_box_PUBLICKEYBYTES) == crypto_box_PUBLICKEYBYTES;
+        close(fd);
+        if (!ok) {
+            unlink(path);
+            throw std::runtime_error("Unable to write key file");
+        }
+        return path;
+    }
+};